@@ -60,11 +60,59 @@ namespace UTJ.FrameCapturer
             _24Bits = 24,
         }
 
+        public enum fcTaskPriority
+        {
+            RealTime,
+            Normal,
+            Background,
+        }
+
+        public enum fcBackpressurePolicy
+        {
+            Block,
+            DropNewest,
+            DropOldest,
+            Grow,
+            Spill,
+        }
+
 
 
         [DllImport ("fccore")] public static extern void         fcSetModulePath(string path);
         [DllImport ("fccore")] public static extern double       fcGetTime();
 
+        public struct fcSchedulerConfig
+        {
+            public int maxWorkers; // <= 0: number of logical cores - 1
+            public ulong affinityMask; // bit n: core n. 0: all cores
+            public int threadPriority; // nice value. -20 (highest) to 19 (lowest)
+            public IntPtr threadName; // const char*. IntPtr.Zero: "fcWorker"
+        }
+        [DllImport ("fccore")] public static extern void         fcSetSchedulerConfig(ref fcSchedulerConfig conf);
+        [DllImport ("fccore")] public static extern void         fcGetSchedulerConfig(ref fcSchedulerConfig conf);
+        [DllImport ("fccore")] public static extern void         fcTraceBegin(int maxSpansPerThread);
+        [DllImport ("fccore")] public static extern void         fcTraceEnd();
+        [DllImport ("fccore")] public static extern Bool         fcTraceDump(string path);
+
+        public struct fcBufferPoolStats
+        {
+            public ulong idleBytes;
+            public ulong peakIdleBytes;
+            public ulong inUseBytes;
+            public ulong peakInUseBytes;
+            public ulong numAllocations;
+            public ulong numReuses;
+            public ulong numTrimmed;
+        }
+        [DllImport ("fccore")] public static extern void         fcBufferPoolSetMaxIdleBytes(ulong maxIdleBytes);
+        [DllImport ("fccore")] public static extern void         fcBufferPoolTrim(ulong maxIdleBytes);
+        [DllImport ("fccore")] public static extern void         fcBufferPoolGetStats(ref fcBufferPoolStats dst);
+        [DllImport ("fccore")] public static extern void         fcSetMemoryBudget(ulong bytes);
+        [DllImport ("fccore")] public static extern ulong        fcGetMemoryBudget();
+        [DllImport ("fccore")] public static extern ulong        fcGetMemoryUsage();
+        [DllImport ("fccore")] public static extern ulong        fcGetPeakMemoryUsage();
+        [DllImport ("fccore")] public static extern void         fcSetSpillDirectory(string path);
+
 
         public struct fcDeferredCall
         {
@@ -80,7 +128,51 @@ namespace UTJ.FrameCapturer
             public static implicit operator bool(fcStream v) { return v.ptr != IntPtr.Zero; }
         }
         [DllImport ("fccore")] public static extern fcStream     fcCreateFileStream(string path);
-        [DllImport ("fccore")] public static extern fcStream     fcCreateMemoryStream();
+
+        public struct fcFileStreamConfig
+        {
+            public int bufferSize;
+            public int numBuffers;
+            public ulong preallocateSize;
+            public Bool useIOUring;
+            public Bool directIO;
+
+            public static fcFileStreamConfig default_value
+            {
+                get
+                {
+                    return new fcFileStreamConfig
+                    {
+                        bufferSize = 1024 * 1024,
+                        numBuffers = 4,
+                        preallocateSize = 0,
+                        useIOUring = false,
+                        directIO = false,
+                    };
+                }
+            }
+        };
+        [DllImport ("fccore")] public static extern fcStream     fcCreateBufferedFileStream(string path, ref fcFileStreamConfig conf);
+        // errno of the first failed write (e.g. disk full), 0 if none. call after releasing the contexts writing to s
+        [DllImport ("fccore")] public static extern int          fcFileStreamGetError(fcStream s);
+        // chunkSize: 0 is default (1MB)
+        [DllImport ("fccore")] public static extern fcStream     fcCreateMemoryStream(int chunkSize = 0);
+        public struct fcBufferData
+        {
+            public IntPtr data;
+            public UIntPtr size;
+        }
+        // merges chunks into one buffer. fcStreamGetChunk() avoids the copy
+        [DllImport ("fccore")] public static extern fcBufferData fcStreamGetBufferData(fcStream s);
+        [DllImport ("fccore")] public static extern int          fcStreamGetNumChunks(fcStream s);
+        [DllImport ("fccore")] public static extern fcBufferData fcStreamGetChunk(fcStream s, int i);
+
+        // ring buffer stream for pulling encoded data while recording. use append-only containers (fcWebMConfig.live, Ogg)
+        [DllImport ("fccore")] public static extern fcStream     fcCreateRingStream(UIntPtr capacity, fcSinkLagPolicy lagPolicy);
+        [DllImport ("fccore")] public static extern Bool         fcRingStreamPeek(fcStream s, ref fcBufferData dst, int timeoutMS);
+        [DllImport ("fccore")] public static extern void         fcRingStreamAdvance(fcStream s, UIntPtr n);
+        [DllImport ("fccore")] public static extern void         fcRingStreamClose(fcStream s);
+        [DllImport ("fccore")] public static extern ulong        fcRingStreamGetDroppedPatchBytes(fcStream s);
         [DllImport ("fccore")] private static extern void        fcReleaseStream(fcStream s);
         [DllImport ("fccore")] public static extern ulong        fcStreamGetWrittenSize(fcStream s);
 
@@ -88,6 +180,7 @@ namespace UTJ.FrameCapturer
         [DllImport ("fccore")] public static extern void         fcGuardEnd();
         [DllImport ("fccore")] public static extern fcDeferredCall fcAllocateDeferredCall();
         [DllImport ("fccore")] private static extern void        fcReleaseDeferredCall(fcDeferredCall dc);
+        [DllImport ("fccore")] public static extern fcDeferredCall fcAddDeferredCallBatch(int[] ids, int num, int id);
         [DllImport ("fccore")] public static extern IntPtr       fcGetRenderEventFunc();
 
         public static void fcGuard(Action body)
@@ -153,6 +246,112 @@ namespace UTJ.FrameCapturer
         [DllImport ("fccore")] public static extern void fcWaitAsyncDelete();
         [DllImport ("fccore")] public static extern void fcReleaseContext(IntPtr ctx);
 
+        public struct fcFrameStats
+        {
+            public ulong frames;
+            public ulong droppedFrames;
+            public ulong lateFrames;
+            public ulong spilledFrames;
+        }
+        [DllImport ("fccore")] public static extern Bool fcGetFrameStats(IntPtr ctx, ref fcFrameStats dst);
+
+        public struct fcLatencyStats
+        {
+            public ulong count;
+            public float p50; // in milliseconds
+            public float p99;
+            public float max;
+        }
+        public struct fcContextStats
+        {
+            public ulong framesSubmitted;
+            public ulong framesEncoded;
+            public ulong framesWritten;
+            public int queueDepth;
+            public int peakQueueDepth;
+            public int numStreams;
+            [MarshalAs(UnmanagedType.ByValArray, SizeConst = 8)] public ulong[] streamBytes;
+            [MarshalAs(UnmanagedType.ByValArray, SizeConst = 8)] public ulong[] streamPendingBytes;
+            public fcLatencyStats readback;
+            public fcLatencyStats convert;
+            public fcLatencyStats yuv;
+            public fcLatencyStats encode;
+            public fcLatencyStats write;
+            public ulong memoryBytes;
+        }
+        [DllImport ("fccore")] public static extern Bool fcGetContextStats(IntPtr ctx, ref fcContextStats dst);
+
+        public enum fcSinkLagPolicy
+        {
+            Block,
+            Detach,
+        }
+        public struct fcAsyncStreamConfig
+        {
+            public int maxQueueSize;
+            public fcSinkLagPolicy lagPolicy;
+
+            public static fcAsyncStreamConfig default_value
+            {
+                get
+                {
+                    return new fcAsyncStreamConfig
+                    {
+                        maxQueueSize = 64 * 1024 * 1024,
+                        lagPolicy = fcSinkLagPolicy.Block,
+                    };
+                }
+            }
+        };
+        public struct fcAsyncStreamStats
+        {
+            public ulong queuedBytes;
+            public ulong peakQueuedBytes;
+            public ulong writtenBytes;
+            public ulong stalls;
+            public fcLatencyStats lag;
+            public Bool detached;
+        }
+        // wrap sink so that a slow sink doesn't stall other output streams. register the returned stream to contexts instead of sink
+        [DllImport ("fccore")] public static extern fcStream fcCreateAsyncStream(fcStream sink, ref fcAsyncStreamConfig conf);
+        [DllImport ("fccore")] public static extern Bool fcGetAsyncStreamStats(fcStream s, ref fcAsyncStreamStats dst);
+
+        // finalize context on worker threads and poll / wait for completion. handle must be released by fcReleaseFinalizeHandle()
+        public delegate void fcFinalizeCallback(IntPtr userdata, float progress);
+        [DllImport ("fccore")] public static extern IntPtr fcReleaseContextAsync(IntPtr ctx, fcFinalizeCallback cb, IntPtr userdata);
+        [DllImport ("fccore")] public static extern Bool fcFinalizeIsDone(IntPtr h);
+        [DllImport ("fccore")] public static extern float fcFinalizeGetProgress(IntPtr h);
+        [DllImport ("fccore")] public static extern Bool fcFinalizeWait(IntPtr h, int timeoutMS);
+        [DllImport ("fccore")] public static extern void fcReleaseFinalizeHandle(IntPtr h);
+
+        // *Borrowed() functions don't copy pixels. pixels must be pinned (or native) memory until release is called.
+        // release can be called on any thread.
+        public delegate void fcReleasePixels(IntPtr userdata, IntPtr pixels);
+
+        // encoded packets without container, by fcMP4AddPacketCallback() / fcWebMAddPacketCallback()
+        public enum fcPacketCodec
+        {
+            H264,
+            AAC,
+            VP8,
+            VP9,
+            Vorbis,
+            Opus,
+        }
+        public struct fcPacket
+        {
+            public fcPacketCodec codec;
+            public IntPtr data; // valid only during the callback
+            public UIntPtr size;
+            public double timestamp;
+            public double duration;
+            public Bool keyframe;
+            public IntPtr codecPrivate;
+            public UIntPtr codecPrivateSize;
+        }
+        // called on encoder threads. the delegate must be kept alive until the context is released
+        public delegate void fcPacketCallback(IntPtr userdata, ref fcPacket packet);
+
 
         // -------------------------------------------------------------
         // PNG Exporter
@@ -170,6 +369,8 @@ namespace UTJ.FrameCapturer
         {
             public fcPngPixelFormat pixelFormat;
             [Range(1, 32)] public int maxTasks;
+            public fcTaskPriority priority;
+            public fcBackpressurePolicy backpressure;
             // C# ext
             [HideInInspector] public int width;
             [HideInInspector] public int height;
@@ -183,6 +384,8 @@ namespace UTJ.FrameCapturer
                     {
                         pixelFormat = fcPngPixelFormat.Auto,
                         maxTasks = 2,
+                        priority = fcTaskPriority.Background,
+                        backpressure = fcBackpressurePolicy.Block,
                     };
                 }
             }
@@ -198,6 +401,7 @@ namespace UTJ.FrameCapturer
         [DllImport ("fccore")] public static extern Bool         fcPngIsSupported();
         [DllImport ("fccore")] public static extern fcPngContext fcPngCreateContext(ref fcPngConfig conf);
         [DllImport ("fccore")] public static extern Bool         fcPngExportPixels(fcPngContext ctx, string path, byte[] pixels, int width, int height, fcPixelFormat fmt, int num_channels);
+        [DllImport ("fccore")] public static extern Bool         fcPngExportPixelsBorrowed(fcPngContext ctx, string path, IntPtr pixels, int width, int height, fcPixelFormat fmt, int num_channels, fcReleasePixels release, IntPtr userdata);
 
 
         // -------------------------------------------------------------
@@ -227,6 +431,7 @@ namespace UTJ.FrameCapturer
             public fcExrPixelFormat pixelFormat;
             public fcExrCompression compression;
             [Range(1, 32)] public int maxTasks;
+            public fcTaskPriority priority;
             // C# ext
             [HideInInspector] public int width;
             [HideInInspector] public int height;
@@ -241,6 +446,7 @@ namespace UTJ.FrameCapturer
                         pixelFormat = fcExrPixelFormat.Auto,
                         compression = fcExrCompression.Zip,
                         maxTasks = 2,
+                        priority = fcTaskPriority.Background,
                     };
                 }
             }
@@ -257,6 +463,7 @@ namespace UTJ.FrameCapturer
         [DllImport ("fccore")] public static extern fcExrContext fcExrCreateContext(ref fcExrConfig conf);
         [DllImport ("fccore")] public static extern Bool         fcExrBeginImage(fcExrContext ctx, string path, int width, int height);
         [DllImport ("fccore")] public static extern Bool         fcExrAddLayerPixels(fcExrContext ctx, byte[] pixels, fcPixelFormat fmt, int ch, string name);
+        [DllImport ("fccore")] public static extern Bool         fcExrAddLayerPixelsBorrowed(fcExrContext ctx, IntPtr pixels, fcPixelFormat fmt, int ch, string name, fcReleasePixels release, IntPtr userdata);
         [DllImport ("fccore")] public static extern Bool         fcExrEndImage(fcExrContext ctx);
 
 
@@ -272,6 +479,9 @@ namespace UTJ.FrameCapturer
             [Range(1, 256)] public int numColors;
             [Range(1, 120)] public int keyframeInterval;
             [Range(1, 32)] public int maxTasks;
+            public fcTaskPriority priority;
+            public fcBackpressurePolicy backpressure;
+            public int backpressureMemoryLimit; // in MB
 
             public static fcGifConfig default_value
             {
@@ -282,6 +492,9 @@ namespace UTJ.FrameCapturer
                         numColors = 256,
                         maxTasks = 8,
                         keyframeInterval = 30,
+                        priority = fcTaskPriority.Normal,
+                        backpressure = fcBackpressurePolicy.Block,
+                        backpressureMemoryLimit = 256,
                     };
                 }
             }
@@ -297,6 +510,7 @@ namespace UTJ.FrameCapturer
         [DllImport ("fccore")] public static extern fcGifContext fcGifCreateContext(ref fcGifConfig conf);
         [DllImport ("fccore")] public static extern void         fcGifAddOutputStream(fcGifContext ctx, fcStream stream);
         [DllImport ("fccore")] public static extern Bool         fcGifAddFramePixels(fcGifContext ctx, byte[] pixels, fcPixelFormat fmt, double timestamp = -1.0);
+        [DllImport ("fccore")] public static extern Bool         fcGifAddFramePixelsBorrowed(fcGifContext ctx, IntPtr pixels, fcPixelFormat fmt, double timestamp, fcReleasePixels release, IntPtr userdata);
 
 
         // -------------------------------------------------------------
@@ -340,6 +554,10 @@ namespace UTJ.FrameCapturer
             [HideInInspector] public int audioFlags;
             [Range(1, 32)] public int audioMaxTasks;
 
+            public fcTaskPriority priority;
+            public fcBackpressurePolicy backpressure;
+            public int backpressureMemoryLimit; // in MB
+
             public static fcMP4Config default_value
             {
                 get
@@ -360,6 +578,10 @@ namespace UTJ.FrameCapturer
                         audioTargetBitrate = 128 * 1000,
                         audioFlags = (int)fcMP4AudioFlags.AACMask,
                         audioMaxTasks = 4,
+
+                        priority = fcTaskPriority.RealTime,
+                        backpressure = fcBackpressurePolicy.Block,
+                        backpressureMemoryLimit = 512,
                     };
                 }
             }
@@ -376,9 +598,11 @@ namespace UTJ.FrameCapturer
         [DllImport ("fccore")] public static extern fcMP4Context     fcMP4CreateContext(ref fcMP4Config conf);
         [DllImport ("fccore")] public static extern fcMP4Context     fcMP4OSCreateContext(ref fcMP4Config conf, string path);
         [DllImport ("fccore")] public static extern void             fcMP4AddOutputStream(fcMP4Context ctx, fcStream s);
+        [DllImport ("fccore")] public static extern void             fcMP4AddPacketCallback(fcMP4Context ctx, fcPacketCallback cb, IntPtr userdata);
         [DllImport ("fccore")] private static extern IntPtr          fcMP4GetAudioEncoderInfo(fcMP4Context ctx);
         [DllImport ("fccore")] private static extern IntPtr          fcMP4GetVideoEncoderInfo(fcMP4Context ctx);
         [DllImport ("fccore")] public static extern Bool             fcMP4AddVideoFramePixels(fcMP4Context ctx, byte[] pixels, fcPixelFormat fmt, double timestamp = -1.0);
+        [DllImport ("fccore")] public static extern Bool             fcMP4AddVideoFramePixelsBorrowed(fcMP4Context ctx, IntPtr pixels, fcPixelFormat fmt, double timestamp, fcReleasePixels release, IntPtr userdata);
         [DllImport ("fccore")] public static extern Bool             fcMP4AddAudioSamples(fcMP4Context ctx, float[] samples, int num_samples);
 
         public static string fcMP4GetAudioEncoderInfoS(fcMP4Context ctx)
@@ -435,6 +659,11 @@ namespace UTJ.FrameCapturer
             public int audioTargetBitrate;
             [Range(1, 32)] public int audioMaxTasks;
 
+            public fcTaskPriority priority;
+            public fcBackpressurePolicy backpressure;
+            public int backpressureMemoryLimit; // in MB
+            public Bool live; // append-only output. for fcCreateRingStream()
+
             public static fcWebMConfig default_value
             {
                 get
@@ -455,6 +684,11 @@ namespace UTJ.FrameCapturer
                         audioBitrateMode = fcBitrateMode.VBR,
                         audioTargetBitrate = 128 * 1000,
                         audioMaxTasks = 4,
+
+                        priority = fcTaskPriority.RealTime,
+                        backpressure = fcBackpressurePolicy.Block,
+                        backpressureMemoryLimit = 512,
+                        live = false,
                     };
                 }
             }
@@ -463,8 +697,10 @@ namespace UTJ.FrameCapturer
         [DllImport ("fccore")] public static extern Bool fcWebMIsSupported();
         [DllImport ("fccore")] public static extern fcWebMContext fcWebMCreateContext(ref fcWebMConfig conf);
         [DllImport ("fccore")] public static extern void fcWebMAddOutputStream(fcWebMContext ctx, fcStream stream);
+        [DllImport ("fccore")] public static extern void fcWebMAddPacketCallback(fcWebMContext ctx, fcPacketCallback cb, IntPtr userdata);
         // timestamp=-1 is treated as current time.
         [DllImport ("fccore")] public static extern Bool fcWebMAddVideoFramePixels(fcWebMContext ctx, byte[] pixels, fcPixelFormat fmt, double timestamp = -1.0);
+        [DllImport ("fccore")] public static extern Bool fcWebMAddVideoFramePixelsBorrowed(fcWebMContext ctx, IntPtr pixels, fcPixelFormat fmt, double timestamp, fcReleasePixels release, IntPtr userdata);
         // timestamp=-1 is treated as current time.
         [DllImport ("fccore")] public static extern Bool fcWebMAddAudioSamples(fcWebMContext ctx, float[] samples, int num_samples);
 
@@ -527,6 +763,7 @@ namespace UTJ.FrameCapturer
             public fcBitrateMode bitrateMode;
             public int targetBitrate;
             [Range(1, 32)] public int maxTasks;
+            public fcTaskPriority priority;
 
             public static fcOggConfig default_value
             {
@@ -539,6 +776,7 @@ namespace UTJ.FrameCapturer
                         bitrateMode = fcBitrateMode.VBR,
                         targetBitrate = 128 * 1000,
                         maxTasks = 2,
+                        priority = fcTaskPriority.RealTime,
                     };
                 }
             }
@@ -570,6 +808,7 @@ namespace UTJ.FrameCapturer
             public int blockSize;
             [HideInInspector] public Bool verify;
             [Range(1, 32)] public int maxTasks;
+            public fcTaskPriority priority;
 
             public static fcFlacConfig default_value
             {
@@ -584,6 +823,7 @@ namespace UTJ.FrameCapturer
                         blockSize = 0,
                         verify = false,
                         maxTasks = 2,
+                        priority = fcTaskPriority.RealTime,
                     };
                 }
             }
@@ -0,0 +1,177 @@
+#include "pch.h"
+#include "TestCommon.h"
+#include <new>
+
+// counts heap allocations made while encoding in steady state.
+// operator new is replaced for the whole process (on linux this also covers allocations in fccore).
+// malloc() by codec libraries (libpng, libvpx, etc) is not counted.
+
+static std::atomic_bool g_count_alloc = { false };
+static std::atomic<uint64_t> g_num_alloc = { 0 };
+
+void* operator new(size_t size)
+{
+    if (g_count_alloc) { ++g_num_alloc; }
+    if (void *p = malloc(size > 0 ? size : 1)) { return p; }
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+
+
+struct AllocCount
+{
+    uint64_t heap = 0;
+    uint64_t aligned = 0;
+};
+
+template<class Body>
+static AllocCount CountAlloc(const Body& body)
+{
+    uint64_t aligned = GetAlignedAllocCount();
+    g_num_alloc = 0;
+    g_count_alloc = true;
+    body();
+    g_count_alloc = false;
+
+    AllocCount ret;
+    ret.heap = g_num_alloc;
+    ret.aligned = GetAlignedAllocCount() - aligned;
+    return ret;
+}
+
+// index tables and output buffers grow geometrically, so a few allocations are allowed in 1000 frames.
+// allocating per frame hits 1000+ and fails.
+static const int WarmupFrames = 100;
+static const int MeasureFrames = 1000;
+static const uint64_t AllocBudget = 32;
+
+static bool CheckAllocCount(const char *name, const AllocCount& c, bool check_heap = true)
+{
+    bool ok = c.aligned <= AllocBudget && (!check_heap || c.heap <= AllocBudget);
+    printf("  %s: %d frames, %llu heap allocations, %llu aligned allocations %s\n",
+        name, MeasureFrames, (unsigned long long)c.heap, (unsigned long long)c.aligned, ok ? "" : "FAILED");
+    return ok;
+}
+
+
+static const int Width = 64;
+static const int Height = 64;
+
+static bool GifAllocTest()
+{
+    fcGifConfig conf;
+    conf.width = Width;
+    conf.height = Height;
+    fcStream *fstream = fcCreateFileStream("AllocTest.gif");
+    fcIGifContext *ctx = fcGifCreateContext(&conf);
+    fcGifAddOutputStream(ctx, fstream);
+
+    fcTime t = 0;
+    RawVector<RGBAu8> video_frame(Width * Height);
+    auto add_frames = [&](int n) {
+        for (int i = 0; i < n; ++i) {
+            CreateVideoData(&video_frame[0], Width, Height, i);
+            fcGifAddFramePixels(ctx, &video_frame[0], fcPixelFormat_RGBAu8, t);
+            t += 1.0 / 30.0;
+        }
+    };
+    add_frames(WarmupFrames);
+    auto count = CountAlloc([&]() { add_frames(MeasureFrames); });
+
+    fcReleaseContext(ctx);
+    fcReleaseStream(fstream);
+    return CheckAllocCount("gif", count);
+}
+
+static bool PngAllocTest()
+{
+    fcPngConfig conf;
+    fcIPngContext *ctx = fcPngCreateContext(&conf);
+
+    RawVector<RGBAu8> video_frame(Width * Height);
+    auto export_frames = [&](int n) {
+        for (int i = 0; i < n; ++i) {
+            CreateVideoData(&video_frame[0], Width, Height, i);
+            fcPngExportPixels(ctx, "AllocTest.png", &video_frame[0], Width, Height, fcPixelFormat_RGBAu8, 0);
+        }
+    };
+    export_frames(WarmupFrames);
+    auto count = CountAlloc([&]() { export_frames(MeasureFrames); });
+
+    fcReleaseContext(ctx);
+    return CheckAllocCount("png", count);
+}
+
+static bool MP4AllocTest()
+{
+    fcMP4Config conf;
+    conf.video = true;
+    conf.video_width = Width;
+    conf.video_height = Height;
+    conf.audio = false;
+    fcStream *fstream = fcCreateFileStream("AllocTest.mp4");
+    fcIMP4Context *ctx = fcMP4CreateContext(&conf);
+    fcMP4AddOutputStream(ctx, fstream);
+
+    fcTime t = 0;
+    RawVector<RGBAu8> video_frame(Width * Height);
+    auto add_frames = [&](int n) {
+        for (int i = 0; i < n; ++i) {
+            CreateVideoData(&video_frame[0], Width, Height, i);
+            fcMP4AddVideoFramePixels(ctx, &video_frame[0], fcPixelFormat_RGBAu8, t);
+            t += 1.0 / 30.0;
+        }
+    };
+    add_frames(WarmupFrames);
+    auto count = CountAlloc([&]() { add_frames(MeasureFrames); });
+
+    fcReleaseContext(ctx);
+    fcReleaseStream(fstream);
+    return CheckAllocCount("mp4", count);
+}
+
+static bool WebMAllocTest()
+{
+    fcWebMConfig conf;
+    conf.video = true;
+    conf.video_width = Width;
+    conf.video_height = Height;
+    conf.audio = false;
+    fcStream *fstream = fcCreateFileStream("AllocTest.webm");
+    fcIWebMContext *ctx = fcWebMCreateContext(&conf);
+    fcWebMAddOutputStream(ctx, fstream);
+
+    fcTime t = 0;
+    RawVector<RGBAu8> video_frame(Width * Height);
+    auto add_frames = [&](int n) {
+        for (int i = 0; i < n; ++i) {
+            CreateVideoData(&video_frame[0], Width, Height, i);
+            fcWebMAddVideoFramePixels(ctx, &video_frame[0], fcPixelFormat_RGBAu8, t);
+            t += 1.0 / 30.0;
+        }
+    };
+    add_frames(WarmupFrames);
+    auto count = CountAlloc([&]() { add_frames(MeasureFrames); });
+
+    fcReleaseContext(ctx);
+    fcReleaseStream(fstream);
+    // libwebm copies each frame into new[]'ed memory, so only aligned allocations by fccore are checked
+    return CheckAllocCount("webm", count, false);
+}
+
+bool AllocTest()
+{
+    printf("AllocTest begin\n");
+
+    bool ok = true;
+    if (fcGifIsSupported()) { ok = GifAllocTest() && ok; }
+    if (fcPngIsSupported()) { ok = PngAllocTest() && ok; }
+    if (fcMP4IsSupported()) { ok = MP4AllocTest() && ok; }
+    if (fcWebMIsSupported()) { ok = WebMAllocTest() && ok; }
+    fcWaitAsyncDelete();
+
+    printf("AllocTest end\n");
+    return ok;
+}
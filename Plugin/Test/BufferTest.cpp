@@ -0,0 +1,247 @@
+#include "pch.h"
+#include "TestCommon.h"
+#include <chrono>
+#include <future>
+
+using Clock = std::chrono::high_resolution_clock;
+
+static double ElapsedMS(Clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+// runs body with large allocation (mmap / mremap / huge pages) disabled and enabled
+template<class Body>
+static void CompareLargeAlloc(const char *name, const Body& body)
+{
+    size_t threshold = GetLargeAllocThreshold();
+    SetLargeAllocThreshold(0);
+    printf("  %s (AlignedAlloc): %.2lfms\n", name, body());
+    SetLargeAllocThreshold(threshold);
+    printf("  %s (large alloc): %.2lfms\n", name, body());
+}
+
+// simulates recording long video into a memory stream.
+// growing BufferStream copies all written data without mremap(). ChunkedBufferStream (fcCreateMemoryStream()) never copies.
+static double MemoryStreamBenchmark(BinaryStream& s)
+{
+    const size_t ChunkSize = 64 * 1024;
+    const size_t TotalSize = 1024 * 1024 * 1024;
+
+    Buffer chunk(ChunkSize);
+    memset(chunk.data(), 0x55, chunk.size());
+
+    auto begin = Clock::now();
+    for (size_t written = 0; written < TotalSize; written += ChunkSize) {
+        s.write(chunk.data(), chunk.size());
+    }
+    return ElapsedMS(begin);
+}
+
+// 8K RGBAf16 -> RGBAu8. buffers are touched before measurement, so that page faults are excluded and TLB misses are measured.
+static double ConvertBenchmark()
+{
+    const int Width = 7680;
+    const int Height = 4320;
+    const int NumFrames = 10;
+
+    RawVector<RGBAf16> src(Width * Height);
+    RawVector<RGBAu8> dst(Width * Height);
+    CreateVideoData(&src[0], Width, Height, 0);
+    memset(dst.data(), 0, dst.size() * sizeof(RGBAu8));
+
+    auto begin = Clock::now();
+    for (int i = 0; i < NumFrames; ++i) {
+        fcConvertPixelFormat(&dst[0], fcPixelFormat_RGBAu8, &src[0], fcPixelFormat_RGBAf16, src.size());
+    }
+    return ElapsedMS(begin) / NumFrames;
+}
+
+// several recorders of the same resolution share idle frame buffers through the global pool
+static void BufferPoolTest()
+{
+    const int Width = 320;
+    const int Height = 240;
+    const int NumContexts = 4;
+    const int NumFrames = 60;
+
+    auto record = []() {
+        fcGifConfig conf;
+        conf.width = Width;
+        conf.height = Height;
+        fcIGifContext *ctx = fcGifCreateContext(&conf);
+        fcStream *mstream = fcCreateMemoryStream();
+        fcGifAddOutputStream(ctx, mstream);
+
+        RawVector<RGBAf16> video_frame(Width * Height);
+        fcTime t = 0;
+        for (int i = 0; i < NumFrames; ++i) {
+            CreateVideoData(&video_frame[0], Width, Height, i);
+            fcGifAddFramePixels(ctx, &video_frame[0], fcPixelFormat_RGBAf16, t);
+            t += 1.0 / 30.0;
+        }
+        fcReleaseContext(ctx);
+        fcReleaseStream(mstream);
+    };
+
+    fcBufferPoolTrim(0);
+    std::vector<std::future<void>> tasks;
+    for (int i = 0; i < NumContexts; ++i) {
+        tasks.push_back(std::async(std::launch::async, record));
+    }
+    for (auto& task : tasks) { task.get(); }
+    fcWaitAsyncDelete();
+
+    fcBufferPoolStats stats;
+    fcBufferPoolGetStats(&stats);
+    printf("  buffer pool: %d contexts x %d frames, %llu allocations, %llu reuses, peak in use %.2lfMB, peak idle %.2lfMB\n",
+        NumContexts, NumFrames, (unsigned long long)stats.num_allocations, (unsigned long long)stats.num_reuses,
+        double(stats.peak_in_use_bytes) / (1024 * 1024), double(stats.peak_idle_bytes) / (1024 * 1024));
+
+    fcBufferPoolTrim(0);
+    fcBufferPoolGetStats(&stats);
+    printf("  buffer pool trim: %s\n", stats.idle_bytes == 0 ? "ok" : "FAILED");
+}
+
+// frames beyond the global memory budget are handled by backpressure policy of each context
+static void MemoryBudgetTest()
+{
+    const int Width = 320;
+    const int Height = 240;
+    const int NumFrames = 60;
+    const uint64_t FrameSize = Width * Height * sizeof(RGBAf16);
+
+    fcSetMemoryBudget(FrameSize * 2);
+
+    fcGifConfig conf;
+    conf.width = Width;
+    conf.height = Height;
+    conf.backpressure = fcBackpressurePolicy::DropNewest;
+    fcIGifContext *ctx = fcGifCreateContext(&conf);
+    fcStream *mstream = fcCreateMemoryStream();
+    fcGifAddOutputStream(ctx, mstream);
+
+    RawVector<RGBAf16> video_frame(Width * Height);
+    fcTime t = 0;
+    uint64_t max_usage = 0;
+    for (int i = 0; i < NumFrames; ++i) {
+        CreateVideoData(&video_frame[0], Width, Height, i);
+        fcGifAddFramePixels(ctx, &video_frame[0], fcPixelFormat_RGBAf16, t);
+        max_usage = std::max(max_usage, fcGetMemoryUsage());
+        t += 1.0 / 30.0;
+    }
+    fcFrameStats fstats;
+    fcGetFrameStats(ctx, &fstats);
+    fcReleaseContext(ctx);
+    fcReleaseStream(mstream);
+    fcWaitAsyncDelete();
+
+    bool ok = max_usage <= FrameSize * 2 && fcGetMemoryUsage() == 0;
+    printf("  memory budget: %d frames, %llu dropped, max usage %.2lfMB (budget %.2lfMB) %s\n",
+        NumFrames, (unsigned long long)fstats.dropped_frames,
+        double(max_usage) / (1024 * 1024), double(FrameSize * 2) / (1024 * 1024), ok ? "" : "FAILED");
+    fcSetMemoryBudget(0);
+}
+
+// frames go to the spill file and come back in order with their metadata
+static void SpillQueueTest()
+{
+    const int NumFrames = 32;
+
+    SpillQueue spill;
+    bool ok = true;
+    for (int i = 0; i < NumFrames; ++i) {
+        SpillQueue::Header header;
+        header.size = (i + 1) * 1000;
+        header.format = fcPixelFormat_RGBAu8;
+        header.timestamp = i;
+        header.width = i;
+        Buffer pixels(header.size);
+        memset(pixels.data(), i, pixels.size());
+        ok = ok && spill.push(header, pixels.data(), std::to_string(i).c_str());
+    }
+    Buffer dst;
+    for (int i = 0; i < NumFrames; ++i) {
+        SpillQueue::Header header;
+        std::string name;
+        ok = ok && spill.pop(header, dst, &name) &&
+            header.size == dst.size() && header.size == size_t(i + 1) * 1000 && header.width == i && name == std::to_string(i) &&
+            dst[0] == (char)i && dst[dst.size() - 1] == (char)i;
+    }
+    ok = ok && spill.empty();
+    printf("  spill queue: %s\n", ok ? "ok" : "FAILED");
+}
+
+// image sequence with Spill doesn't wait for the encoder
+static void SpillPngTest()
+{
+    const int Width = 1920;
+    const int Height = 1080;
+    const int NumFrames = 16;
+
+    bool all_written = true;
+    auto record = [&](fcBackpressurePolicy policy) {
+        fcPngConfig conf;
+        conf.max_tasks = 1;
+        conf.backpressure = policy;
+        fcIPngContext *ctx = fcPngCreateContext(&conf);
+
+        RawVector<RGBAf16> video_frame(Width * Height);
+        CreateVideoData(&video_frame[0], Width, Height, 0);
+        auto begin = Clock::now();
+        for (int i = 0; i < NumFrames; ++i) {
+            fcPngExportPixels(ctx, "SpillTest.png", &video_frame[0], Width, Height, fcPixelFormat_RGBAf16);
+        }
+        double submit = ElapsedMS(begin);
+
+        // spilled frames must be exported by running tasks, not left for the release of the context
+        fcContextStats stats;
+        for (int i = 0; i < 1000; ++i) {
+            fcGetContextStats(ctx, &stats);
+            if (stats.frames_written == NumFrames) { break; }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        all_written = all_written && stats.frames_written == NumFrames;
+
+        fcReleaseContext(ctx);
+        fcWaitAsyncDelete();
+        return submit;
+    };
+    printf("  png %d frames submission (Block): %.2lfms\n", NumFrames, record(fcBackpressurePolicy::Block));
+    printf("  png %d frames submission (Spill): %.2lfms\n", NumFrames, record(fcBackpressurePolicy::Spill));
+    printf("  png spilled frames written: %s\n", all_written ? "ok" : "FAILED");
+}
+
+void BufferTest()
+{
+    printf("BufferTest begin\n");
+
+    // contents must survive growth by mremap() and shrink_to_fit()
+    {
+        RawVector<int> v;
+        for (int i = 0; i < 4 * 1024 * 1024; ++i) { v.push_back(i); }
+        bool ok = true;
+#ifdef __linux__
+        // large blocks start at a huge page boundary, also after growth
+        ok = ok && ((uintptr_t)v.data() & (2 * 1024 * 1024 - 1)) == 0;
+#endif
+        v.resize(1024);
+        v.shrink_to_fit();
+        for (int i = 0; i < (int)v.size(); ++i) { ok = ok && v[i] == i; }
+        printf("  growth: %s\n", ok ? "ok" : "FAILED");
+    }
+
+    CompareLargeAlloc("memory stream 1GB", []() { Buffer buf; BufferStream s(buf); return MemoryStreamBenchmark(s); });
+    CompareLargeAlloc("chunked memory stream 1GB", []() { ChunkedBufferStream s; return MemoryStreamBenchmark(s); });
+    CompareLargeAlloc("8K RGBAf16 -> RGBAu8 per frame", ConvertBenchmark);
+    SpillQueueTest();
+    if (fcPngIsSupported()) {
+        SpillPngTest();
+    }
+    if (fcGifIsSupported()) {
+        MemoryBudgetTest();
+        BufferPoolTest();
+    }
+
+    printf("BufferTest end\n");
+}
@@ -18,6 +18,61 @@ void ExrTestImpl(fcIExrContext *ctx, const char *filename)
     fcExrEndImage(ctx);
 }
 
+// 4K RGBAf16 frames written to real files. one *Borrowed() call per layer
+static void ExrBorrowBenchmark()
+{
+    const int Width = 3840;
+    const int Height = 2160;
+    const int NumFrames = 4;
+    const char *channel_names[] = { "R", "G", "B", "A" };
+
+    std::vector<RawVector<RGBAf16>> frames(NumFrames);
+    for (int i = 0; i < NumFrames; ++i) {
+        frames[i].resize(Width * Height);
+        CreateVideoData(&frames[i][0], Width, Height, i);
+    }
+
+    fcIExrContext *ctx = nullptr;
+    auto path = [](char *dst, int i) { sprintf(dst, "Borrow%d.exr", i); };
+
+    char name[128];
+    sprintf(name, "ExrBorrowBenchmark: %dx%d RGBAf16 x %d to files", Width, Height, NumFrames);
+    BorrowBenchmark b;
+    b.name = name;
+    b.num_frames = NumFrames;
+    b.releases_per_frame = 4;
+    b.begin = [&]() {
+        ctx = fcExrCreateContext();
+        return ctx != nullptr;
+    };
+    b.submit = [&](int i, fcReleasePixels release, void *userdata) {
+        char p[64];
+        path(p, i);
+        fcExrBeginImage(ctx, p, Width, Height);
+        for (int c = 0; c < 4; ++c) {
+            if (release) {
+                fcExrAddLayerPixelsBorrowed(ctx, &frames[i][0], fcPixelFormat_RGBAf16, c, channel_names[c], release, userdata);
+            }
+            else {
+                fcExrAddLayerPixels(ctx, &frames[i][0], fcPixelFormat_RGBAf16, c, channel_names[c]);
+            }
+        }
+        fcExrEndImage(ctx);
+    };
+    b.end = [&]() {
+        fcReleaseContext(ctx); // waits for all images to be written
+        fcWaitAsyncDelete();
+        uint64_t size = 0;
+        for (int i = 0; i < NumFrames; ++i) {
+            char p[64];
+            path(p, i);
+            size += GetFileSize(p);
+        }
+        return size;
+    };
+    RunBorrowBenchmark(b);
+}
+
 void ExrTest()
 {
     if (!fcExrIsSupported()) {
@@ -33,5 +88,7 @@ void ExrTest()
     ExrTestImpl<RGBAf32>(ctx, "RGBAf32.exr");
     fcReleaseContext(ctx);
 
+    ExrBorrowBenchmark();
+
     printf("ExrTest end\n");
 }
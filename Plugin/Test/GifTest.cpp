@@ -27,6 +27,62 @@ void GifTestImpl(const char *filename)
     fcReleaseStream(fstream);
 }
 
+// encoding into a memory stream. tasks and memory are not limited, so that the caller time is the submission itself
+// and not a wait for the encoder.
+static void GifBorrowBenchmark()
+{
+    const int Width = 1280;
+    const int Height = 720;
+    const int NumFrames = 16;
+
+    std::vector<RawVector<RGBAu8>> frames(NumFrames);
+    for (int i = 0; i < NumFrames; ++i) {
+        frames[i].resize(Width * Height);
+        CreateVideoData(&frames[i][0], Width, Height, i);
+    }
+
+    fcIGifContext *ctx = nullptr;
+    fcStream *mstream = nullptr;
+
+    char name[128];
+    sprintf(name, "GifBorrowBenchmark: %dx%d RGBAu8 x %d to memory", Width, Height, NumFrames);
+    BorrowBenchmark b;
+    b.name = name;
+    b.num_frames = NumFrames;
+    b.untimed_frames = 1; // keyframe
+    b.begin = [&]() {
+        fcGifConfig conf;
+        conf.width = Width;
+        conf.height = Height;
+        conf.keyframe_interval = NumFrames;
+        conf.max_tasks = NumFrames;
+        conf.backpressure = fcBackpressurePolicy::Grow;
+        conf.backpressure_memory_limit = 1024;
+        ctx = fcGifCreateContext(&conf);
+        if (!ctx) { return false; }
+        mstream = fcCreateMemoryStream();
+        fcGifAddOutputStream(ctx, mstream);
+        return true;
+    };
+    b.submit = [&](int i, fcReleasePixels release, void *userdata) {
+        fcTime t = 1.0 / 30.0 * i;
+        if (release) {
+            fcGifAddFramePixelsBorrowed(ctx, &frames[i][0], fcPixelFormat_RGBAu8, t, release, userdata);
+        }
+        else {
+            fcGifAddFramePixels(ctx, &frames[i][0], fcPixelFormat_RGBAu8, t);
+        }
+    };
+    b.end = [&]() {
+        fcReleaseContext(ctx); // waits for all frames to be encoded and written
+        fcWaitAsyncDelete();
+        uint64_t size = fcStreamGetWrittenSize(mstream);
+        fcReleaseStream(mstream);
+        return size;
+    };
+    RunBorrowBenchmark(b);
+}
+
 void GifTest()
 {
     if (!fcGifIsSupported()) {
@@ -46,6 +102,8 @@ void GifTest()
 
     for (auto& task : tasks) { task.get(); }
 
+    GifBorrowBenchmark();
+
     printf("GifTest end\n");
 }
 
@@ -1,5 +1,10 @@
 #include "pch.h"
 #include "TestCommon.h"
+#include <chrono>
+#include "../fccore/Encoder/MP4/fcMP4Internal.h"
+#include "../fccore/Encoder/MP4/fcH264Encoder.h"
+#include "../fccore/Encoder/MP4/fcAACEncoder.h"
+#include "../fccore/Encoder/MP4/fcMP4Writer.h"
 
 
 // custom stream functions (just a wrapper of FILE)
@@ -96,9 +101,146 @@ void MP4TestOSProvidedEncoder(const char *filename)
     printf("MP4Test (%s) end\n", filename);
 }
 
+// encoding video only into a memory stream. tasks and memory are not limited, so that the caller time is the submission itself
+// and not a wait for the encoder.
+static void MP4BorrowBenchmark()
+{
+    const int Width = 1920;
+    const int Height = 1080;
+    const int NumFrames = 30;
+
+    std::vector<RawVector<RGBAu8>> frames(NumFrames);
+    for (int i = 0; i < NumFrames; ++i) {
+        frames[i].resize(Width * Height);
+        CreateVideoData(&frames[i][0], Width, Height, i);
+    }
+
+    fcIMP4Context *ctx = nullptr;
+    fcStream *mstream = nullptr;
+
+    char name[128];
+    sprintf(name, "MP4BorrowBenchmark: %dx%d RGBAu8 x %d to memory", Width, Height, NumFrames);
+    BorrowBenchmark b;
+    b.name = name;
+    b.num_frames = NumFrames;
+    b.begin = [&]() {
+        fcMP4Config conf;
+        conf.video_width = Width;
+        conf.video_height = Height;
+        conf.video_target_framerate = 30;
+        conf.video_max_tasks = NumFrames;
+        conf.audio = false;
+        conf.backpressure = fcBackpressurePolicy::Grow;
+        conf.backpressure_memory_limit = 1024;
+        ctx = fcMP4CreateContext(&conf);
+        if (!ctx) { return false; }
+        mstream = fcCreateMemoryStream();
+        fcMP4AddOutputStream(ctx, mstream);
+        return true;
+    };
+    b.submit = [&](int i, fcReleasePixels release, void *userdata) {
+        fcTime t = 1.0 / 30.0 * i;
+        if (release) {
+            fcMP4AddVideoFramePixelsBorrowed(ctx, &frames[i][0], fcPixelFormat_RGBAu8, t, release, userdata);
+        }
+        else {
+            fcMP4AddVideoFramePixels(ctx, &frames[i][0], fcPixelFormat_RGBAu8, t);
+        }
+    };
+    b.end = [&]() {
+        fcReleaseContext(ctx); // waits for all frames to be encoded and written
+        fcWaitAsyncDelete();
+        uint64_t size = fcStreamGetWrittenSize(mstream);
+        fcReleaseStream(mstream);
+        return size;
+    };
+    RunBorrowBenchmark(b);
+}
+
+// finalizing a 1 hour, 60 fps recording: mp4End() builds the sample tables of all frames at once, at the end of the capture.
+// frames are synthetic (a few bytes of NALs / AAC packets, interleaved as the context writes them), so no encoder is needed
+// and only the finalization is timed.
+static void MP4FinalizeBenchmark()
+{
+    using Clock = std::chrono::high_resolution_clock;
+    const int Seconds = 60 * 60;
+    const int VideoFrameRate = 60;
+    const int AudioSampleRate = 48000;
+    const int AudioPacketSamples = 1024;
+
+    fcMP4Config conf;
+    conf.video_width = 1920;
+    conf.video_height = 1080;
+    conf.video_target_framerate = VideoFrameRate;
+    conf.audio_sample_rate = AudioSampleRate;
+
+    Buffer data;
+    auto stream = new BufferStream(data);
+    auto writer = new fcMP4Writer(stream, conf);
+    const char aac_info[] = { 0x11, (char)0x90 };
+    writer->setAACEncoderInfo(Buffer(aac_info, sizeof(aac_info)));
+
+    // start code + NAL header + payload. SPS and PPS go with the first frame
+    const char sps[] = { 0, 0, 0, 1, 0x67, 0x42, (char)0xc0, 0x14 };
+    const char pps[] = { 0, 0, 0, 1, 0x68, (char)0xce, 0x3c, (char)0x80 };
+    const char payload[16] = {};
+
+    fcH264Frame vf;
+    fcAACFrame af;
+    int num_video = Seconds * VideoFrameRate;
+    int num_audio = 0;
+    for (int i = 0; i < num_video; ++i) {
+        vf.clear();
+        vf.timestamp = double(i) / VideoFrameRate;
+        bool keyframe = i % VideoFrameRate == 0;
+        vf.type = keyframe ? fcH264FrameType_I : fcH264FrameType_P;
+        if (i == 0) {
+            vf.data.append(sps, sizeof(sps)); vf.nal_sizes.push_back((int)sizeof(sps));
+            vf.data.append(pps, sizeof(pps)); vf.nal_sizes.push_back((int)sizeof(pps));
+        }
+        const char start[] = { 0, 0, 0, 1, keyframe ? (char)0x65 : (char)0x41 };
+        vf.data.append(start, sizeof(start));
+        vf.data.append(payload, sizeof(payload));
+        vf.nal_sizes.push_back(int(sizeof(start) + sizeof(payload)));
+        writer->addVideoFrame(vf);
+
+        // audio packets up to the time of the video frame. 7 bytes of ADTS header are stripped by the writer
+        af.clear();
+        for (; double(num_audio) * AudioPacketSamples / AudioSampleRate <= vf.timestamp; ++num_audio) {
+            fcAACFrame::PacketInfo pinfo;
+            pinfo.size = 7 + sizeof(payload);
+            pinfo.duration = double(AudioPacketSamples) / AudioSampleRate;
+            pinfo.timestamp = double(num_audio) * AudioPacketSamples / AudioSampleRate;
+            af.data.resize(af.data.size() + pinfo.size);
+            af.packets.push_back(pinfo);
+        }
+        if (!af.packets.empty()) {
+            writer->AddAudioSamples(af);
+        }
+    }
+
+    size_t moov_pos = stream->tellp();
+    auto begin = Clock::now();
+    delete writer; // mp4End()
+    double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+
+    // moov must follow mdat and span to the end
+    uint32_t moov_size = 0, moov_name = 0;
+    bool ok = data.size() > moov_pos + 8;
+    if (ok) {
+        memcpy(&moov_size, &data[moov_pos], 4);
+        memcpy(&moov_name, &data[moov_pos + 4], 4);
+        ok = u32_be(moov_size) == data.size() - moov_pos && u32_be(moov_name) == 'moov';
+    }
+    printf("MP4FinalizeBenchmark: %d video frames + %d audio packets (1 hour). mp4End() %.2lfms, moov %.1lfKB %s\n",
+        num_video, num_audio, elapsed, double(data.size() - moov_pos) / 1024.0, ok ? "" : "FAILED");
+    stream->release();
+}
 
 void MP4Test()
 {
+    MP4FinalizeBenchmark();
+
     if(!fcMP4OSIsSupported()) {
         printf("MP4Test: OS-provided mp4 encoder is not available\n");
     }
@@ -115,5 +257,6 @@ void MP4Test()
         MP4Test(fcMP4_H264IntelHW, 0, "IntelHW.mp4");
         MP4Test(fcMP4_H264IntelSW, 0, "IntelSW.mp4");
         MP4Test(fcMP4_H264OpenH264, fcMP4_AACFAAC, "OpenH264.mp4");
+        MP4BorrowBenchmark();
     }
 }
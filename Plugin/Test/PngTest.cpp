@@ -12,6 +12,58 @@ void PngTestImpl(fcIPngContext *ctx, const char *filename, bool flipY=false)
     fcPngExportPixels(ctx, filename, &video_frame[0], Width, Height, GetPixelFormat<T>::value, flipY);
 }
 
+// the images are encoded and written to real files, and "until written" includes that:
+// encoding and file I/O are the same for both, only the copy on the caller's thread is saved.
+static void PngBorrowBenchmark()
+{
+    const int Width = 1920;
+    const int Height = 1080;
+    const int NumFrames = 8;
+
+    std::vector<RawVector<RGBAu8>> frames(NumFrames);
+    for (int i = 0; i < NumFrames; ++i) {
+        frames[i].resize(Width * Height);
+        CreateVideoData(&frames[i][0], Width, Height, i);
+    }
+
+    fcIPngContext *ctx = nullptr;
+    auto path = [](char *dst, int i) { sprintf(dst, "Borrow%d.png", i); };
+
+    char name[128];
+    sprintf(name, "PngBorrowBenchmark: %dx%d RGBAu8 x %d to files", Width, Height, NumFrames);
+    BorrowBenchmark b;
+    b.name = name;
+    b.num_frames = NumFrames;
+    b.begin = [&]() {
+        fcPngConfig conf;
+        conf.max_tasks = NumFrames; // no wait for a task slot, so that the caller time is the submission itself
+        ctx = fcPngCreateContext(&conf);
+        return ctx != nullptr;
+    };
+    b.submit = [&](int i, fcReleasePixels release, void *userdata) {
+        char p[64];
+        path(p, i);
+        if (release) {
+            fcPngExportPixelsBorrowed(ctx, p, &frames[i][0], Width, Height, fcPixelFormat_RGBAu8, 0, release, userdata);
+        }
+        else {
+            fcPngExportPixels(ctx, p, &frames[i][0], Width, Height, fcPixelFormat_RGBAu8);
+        }
+    };
+    b.end = [&]() {
+        fcReleaseContext(ctx); // waits for all images to be written
+        fcWaitAsyncDelete();
+        uint64_t size = 0;
+        for (int i = 0; i < NumFrames; ++i) {
+            char p[64];
+            path(p, i);
+            size += GetFileSize(p);
+        }
+        return size;
+    };
+    RunBorrowBenchmark(b);
+}
+
 void PngTest()
 {
     if (!fcPngIsSupported()) {
@@ -34,5 +86,7 @@ void PngTest()
 
     fcReleaseContext(ctx);
 
+    PngBorrowBenchmark();
+
     printf("PngTest end\n");
 }
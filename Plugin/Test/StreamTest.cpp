@@ -0,0 +1,492 @@
+#include "pch.h"
+#include "TestCommon.h"
+#include <chrono>
+#include <iterator>
+#include <thread>
+#ifdef __linux__
+    #include <unistd.h>
+#endif
+
+using Clock = std::chrono::high_resolution_clock;
+
+static double ElapsedMS(Clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+// writes like a muxer: box headers by operator<<, payload in chunks, and size of the first box patched.
+// the header is patched periodically too, so later patches must overwrite earlier ones in order.
+// frame_ms: time taken by each frame (headers + payload) on the writer
+static void WriteMuxerLike(BinaryStream& s, size_t total_size, std::vector<double>& frame_ms)
+{
+    const size_t PayloadSize = 16 * 1024;
+    Buffer payload(PayloadSize);
+    for (size_t i = 0; i < payload.size(); ++i) { payload[i] = (char)i; }
+
+    frame_ms.clear();
+    s << uint32_t(0) << uint32_t('mdat');
+    for (size_t written = 0; written < total_size; written += PayloadSize) {
+        auto begin = Clock::now();
+        for (int i = 0; i < 16; ++i) {
+            s << uint32_t(i) << uint8_t(i) << uint16_t(i);
+        }
+        s.write(payload.data(), payload.size());
+        if (frame_ms.size() % 256 == 255) {
+            size_t pos = s.tellp();
+            s.seekp(0);
+            s << uint32_t(pos);
+            s.seekp(pos);
+        }
+        frame_ms.push_back(ElapsedMS(begin));
+    }
+    size_t end = s.tellp();
+    s.seekp(0);
+    s << uint32_t(end);
+    s.seekp(end);
+    s << uint32_t('end ');
+}
+
+static bool VerifyMuxerLike(const char *path, size_t total_size)
+{
+    std::ifstream is(path, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+    if (data.size() < 12) { return false; }
+    uint32_t head, tail;
+    memcpy(&head, &data[0], 4);
+    memcpy(&tail, &data[data.size() - 4], 4);
+    return head == data.size() - 4 && tail == uint32_t('end ') && data.size() >= total_size;
+}
+
+// throughput including close, and tail latency of frames on the calling (encoder) thread.
+// the I/O thread of buffered streams is not measured, only how long write() keeps the caller.
+static void PrintResult(const char *name, const char *path, size_t total_size, double total_ms, std::vector<double>& frame_ms)
+{
+    std::sort(frame_ms.begin(), frame_ms.end());
+    printf("  %s: %.1lfMB/s, caller time per frame p50 %.3lfms p99 %.3lfms p99.9 %.3lfms max %.3lfms %s\n",
+        name, double(total_size) / (1024 * 1024) / (total_ms / 1000.0),
+        frame_ms[frame_ms.size() / 2], frame_ms[frame_ms.size() * 99 / 100], frame_ms[frame_ms.size() * 999 / 1000], frame_ms.back(),
+        VerifyMuxerLike(path, total_size) ? "" : "FAILED");
+}
+
+static void FileStreamBenchmark()
+{
+    const size_t TotalSize = 256 * 1024 * 1024;
+    const char *path = "StreamTest.bin";
+    std::vector<double> frame_ms;
+
+    // each row runs twice and reports the second run. both runs start from the same state, outside of the measurement:
+    // the file of the previous run is removed (not truncated by the next open), and sync() leaves none of its dirty pages
+    // to be written back meanwhile. the first run takes first-use costs, e.g. faulting in fresh stream buffers.
+    auto row = [&](const char *name, const std::function<BinaryStream*(bool first)>& open) {
+        double total_ms = 0.0;
+        for (int run = 0; run < 2; ++run) {
+            remove(path);
+#ifdef __linux__
+            sync();
+#endif
+            auto begin = Clock::now();
+            auto s = open(run == 0);
+            WriteMuxerLike(*s, TotalSize, frame_ms);
+            s->release();
+            total_ms = ElapsedMS(begin);
+        }
+        PrintResult(name, path, TotalSize, total_ms, frame_ms);
+    };
+
+    row("fstream", [&](bool) -> BinaryStream* {
+        return new StdIOStream(new std::fstream(path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc), true);
+    });
+    auto buffered = [&](const char *name, uint64_t preallocate_size, bool use_io_uring, bool direct_io) {
+        row(name, [=](bool first) -> BinaryStream* {
+            fcFileStreamConfig conf;
+            conf.preallocate_size = preallocate_size;
+            conf.use_io_uring = use_io_uring;
+            conf.direct_io = direct_io;
+            auto s = new FileStream(path, conf);
+            if (first && use_io_uring && !s->isIOUringEnabled()) {
+                printf("  %s: io_uring is not available. fell back to the I/O thread\n", name);
+            }
+            if (first && direct_io && !s->isDirectIOEnabled()) {
+                printf("  %s: O_DIRECT is not available. fell back to the page cache\n", name);
+            }
+            return s;
+        });
+    };
+    buffered("buffered file stream", 0, false, false);
+    buffered("buffered file stream + preallocation", 64 * 1024 * 1024, false, false);
+    buffered("io_uring file stream", 0, true, false);
+    buffered("direct I/O file stream", 64 * 1024 * 1024, false, true);
+    remove(path);
+}
+
+// a full disk must be reported, not dropped silently: writes after the failure are rejected
+static void FileStreamErrorTest()
+{
+#ifdef __linux__
+    auto test = [](const char *name, bool use_io_uring) {
+        fcFileStreamConfig conf;
+        conf.use_io_uring = use_io_uring;
+        auto s = new FileStream("/dev/full", conf);
+        if (!s->isValid()) {
+            printf("  %s: /dev/full is not available\n", name);
+            s->release();
+            return;
+        }
+        Buffer data(1024 * 1024);
+        for (int i = 0; i < 16; ++i) { s->write(data.data(), data.size()); }
+        bool flushed = s->flush();
+        size_t written = s->tellp();
+        size_t rejected = s->write(data.data(), data.size());
+        bool ok = !flushed && s->getError() == ENOSPC && rejected == 0 && s->tellp() == written;
+        printf("  %s: %s\n", name, ok ? "ok" : "FAILED");
+        s->release();
+    };
+    test("write error (I/O thread)", false);
+    test("write error (io_uring)", true);
+#endif
+}
+
+// MP4-like frames (4 byte length + NAL) by write() per piece and by writev().
+// contents must match, and custom streams should get far fewer callbacks.
+static void WritevTest()
+{
+    const int NumFrames = 256;
+    Buffer nal(64 * 1024);
+    for (size_t i = 0; i < nal.size(); ++i) { nal[i] = (char)(i * 7); }
+    const size_t nal_sizes[] = { 20, 8, 900, 60000, 3000 };
+
+    struct Counter
+    {
+        Buffer data;
+        int calls = 0;
+    };
+    auto make_custom = [](Counter& c) {
+        CustomStreamData csd;
+        csd.obj = &c;
+        csd.tellp = [](void *obj) { return ((Counter*)obj)->data.size(); };
+        csd.seekp = [](void*, size_t) {};
+        csd.write = [](void *obj, const void *data, size_t len) {
+            auto& c = *(Counter*)obj;
+            c.data.append((const char*)data, len);
+            ++c.calls;
+            return len;
+        };
+        return new CustomStream(csd);
+    };
+    auto write_frames = [&](BinaryStream& s, bool gather) {
+        uint32_t lengths[5];
+        IOVec vecs[10];
+        for (int f = 0; f < NumFrames; ++f) {
+            int n = 0;
+            for (int i = 0; i < 5; ++i) {
+                size_t size = nal_sizes[(f + i) % 5];
+                lengths[i] = uint32_t(size);
+                vecs[n++] = { &lengths[i], 4 };
+                vecs[n++] = { nal.data(), size };
+            }
+            if (gather) {
+                s.writev(vecs, n);
+            }
+            else {
+                for (int i = 0; i < n; ++i) { s.write(vecs[i].data, vecs[i].size); }
+            }
+        }
+    };
+
+    Counter c1, c2;
+    {
+        auto s1 = make_custom(c1);
+        auto s2 = make_custom(c2);
+        write_frames(*s1, false);
+        write_frames(*s2, true);
+        s1->release();
+        s2->release();
+    }
+    bool same = c1.data.size() == c2.data.size() && memcmp(c1.data.data(), c2.data.data(), c1.data.size()) == 0;
+    printf("  custom stream: write() %.1lf calls/frame, writev() %.1lf calls/frame %s\n",
+        double(c1.calls) / NumFrames, double(c2.calls) / NumFrames, same ? "" : "FAILED");
+
+    Buffer mem;
+    {
+        BufferStream bs(mem);
+        write_frames(bs, true);
+    }
+    printf("  memory stream: %s\n", mem.size() == c1.data.size() && memcmp(mem.data(), c1.data.data(), mem.size()) == 0 ? "ok" : "FAILED");
+
+    const char *path = "WritevTest.bin";
+    {
+        fcFileStreamConfig conf;
+        conf.buffer_size = 16 * 1024;
+        auto fs = new FileStream(path, conf);
+        write_frames(*fs, true);
+        fs->release();
+    }
+    std::ifstream is(path, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+    is.close();
+    printf("  file stream: %s\n", data.size() == c1.data.size() && memcmp(data.data(), c1.data.data(), data.size()) == 0 ? "ok" : "FAILED");
+    remove(path);
+}
+
+// a context writing to a fast sink and a slow one (e.g. network). with AsyncStream the slow one doesn't stall the writer.
+static void FanOutTest()
+{
+    const int NumFrames = 200;
+    Buffer payload(16 * 1024);
+    for (size_t i = 0; i < payload.size(); ++i) { payload[i] = (char)(i * 3); }
+
+    struct SlowSink
+    {
+        Buffer data;
+        size_t pos = 0;
+    };
+    auto make_slow = [](SlowSink& sink) {
+        CustomStreamData csd;
+        csd.obj = &sink;
+        csd.tellp = [](void *obj) { return ((SlowSink*)obj)->pos; };
+        csd.seekp = [](void *obj, size_t pos) { ((SlowSink*)obj)->pos = pos; };
+        csd.write = [](void *obj, const void *data, size_t len) {
+            auto& s = *(SlowSink*)obj;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            if (s.data.size() < s.pos + len) { s.data.resize(s.pos + len); }
+            memcpy(s.data.data() + s.pos, data, len);
+            s.pos += len;
+            return len;
+        };
+        return new CustomStream(csd);
+    };
+    auto write_frames = [&](std::vector<BinaryStream*>& streams) {
+        for (auto s : streams) { *s << uint32_t(0) << uint32_t('mdat'); }
+        for (int f = 0; f < NumFrames; ++f) {
+            for (auto s : streams) {
+                *s << uint32_t(f);
+                s->write(payload.data(), payload.size());
+            }
+        }
+        for (auto s : streams) {
+            size_t end = s->tellp();
+            s->seekp(0);
+            *s << uint32_t(end);
+            s->seekp(end);
+        }
+    };
+
+    auto run = [&](const char *name, bool async, fcSinkLagPolicy policy, int max_queue_size) {
+        Buffer fast_data;
+        SlowSink slow;
+        BinaryStream *slow_stream = make_slow(slow);
+        AsyncStream *as = nullptr;
+        if (async) {
+            fcAsyncStreamConfig conf;
+            conf.lag_policy = policy;
+            conf.max_queue_size = max_queue_size;
+            as = new AsyncStream(slow_stream, conf);
+            slow_stream->release();
+            slow_stream = as;
+        }
+        std::vector<BinaryStream*> streams = { new BufferStream(fast_data), slow_stream };
+
+        auto begin = Clock::now();
+        write_frames(streams);
+        double writer_ms = ElapsedMS(begin);
+
+        fcAsyncStreamStats stats;
+        uint64_t counted = 0;
+        if (as) { as->flush(); as->getStats(stats); counted = as->getWrittenBytes(); }
+        for (auto s : streams) { s->release(); }
+        double total_ms = ElapsedMS(begin);
+
+        bool same = slow.data.size() == fast_data.size() && memcmp(slow.data.data(), fast_data.data(), fast_data.size()) == 0;
+        // a detached stream counts only what was queued for the sink
+        bool ok = policy == fcSinkLagPolicy::Detach ? stats.detached && counted < fast_data.size() : same;
+        printf("  %s: writer %.1lfms, until the slow sink completes %.1lfms", name, writer_ms, total_ms);
+        if (as) {
+            printf(", peak queue %.1lfKB, lag p99 %.1lfms, stalls %d%s", stats.peak_queued_bytes / 1024.0, stats.lag.p99, (int)stats.stalls, stats.detached ? ", detached" : "");
+        }
+        printf(" %s\n", ok ? "" : "FAILED");
+    };
+    run("sync", false, fcSinkLagPolicy::Block, 0);
+    run("async", true, fcSinkLagPolicy::Block, 64 * 1024 * 1024);
+    run("async (256KB queue, Block)", true, fcSinkLagPolicy::Block, 256 * 1024);
+    run("async (256KB queue, Detach)", true, fcSinkLagPolicy::Detach, 256 * 1024);
+}
+
+// random writes and header patch-ups to a chunked stream and a contiguous one must give the same data,
+// through read(), chunks and compact(), and also when writing continues after compact().
+static void ChunkedMemoryStreamTest()
+{
+    Buffer expected;
+    BufferStream bs(expected);
+    auto cs = new ChunkedBufferStream(4096);
+    std::vector<BinaryStream*> streams = { &bs, cs };
+
+    auto write_random = [&](uint32_t seed, int count) {
+        Buffer data(10000);
+        for (int i = 0; i < count; ++i) {
+            seed = seed * 1103515245 + 12345;
+            size_t len = seed % data.size();
+            for (size_t j = 0; j < len; ++j) { data[j] = (char)(seed + j); }
+            for (auto s : streams) {
+                if (i % 8 == 7) {
+                    // patch somewhere in the middle, then go back to the end
+                    size_t end = s->tellp();
+                    s->seekp(end / 3);
+                    s->write(data.data(), std::min<size_t>(len, end - end / 3));
+                    s->seekp(end);
+                }
+                else {
+                    s->write(data.data(), len);
+                }
+            }
+        }
+    };
+    auto verify = [&]() {
+        bool ok = cs->size() == expected.size();
+
+        Buffer chunks;
+        for (int i = 0; i < cs->getNumChunks(); ++i) {
+            fcBufferData c = cs->getChunk(i);
+            chunks.append((const char*)c.data, c.size);
+        }
+        ok = ok && chunks.size() == expected.size() && memcmp(chunks.data(), expected.data(), expected.size()) == 0;
+
+        Buffer read(expected.size());
+        cs->seekg(0);
+        ok = ok && cs->read(read.data(), read.size()) == expected.size() && memcmp(read.data(), expected.data(), expected.size()) == 0;
+        return ok;
+    };
+
+    write_random(1, 200);
+    bool ok = verify();
+    int num_chunks = cs->getNumChunks();
+    fcBufferData contiguous = cs->compact();
+    ok = ok && contiguous.size == expected.size() && memcmp(contiguous.data, expected.data(), expected.size()) == 0;
+    ok = ok && cs->getNumChunks() == 1;
+    write_random(2, 200);
+    ok = ok && verify();
+    printf("  chunked memory stream: %d chunks, %d after compact and more writes %s\n", num_chunks, cs->getNumChunks(), ok ? "" : "FAILED");
+    cs->release();
+}
+
+// a writer thread appends to a small ring and a consumer thread drains it in place.
+// also checks that backward writes change only bytes the consumer hasn't peeked.
+static void RingStreamTest()
+{
+    const size_t TotalSize = 64 * 1024 * 1024;
+    bool ok = true;
+
+    auto rs = new RingStream(64 * 1024);
+    Buffer received;
+    std::thread consumer([&]() {
+        fcBufferData d;
+        while (rs->peek(d, -1)) {
+            received.append((const char*)d.data, d.size);
+            rs->advance(d.size);
+        }
+    });
+
+    auto begin = Clock::now();
+    Buffer data(20000);
+    uint32_t seed = 1;
+    for (size_t written = 0; written < TotalSize; ) {
+        seed = seed * 1103515245 + 12345;
+        size_t len = std::min<size_t>(seed % data.size(), TotalSize - written);
+        for (size_t j = 0; j < len; ++j) { data[j] = (char)(written + j); }
+        rs->write(data.data(), len);
+        written += len;
+    }
+    rs->close();
+    consumer.join();
+    double elapsed = ElapsedMS(begin);
+    ok = ok && received.size() == TotalSize;
+    for (size_t i = 0; ok && i < received.size(); ++i) { ok = received[i] == (char)i; }
+    rs->release();
+
+    // patch semantics
+    {
+        auto rs = new RingStream(4096);
+        Buffer a(100), b(100);
+        memset(a.data(), 'a', a.size());
+        memset(b.data(), 'b', b.size());
+        fcBufferData d;
+        rs->write(a.data(), 100);
+        rs->peek(d, 0);                 // consumer has seen [0, 100)
+        rs->write(a.data(), 100);
+        rs->seekp(50);
+        rs->write(b.data(), 100);       // [50, 100) is dropped, [100, 150) is applied
+        rs->seekp(200);
+        rs->advance(100);
+        rs->peek(d, 0);
+        const char *p = (const char*)d.data;
+        ok = ok && rs->getDroppedPatchBytes() == 50 && d.size == 100 && p[0] == 'b' && p[49] == 'b' && p[50] == 'a';
+        rs->close();
+        rs->advance(d.size);
+        ok = ok && !rs->peek(d, 0);
+        rs->release();
+    }
+
+    // Detach: a write into the full ring closes the stream instead of waiting. discarded bytes are not counted as written
+    {
+        auto rs = new RingStream(4096, fcSinkLagPolicy::Detach);
+        Buffer a(3000);
+        fcBufferData d;
+        rs->write(a.data(), a.size());
+        rs->write(a.data(), a.size());  // 1096 bytes fit
+        rs->write(a.data(), a.size());  // closed
+        ok = ok && rs->getWrittenBytes() == 4096 && rs->tellp() == 9000;
+        ok = ok && rs->peek(d, 0) && d.size == 4096;
+        rs->advance(d.size);
+        ok = ok && !rs->peek(d, 0);
+        rs->release();
+    }
+
+    // Block on a pool worker: a context writes under its lock (WebM / mp4 writers), and its other task takes the same lock.
+    // the waiting write must not run that task on its own thread, or it would lock the mutex it already holds.
+    {
+        auto rs = new RingStream(4096);
+        std::thread slow_consumer([&]() {
+            fcBufferData d;
+            while (rs->peek(d, -1)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                rs->advance(d.size);
+            }
+        });
+
+        std::mutex ctx_mutex;
+        std::atomic<std::thread::id> lock_owner;
+        std::atomic_bool reentered = { false };
+        TaskGroup tasks;
+        tasks.run([&]() {
+            std::unique_lock<std::mutex> l(ctx_mutex);
+            lock_owner = std::this_thread::get_id();
+            Buffer a(64 * 1024);
+            rs->write(a.data(), a.size());
+            lock_owner = std::thread::id();
+        });
+        tasks.run([&]() {
+            if (lock_owner == std::this_thread::get_id()) {
+                reentered = true; // would dead-lock on ctx_mutex
+                return;
+            }
+            std::unique_lock<std::mutex> l(ctx_mutex);
+        });
+        tasks.wait();
+        rs->close();
+        slow_consumer.join();
+        ok = ok && !reentered && rs->getWrittenBytes() == 64 * 1024;
+        rs->release();
+    }
+    printf("  ring stream: %.1lfMB/s through a 64KB ring %s\n", double(TotalSize) / (1024 * 1024) / (elapsed / 1000.0), ok ? "" : "FAILED");
+}
+
+void StreamTest()
+{
+    printf("StreamTest begin\n");
+    RingStreamTest();
+    ChunkedMemoryStreamTest();
+    WritevTest();
+    FanOutTest();
+    FileStreamBenchmark();
+    FileStreamErrorTest();
+    printf("StreamTest end\n");
+}
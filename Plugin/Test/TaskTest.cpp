@@ -0,0 +1,280 @@
+#include "pch.h"
+#include "TestCommon.h"
+#include <chrono>
+#include <future>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
+
+using Clock = std::chrono::high_resolution_clock;
+
+static double ElapsedMS(Clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+// small amount of work similar to encoding a tiny frame
+static void DummyWork(std::atomic_int& counter)
+{
+    volatile int v = 0;
+    for (int i = 0; i < 1000; ++i) { v += i; }
+    ++counter;
+}
+
+static void TaskBenchmark(int num_tasks, int max_tasks)
+{
+    // old TaskGroup: one std::async (= one OS thread) per task
+    {
+        std::atomic_int counter = { 0 };
+        auto begin = Clock::now();
+        std::deque<std::future<void>> futures;
+        for (int i = 0; i < num_tasks; ++i) {
+            while (futures.size() >= (size_t)max_tasks) {
+                futures.front().get();
+                futures.pop_front();
+            }
+            futures.push_back(std::async(std::launch::async, [&counter]() { DummyWork(counter); }));
+        }
+        for (auto& f : futures) { f.get(); }
+        printf("  std::async: %d tasks %.2lfms\n", (int)counter, ElapsedMS(begin));
+    }
+
+    // TaskGroup on the shared thread pool
+    {
+        std::atomic_int counter = { 0 };
+        auto begin = Clock::now();
+        TaskGroup group;
+        group.setMaxTasks(max_tasks);
+        for (int i = 0; i < num_tasks; ++i) {
+            group.run([&counter]() { DummyWork(counter); });
+        }
+        group.wait();
+        printf("  TaskGroup: %d tasks %.2lfms\n", (int)counter, ElapsedMS(begin));
+    }
+}
+
+// frames of mixed cost: every 8th frame is 20x heavier than others (e.g. large frame with poor compression)
+static void MixedFrameWork(int i, std::atomic_int& counter)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(i % 8 == 0 ? 20 : 1));
+    ++counter;
+}
+
+static void MixedTaskBenchmark(int num_tasks, int max_tasks)
+{
+    // head-of-line throttling: wait for the oldest task when the limit is reached
+    {
+        std::atomic_int counter = { 0 };
+        auto begin = Clock::now();
+        std::deque<std::future<void>> futures;
+        for (int i = 0; i < num_tasks; ++i) {
+            while (futures.size() >= (size_t)max_tasks) {
+                futures.front().get();
+                futures.pop_front();
+            }
+            auto task = std::make_shared<std::packaged_task<void()>>([i, &counter]() { MixedFrameWork(i, counter); });
+            futures.push_back(task->get_future());
+            ThreadPool::getInstance().run([task]() { (*task)(); });
+        }
+        for (auto& f : futures) { f.get(); }
+        printf("  mixed (head-of-line): %d tasks %.2lfms\n", (int)counter, ElapsedMS(begin));
+    }
+
+    // TaskGroup: a slot is released as soon as any task completes
+    {
+        std::atomic_int counter = { 0 };
+        auto begin = Clock::now();
+        TaskGroup group;
+        group.setMaxTasks(max_tasks);
+        for (int i = 0; i < num_tasks; ++i) {
+            group.run([i, &counter]() { MixedFrameWork(i, counter); });
+        }
+        group.wait();
+        printf("  mixed (TaskGroup): %d tasks %.2lfms\n", (int)counter, ElapsedMS(begin));
+    }
+}
+
+// enqueue latency of the queue used on the video/audio feed paths. Queue: TaskQueue or SPSCTaskQueue
+// tasks are pushed in small bursts like frames / audio blocks, and the consumer catches up between bursts.
+template<class Queue>
+static void EnqueueBenchmark(const char *name, int num_bursts, int burst_size)
+{
+    std::atomic_int counter = { 0 };
+    double total = 0.0, max = 0.0;
+    {
+        Queue queue;
+        for (int bi = 0; bi < num_bursts; ++bi) {
+            for (int i = 0; i < burst_size; ++i) {
+                auto begin = Clock::now();
+                queue.run([&counter]() { ++counter; });
+                double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+                total += elapsed;
+                max = std::max<double>(max, elapsed);
+            }
+            while (counter < (bi + 1) * burst_size) { std::this_thread::yield(); }
+        }
+        queue.wait();
+    }
+    printf("  %s enqueue: avg %.1lfns max %.1lfns\n", name, total / (num_bursts * burst_size), max);
+}
+
+// latency of a task submitted behind a backlog of background tasks (e.g. video frame while exporting png sequence)
+static void PriorityTest()
+{
+    TaskGroup background;
+    background.setPriority(fcTaskPriority::Background);
+    background.setMaxTasks(256);
+    for (int i = 0; i < 256; ++i) {
+        background.run([]() { std::this_thread::sleep_for(std::chrono::milliseconds(1)); });
+    }
+
+    auto measure = [](fcTaskPriority priority) {
+        TaskGroup group;
+        group.setPriority(priority);
+        auto begin = Clock::now();
+        std::atomic<double> latency = { 0.0 };
+        group.run([&]() { latency = ElapsedMS(begin); });
+        group.wait();
+        return (double)latency;
+    };
+    double realtime = measure(fcTaskPriority::RealTime);
+    double same = measure(fcTaskPriority::Background);
+    background.wait();
+    printf("  latency behind background tasks: RealTime %.2lfms, Background %.2lfms\n", realtime, same);
+}
+
+// feed frames faster than the encoder can process and see how each backpressure policy behaves
+static void BackpressureTest(fcBackpressurePolicy policy, const char *name)
+{
+    FrameQueue<std::vector<char>> frames;
+    frames.setPolicy(policy, 8 * 1024);
+    for (int i = 0; i < 2; ++i) { frames.emplace(); }
+
+    SPSCTaskQueue encoder;
+    auto begin = Clock::now();
+    for (int i = 0; i < 64; ++i) {
+        if (auto frame = frames.acquire(1024)) {
+            frames.push(frame);
+            encoder.run([&frames]() {
+                if (auto frame = frames.pop()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                    frames.release(frame);
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    encoder.wait();
+
+    auto stats = frames.getStats();
+    printf("  backpressure %s: %.2lfms, frames %d dropped %d late %d\n",
+        name, ElapsedMS(begin), (int)stats.frames, (int)stats.dropped_frames, (int)stats.late_frames);
+}
+
+static void NestedTaskTest()
+{
+    // tasks that wait for other tasks must not dead-lock even if all workers are waiting
+    std::atomic_int counter = { 0 };
+    int n = ThreadPool::getInstance().getMaxWorkers() * 2;
+    TaskGroup outer;
+    outer.setMaxTasks(n);
+    for (int i = 0; i < n; ++i) {
+        outer.run([&counter]() {
+            TaskGroup inner;
+            for (int j = 0; j < 16; ++j) {
+                inner.run([&counter]() { DummyWork(counter); });
+            }
+            inner.wait();
+        });
+    }
+    outer.wait();
+    printf("  nested: %d tasks\n", (int)counter);
+}
+
+static void TaskExceptionTest()
+{
+    // a throwing task must release its slot, and wait() rethrows its exception
+    TaskGroup group;
+    group.setMaxTasks(1);
+    std::atomic_int counter = { 0 };
+    group.run([]() { throw std::runtime_error("task failed"); });
+    group.run([&counter]() { ++counter; });
+    bool thrown = false;
+    try {
+        group.wait();
+    }
+    catch (std::runtime_error&) {
+        thrown = true;
+    }
+    group.run([&counter]() { ++counter; });
+    group.wait();
+    printf("  exception: %s\n", thrown && counter == 2 ? "ok" : "FAILED");
+}
+
+// defined in fccore.cpp. exported for the C# side and not declared in fccore.h
+fcAPI int  fcAddDeferredCall(const std::function<void()>& dc, int id);
+fcAPI void fcReleaseDeferredCall(int id);
+fcAPI void fcCallDeferredCall(int id);
+fcAPI void fcGuardBegin();
+fcAPI void fcGuardEnd();
+
+static void DeferredCallTest()
+{
+    // a slow call (readback of one camera) doesn't hold up other ids. releasing its own id waits until it returns,
+    // and so does fcGuardBegin().
+    std::atomic_bool started = { false }, done = { false };
+    auto slow_call = [&]() {
+        started = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        done = true;
+    };
+    std::atomic_int fast_calls = { 0 };
+    int slow = fcAddDeferredCall(slow_call, 0);
+    int fast = fcAddDeferredCall([&fast_calls]() { ++fast_calls; }, 0);
+
+    std::thread render_thread([slow]() { fcCallDeferredCall(slow); });
+    while (!started) { std::this_thread::yield(); }
+    auto begin = Clock::now();
+    fcCallDeferredCall(fast);
+    fcReleaseDeferredCall(fast);
+    double fast_ms = ElapsedMS(begin);
+    fcReleaseDeferredCall(slow);
+    bool ok = done && fast_calls == 1 && fast_ms < 50.0;
+    render_thread.join();
+    fcCallDeferredCall(slow); // released. no-op
+    fcCallDeferredCall(fast);
+    ok = ok && fast_calls == 1;
+
+    started = done = false;
+    slow = fcAddDeferredCall(slow_call, 0);
+    render_thread = std::thread([slow]() { fcCallDeferredCall(slow); });
+    while (!started) { std::this_thread::yield(); }
+    fcGuardBegin();
+    ok = ok && done;
+    fcGuardEnd();
+    render_thread.join();
+    fcReleaseDeferredCall(slow);
+
+    printf("  deferred call: other id called and released in %.3lfms during a 100ms call %s\n", fast_ms, ok ? "" : "FAILED");
+}
+
+void TaskTest()
+{
+    printf("TaskTest begin\n");
+    printf("  workers: %d\n", ThreadPool::getInstance().getMaxWorkers());
+
+    TaskBenchmark(10000, 8);
+    MixedTaskBenchmark(256, std::min<int>(ThreadPool::getInstance().getMaxWorkers(), 8));
+    EnqueueBenchmark<TaskQueue>("TaskQueue", 10000, 8);
+    EnqueueBenchmark<SPSCTaskQueue>("SPSCTaskQueue", 10000, 8);
+    PriorityTest();
+    BackpressureTest(fcBackpressurePolicy::Block, "Block");
+    BackpressureTest(fcBackpressurePolicy::DropNewest, "DropNewest");
+    BackpressureTest(fcBackpressurePolicy::DropOldest, "DropOldest");
+    BackpressureTest(fcBackpressurePolicy::Grow, "Grow");
+    NestedTaskTest();
+    TaskExceptionTest();
+    DeferredCallTest();
+
+    printf("TaskTest end\n");
+}
@@ -10,6 +10,10 @@ void WaveTest();
 void OggTest();
 void FlacTest();
 void ConvertTest();
+void TaskTest();
+void BufferTest();
+void StreamTest();
+bool AllocTest();
 
 int main(int argc, char *argv[])
 {
@@ -22,6 +26,10 @@ int main(int argc, char *argv[])
     bool ogg = false;
     bool flac = false;
     bool convert = false;
+    bool task = false;
+    bool buffer = false;
+    bool stream = false;
+    bool alloc = false;
 
     if (argc <= 1) {
         png = exr = gif = mp4 = webm = convert = true;
@@ -38,6 +46,10 @@ int main(int argc, char *argv[])
             else if (strstr(argv[i], "ogg")) { ogg = true; }
             else if (strstr(argv[i], "flac")) { flac = true; }
             else if (strstr(argv[i], "convert")) { convert = true; }
+            else if (strstr(argv[i], "task")) { task = true; }
+            else if (strstr(argv[i], "buffer")) { buffer = true; }
+            else if (strstr(argv[i], "stream")) { stream = true; }
+            else if (strstr(argv[i], "alloc")) { alloc = true; }
         }
     }
 
@@ -51,6 +63,13 @@ int main(int argc, char *argv[])
     if (ogg) OggTest();
     if (flac) FlacTest();
     if (convert) ConvertTest();
+    if (task) TaskTest();
+    if (buffer) BufferTest();
+    if (stream) StreamTest();
+
+    int ret = 0;
+    if (alloc && !AllocTest()) { ret = 1; }
 
     fcWaitAsyncDelete();
+    return ret;
 }
@@ -1,5 +1,7 @@
 #include "pch.h"
 #include "TestCommon.h"
+#include <chrono>
+#include <atomic>
 #ifdef _WIN32
     #pragma comment(lib, "Half.lib")
 #endif
@@ -75,3 +77,45 @@ void CreateAudioData(float *samples, int num_samples, double t, float scale)
         samples[i] = std::sin((float(i + ((double)num_samples * t)) * 5.5f) * (3.14159f / 180.0f)) * scale;
     }
 }
+
+uint64_t GetFileSize(const char *path)
+{
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+    return f ? (uint64_t)f.tellg() : 0;
+}
+
+bool RunBorrowBenchmark(const BorrowBenchmark& b)
+{
+    using Clock = std::chrono::high_resolution_clock;
+    auto elapsed_ms = [](Clock::time_point begin) { return std::chrono::duration<double, std::milli>(Clock::now() - begin).count(); };
+
+    std::atomic_int num_released = { 0 };
+    fcReleasePixels release = [](void *userdata, const void*) { ++*(std::atomic_int*)userdata; };
+
+    double caller_ms[2] = {}, total_ms[2] = {};
+    uint64_t size[2] = {};
+    for (int r = 0; r < 2; ++r) {
+        bool borrow = r == 1;
+        if (!b.begin()) {
+            printf("  %s: not available\n", b.name);
+            return false;
+        }
+        auto begin = Clock::now();
+        for (int i = 0; i < b.num_frames; ++i) {
+            auto submit = Clock::now();
+            b.submit(i, borrow ? release : nullptr, &num_released);
+            if (i >= b.untimed_frames) { caller_ms[r] += elapsed_ms(submit); }
+        }
+        caller_ms[r] /= std::max<int>(b.num_frames - b.untimed_frames, 1);
+        size[r] = b.end();
+        total_ms[r] = elapsed_ms(begin);
+    }
+
+    int expected = b.num_frames * b.releases_per_frame;
+    bool ok = num_released == expected && size[0] > 0 && size[0] == size[1];
+    printf("  %s. caller-side cost per frame: copy %.3lfms, borrow %.3lfms. until written: copy %.1lfms, borrow %.1lfms. "
+        "output: copy %llu bytes, borrow %llu bytes. released %d / %d %s\n",
+        b.name, caller_ms[0], caller_ms[1], total_ms[0], total_ms[1],
+        (unsigned long long)size[0], (unsigned long long)size[1], num_released.load(), expected, ok ? "" : "FAILED");
+    return true;
+}
@@ -10,6 +10,7 @@
 #include <fstream>
 #include <vector>
 #include <thread>
+#include <functional>
 #include <OpenEXR/half.h>
 #include "../fccore/fccore.h"
 #include "../fccore/Foundation/fcFoundation.h"
@@ -88,5 +89,22 @@ Def(RGBAf32, fcPixelFormat_RGBAf32)
 
 template<class T> void CreateVideoData(T *rgba, int width, int height, int frame);
 void CreateAudioData(float *samples, int num_samples, double t, float scale);
+uint64_t GetFileSize(const char *path);
+
+// caller-side cost of *Pixels() (copy) vs *PixelsBorrowed() (no copy), and time until the output is written.
+// the same frames are submitted twice: with release == nullptr (copy) and with release (borrow).
+struct BorrowBenchmark
+{
+    const char *name = "";          // printed. e.g. "PngBorrowBenchmark: 1920x1080 RGBAu8 x 8 to files"
+    int num_frames = 0;
+    int releases_per_frame = 1;     // *Borrowed() calls per frame. e.g. exr layers
+    int untimed_frames = 0;         // first frames left out of the caller-side cost. e.g. gif keyframe, built on the caller's thread either way
+    std::function<bool()> begin;    // create the context and its output. return false if it is not available
+    std::function<void(int frame, fcReleasePixels release, void *userdata)> submit;
+    std::function<uint64_t()> end;  // release the context, wait until written, and return the output size
+};
+// prints FAILED if not every borrowed frame is released, or if the two runs give no or different output.
+// return false if begin() fails.
+bool RunBorrowBenchmark(const BorrowBenchmark& b);
 
 bool InitializeD3D11();
@@ -29,6 +29,12 @@ void WaveTest(int bits)
         }
     }
 
+    // written synchronously, so the stats are final here. 44: RIFF header
+    fcContextStats stats;
+    bool ok = fcGetContextStats(ctx, &stats) && stats.frames_written == DurationInSeconds &&
+        stats.stream_bytes[0] == 44 + (uint64_t)SamplingRate * DurationInSeconds * bits / 8;
+    printf("  wave %d bits stats: %s\n", bits, ok ? "ok" : "FAILED");
+
     fcReleaseContext(ctx);
     fcReleaseStream(fstream);
 }
@@ -129,6 +129,78 @@ void WebMTest(fcWebMVideoEncoder ve, fcWebMAudioEncoder ae)
 }
 
 
+// packet callback only, no output streams
+struct WebMPacketTestContext
+{
+    int num_video_packets = 0;
+    int num_keyframes = 0;
+    int num_audio_packets = 0;
+    size_t num_bytes = 0;
+    bool has_codec_private = false;
+    double last_video_timestamp = -1.0;
+    bool monotonic = true;
+
+    static void OnPacket(void *_this, const fcPacket *packet);
+};
+
+void WebMPacketTestContext::OnPacket(void *_this, const fcPacket *packet)
+{
+    auto *self = (WebMPacketTestContext*)_this;
+    self->num_bytes += packet->size;
+    if (packet->codec == fcPacketCodec::VP8 || packet->codec == fcPacketCodec::VP9) {
+        ++self->num_video_packets;
+        if (packet->keyframe) { ++self->num_keyframes; }
+        if (packet->timestamp < self->last_video_timestamp) { self->monotonic = false; }
+        self->last_video_timestamp = packet->timestamp;
+    }
+    else {
+        ++self->num_audio_packets;
+        if (packet->codec_private) { self->has_codec_private = true; }
+    }
+}
+
+void WebMPacketTest(fcWebMVideoEncoder ve, fcWebMAudioEncoder ae)
+{
+    const int DurationInSeconds = 5;
+    const int FrameRate = 30;
+    const int Width = 320;
+    const int Height = 240;
+    const int SamplingRate = 48000;
+
+    fcWebMConfig conf;
+    conf.video_encoder = ve;
+    conf.video_width = Width;
+    conf.video_height = Height;
+    conf.video_target_bitrate = 256 * 1000;
+    conf.audio_encoder = ae;
+    conf.audio_sample_rate = SamplingRate;
+    conf.audio_num_channels = 1;
+    conf.audio_target_bitrate = 64 * 1000;
+
+    WebMPacketTestContext testctx;
+    fcIWebMContext *ctx = fcWebMCreateContext(&conf);
+    fcWebMAddPacketCallback(ctx, &WebMPacketTestContext::OnPacket, &testctx);
+
+    RawVector<RGBAu8> video_frame(Width * Height);
+    RawVector<float> audio_sample(SamplingRate);
+    for (int i = 0; i < DurationInSeconds; ++i) {
+        for (int fi = 0; fi < FrameRate; ++fi) {
+            int frame = i * FrameRate + fi;
+            CreateVideoData(video_frame.data(), Width, Height, frame);
+            fcWebMAddVideoFramePixels(ctx, video_frame.data(), fcPixelFormat_RGBAu8, (double)frame / FrameRate);
+        }
+        CreateAudioData(audio_sample.data(), (int)audio_sample.size(), (double)i, 1.0f);
+        fcWebMAddAudioSamples(ctx, audio_sample.data(), (int)audio_sample.size());
+    }
+    // packets are flushed on release
+    fcReleaseContext(ctx);
+
+    printf("  video packets: %d (keyframes: %d, timestamps %s), audio packets: %d (codec private: %s), %d bytes\n",
+        testctx.num_video_packets, testctx.num_keyframes, testctx.monotonic ? "monotonic" : "NOT monotonic",
+        testctx.num_audio_packets, testctx.has_codec_private ? "yes" : "no", (int)testctx.num_bytes);
+}
+
+
 void WebMTest()
 {
     if (!fcWebMIsSupported()) {
@@ -143,5 +215,9 @@ void WebMTest()
     printf("WebMTest (VP9 & Opus) begin\n");
     WebMTest(fcWebMVideoEncoder::VPX_VP9, fcWebMAudioEncoder::Opus);
     printf("WebMTest (VP9 & Opus) end\n");
+
+    printf("WebMPacketTest (VP8 & Vorbis) begin\n");
+    WebMPacketTest(fcWebMVideoEncoder::VPX_VP8, fcWebMAudioEncoder::Vorbis);
+    printf("WebMPacketTest (VP8 & Vorbis) end\n");
 }
 
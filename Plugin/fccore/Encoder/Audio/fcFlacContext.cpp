@@ -37,14 +37,16 @@ public:
 
     void addOutputStream(fcStream *s) override;
     bool addSamples(const float *samples, int num_samples) override;
+    bool getContextStats(fcContextStats& dst) override;
 
 private:
     fcFlacConfig m_conf;
     std::vector<fcFlacWriterPtr> m_writers;
 
-    TaskQueue       m_tasks;
+    SPSCTaskQueue   m_tasks;
     AudioBuffers    m_buffers;
     RawVector<int>  m_conversion_buffer;
+    ContextStats    m_stats;
 };
 
 
@@ -142,6 +144,7 @@ fcFlacContext::fcFlacContext(const fcFlacConfig& c)
     : m_conf(c)
 {
     m_conf.max_tasks = std::max<int>(m_conf.max_tasks, 1);
+    m_tasks.setPriority(m_conf.priority);
 
     for (int i = 0; i < m_conf.max_tasks; ++i) {
         m_buffers.emplace();
@@ -158,6 +161,7 @@ void fcFlacContext::addOutputStream(fcStream *s)
 {
     if (s) {
         m_writers.emplace_back(new fcFlacWriter(m_conf, s));
+        m_stats.addStream(s);
     }
 }
 
@@ -165,20 +169,38 @@ bool fcFlacContext::addSamples(const float *samples, int num_samples)
 {
     if (!samples || num_samples == 0) { return false; }
 
+    m_stats.onSubmit();
     auto buf = m_buffers.acquire();
     buf->assign(samples, num_samples);
 
+    m_stats.onEnqueue();
     m_tasks.run([this, buf]() {
-        float scale = float((1 << (m_conf.bits_per_sample - 1)) - 1);
-        m_conversion_buffer.resize(buf->size());
-        fcF32ToI32ScaleSamples(m_conversion_buffer.data(), buf->data(), buf->size(), scale);
-        for (auto& w : m_writers) {
-            w->write(m_conversion_buffer.data(), (int)m_conversion_buffer.size() / m_conf.num_channels);
+        {
+            ScopedLatency latency(&m_stats, StatsStage::Convert);
+            float scale = float((1 << (m_conf.bits_per_sample - 1)) - 1);
+            m_conversion_buffer.resize(buf->size());
+            fcF32ToI32ScaleSamples(m_conversion_buffer.data(), buf->data(), buf->size(), scale);
         }
+        {
+            // libFLAC writes to the streams from inside the encoder, so this includes the writes
+            ScopedLatency latency(&m_stats, StatsStage::Encode);
+            for (auto& w : m_writers) {
+                w->write(m_conversion_buffer.data(), (int)m_conversion_buffer.size() / m_conf.num_channels);
+            }
+        }
+        m_stats.onEncoded();
+        m_stats.onWritten();
+        m_stats.onDequeue();
     });
     return true;
 }
 
+bool fcFlacContext::getContextStats(fcContextStats& dst)
+{
+    m_stats.getStats(dst);
+    return true;
+}
+
 fcIFlacContext* fcFlacCreateContextImpl(const fcFlacConfig *conf)
 {
     return new fcFlacContext(*conf);
@@ -22,6 +22,7 @@ public:
 
     virtual void addOutputStream(fcStream *s) override;
     virtual bool addSamples(const float *samples, int num_samples) override;
+    virtual bool getContextStats(fcContextStats& dst) override;
 
     void pageOut();
 
@@ -29,7 +30,7 @@ private:
     fcOggConfig m_conf;
     std::vector<fcStream*> m_streams;
 
-    TaskQueue           m_tasks;
+    SPSCTaskQueue       m_tasks;
     AudioBuffers        m_buffers;
     Buffer              m_header_data;
 
@@ -40,6 +41,7 @@ private:
 
     ogg_stream_state    m_ogstream;
     ogg_page            m_ogpage;
+    ContextStats        m_stats;
 };
 
 
@@ -48,6 +50,7 @@ fcOggContext::fcOggContext(const fcOggConfig& conf)
     : m_conf(conf)
 {
     m_conf.max_tasks = std::max<int>(m_conf.max_tasks, 1);
+    m_tasks.setPriority(m_conf.priority);
 
     vorbis_info_init(&m_vo_info);
     switch (conf.bitrate_mode) {
@@ -110,6 +113,7 @@ void fcOggContext::addOutputStream(fcStream *s)
     if (!s) { return; }
     s->addRef();
     m_streams.push_back(s);
+    m_stats.addStream(s);
     s->write(m_header_data.data(), m_header_data.size());
 }
 
@@ -117,9 +121,11 @@ bool fcOggContext::addSamples(const float *samples, int num_samples)
 {
     if (!samples || num_samples == 0) { return false; }
 
+    m_stats.onSubmit();
     auto buf = m_buffers.acquire();
     buf->assign(samples, num_samples);
 
+    m_stats.onEnqueue();
     m_tasks.run([this, buf]() {
         int num_channels = m_conf.num_channels;
         int num_samples = (int)buf->size();
@@ -135,16 +141,28 @@ bool fcOggContext::addSamples(const float *samples, int num_samples)
         if (vorbis_analysis_wrote(&m_vo_dsp, block_size) == 0) {
             pageOut();
         }
+        m_stats.onEncoded();
+        m_stats.onWritten();
+        m_stats.onDequeue();
     });
 
     return true;
 }
 
+bool fcOggContext::getContextStats(fcContextStats& dst)
+{
+    m_stats.getStats(dst);
+    return true;
+}
+
 void fcOggContext::pageOut()
 {
     while (vorbis_analysis_blockout(&m_vo_dsp, &m_vo_block) == 1) {
-        vorbis_analysis(&m_vo_block, nullptr);
-        vorbis_bitrate_addblock(&m_vo_block);
+        {
+            ScopedLatency latency(&m_stats, StatsStage::Encode);
+            vorbis_analysis(&m_vo_block, nullptr);
+            vorbis_bitrate_addblock(&m_vo_block);
+        }
 
         ogg_packet packet;
         while (vorbis_bitrate_flushpacket(&m_vo_dsp, &packet) == 1) {
@@ -152,6 +170,7 @@ void fcOggContext::pageOut()
             for (;;) {
                 int result = ogg_stream_pageout(&m_ogstream, &m_ogpage);
                 if (result == 0) { break; }
+                ScopedLatency latency(&m_stats, StatsStage::Write);
                 for (auto& w : m_streams) {
                     w->write(m_ogpage.header, m_ogpage.header_len);
                     w->write(m_ogpage.body, m_ogpage.body_len);
@@ -13,8 +13,10 @@ public:
 
     void addOutputStream(fcStream *s) override;
     bool addSamples(const float *samples, int num_samples) override;
+    bool getContextStats(fcContextStats& dst) override;
 
 private:
+    void writeHeader(ByteWriter<64>& w, uint32_t data_size);
     void waveBegin(fcStream *s);
     void waveEnd(fcStream *s);
 
@@ -22,24 +24,10 @@ private:
     std::vector<fcStream*> m_streams;
     Buffer m_sample_buffer;
     size_t m_sample_size = 0; // in byte
+    ContextStats m_stats;
 };
 
-struct WaveHeader
-{
-    char    RIFFTag[4] = {'R', 'I', 'F', 'F'};
-    int32_t nFileSize = 0;
-    char    WAVETag[4] = { 'W', 'A', 'V', 'E' };
-    char    fmtTag[4] = { 'f', 'm', 't', ' ' };
-    int32_t nFmtSize = 16;
-    int16_t shFmtID = 1;
-    int16_t shCh = 2;
-    int32_t nSampleRate = 48000;
-    int32_t nBytePerSec = 96000;
-    int16_t shBlockSize = 4;
-    int16_t shBitPerSample = 16;
-    char    dataTag[4] = { 'd', 'a', 't', 'a' };
-    int32_t nBytesData = 0;
-};
+static const size_t WaveHeaderSize = 44;
 
 fcWaveContext::fcWaveContext(const fcWaveConfig& c)
     : m_conf(c)
@@ -61,56 +49,85 @@ void fcWaveContext::addOutputStream(fcStream *s)
         s->addRef();
         waveBegin(s);
         m_streams.push_back(s);
+        m_stats.addStream(s);
     }
 }
 
+// RIFF header. fields are little endian
+void fcWaveContext::writeHeader(ByteWriter<64>& w, uint32_t data_size)
+{
+    int16_t channels = (int16_t)m_conf.num_channels;
+    int16_t bits = (int16_t)m_conf.bits_per_sample;
+    w.write("RIFF", 4);
+    w << uint32_t(WaveHeaderSize - 8 + data_size);  // file size - 8
+    w.write("WAVEfmt ", 8);
+    w << int32_t(16);                                // fmt chunk size
+    w << int16_t(1);                                 // PCM
+    w << channels;
+    w << int32_t(m_conf.sample_rate);
+    w << int32_t(m_conf.sample_rate * bits * channels / 8); // bytes per sec
+    w << int16_t(bits * channels / 8);               // block size
+    w << bits;
+    w.write("data", 4);
+    w << data_size;
+}
+
 void fcWaveContext::waveBegin(fcStream *s)
 {
-    WaveHeader header;
-    header.nSampleRate = m_conf.sample_rate;
-    header.shCh = m_conf.num_channels;
-    header.shBitPerSample = m_conf.bits_per_sample;
-    header.nBytePerSec = header.nSampleRate * header.shBitPerSample * header.shCh / 8;
-    header.shBlockSize = header.shBitPerSample * header.shCh / 8;
-    s->write(&header, sizeof(header));
+    ByteWriter<64> w;
+    writeHeader(w, 0);
+    w.flush(*s);
 }
 
+// rewrite the whole header with the sizes. one seek instead of one per field
 void fcWaveContext::waveEnd(fcStream *s)
 {
-    uint32_t total_size = (uint32_t)(m_sample_size + sizeof(WaveHeader));
-    uint32_t filesize = total_size - 8;
-    uint32_t datasize = total_size - 44;
-    s->seekp(4);
-    s->write(&filesize, 4);
-    s->seekp(40);
-    s->write(&datasize, 4);
+    ByteWriter<64> w;
+    writeHeader(w, (uint32_t)m_sample_size);
+    s->seekp(0);
+    w.flush(*s);
 }
 
 bool fcWaveContext::addSamples(const float *samples, int num_samples)
 {
     if (!samples || num_samples == 0) { return false; }
-
-    if (m_conf.bits_per_sample == 8) {
-        m_sample_buffer.resize(num_samples * 1);
-        fcF32ToU8Samples((uint8_t*)m_sample_buffer.data(), samples, num_samples);
-    }
-    else if (m_conf.bits_per_sample == 16) {
-        m_sample_buffer.resize(num_samples * 2);
-        fcF32ToI16Samples((int16_t*)m_sample_buffer.data(), samples, num_samples);
-    }
-    else if (m_conf.bits_per_sample == 24) {
-        m_sample_buffer.resize(num_samples * 3);
-        fcF32ToI24Samples((uint8_t*)m_sample_buffer.data(), samples, num_samples);
-    }
-    else if (m_conf.bits_per_sample == 32) {
-        m_sample_buffer.resize(num_samples * 4);
-        fcF32ToI32Samples((int32_t*)m_sample_buffer.data(), samples, num_samples);
+    m_stats.onSubmit();
+
+    {
+        ScopedLatency latency(&m_stats, StatsStage::Convert);
+        if (m_conf.bits_per_sample == 8) {
+            m_sample_buffer.resize(num_samples * 1);
+            fcF32ToU8Samples((uint8_t*)m_sample_buffer.data(), samples, num_samples);
+        }
+        else if (m_conf.bits_per_sample == 16) {
+            m_sample_buffer.resize(num_samples * 2);
+            fcF32ToI16Samples((int16_t*)m_sample_buffer.data(), samples, num_samples);
+        }
+        else if (m_conf.bits_per_sample == 24) {
+            m_sample_buffer.resize(num_samples * 3);
+            fcF32ToI24Samples((uint8_t*)m_sample_buffer.data(), samples, num_samples);
+        }
+        else if (m_conf.bits_per_sample == 32) {
+            m_sample_buffer.resize(num_samples * 4);
+            fcF32ToI32Samples((int32_t*)m_sample_buffer.data(), samples, num_samples);
+        }
     }
     m_sample_size += m_sample_buffer.size();
+    m_stats.onEncoded();
 
-    for (auto s : m_streams) {
-        s->write(m_sample_buffer.data(), m_sample_buffer.size());
+    {
+        ScopedLatency latency(&m_stats, StatsStage::Write);
+        for (auto s : m_streams) {
+            s->write(m_sample_buffer.data(), m_sample_buffer.size());
+        }
     }
+    m_stats.onWritten();
+    return true;
+}
+
+bool fcWaveContext::getContextStats(fcContextStats& dst)
+{
+    m_stats.getStats(dst);
     return true;
 }
 
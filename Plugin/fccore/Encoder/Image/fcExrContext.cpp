@@ -29,11 +29,14 @@ struct fcExrTaskData
     int width = 0;
     int height = 0;
     std::list<Buffer> pixels;
+    std::list<BorrowedPixels> borrowed;
+    size_t charged = 0; // bytes charged to MemoryBudget
+    ContextStats *stats = nullptr;
     Imf::Header header;
     Imf::FrameBuffer frame_buffer;
 
-    fcExrTaskData(const char *p, int w, int h, fcExrCompression compression)
-        : path(p), width(w), height(h), header(w, h)
+    fcExrTaskData(const char *p, int w, int h, fcExrCompression compression, ContextStats *s)
+        : path(p), width(w), height(h), stats(s), header(w, h)
     {
         switch (compression) {
         case fcExrCompression::None:    header.compression() = Imf::NO_COMPRESSION; break;
@@ -43,6 +46,19 @@ struct fcExrTaskData
         case fcExrCompression::PIZ:     header.compression() = Imf::PIZ_COMPRESSION; break;
         }
     }
+
+    ~fcExrTaskData()
+    {
+        for (auto& p : pixels) { BufferPool::getInstance().release(p); }
+        MemoryBudget::getInstance().release(charged, stats);
+    }
+
+    // layers can't wait for the budget in the middle of a frame. beginFrame() waits instead.
+    void charge(size_t size)
+    {
+        MemoryBudget::getInstance().forceCharge(size, stats);
+        charged += size;
+    }
 };
 
 class fcExrContext : public fcIExrContext
@@ -53,8 +69,9 @@ public:
 
     bool beginFrame(const char *path, int width, int height) override;
     bool addLayerTexture(void *tex, fcPixelFormat fmt, int channel, const char *name) override;
-    bool addLayerPixels(const void *pixels, fcPixelFormat fmt, int channel, const char *name) override;
+    bool addLayerPixels(const void *pixels, fcPixelFormat fmt, int channel, const char *name, fcReleasePixels release, void *userdata) override;
     bool endFrame() override;
+    bool getContextStats(fcContextStats& dst) override;
 
 private:
     bool addLayerImpl(char *pixels, fcPixelFormat fmt, int channel, const char *name);
@@ -65,10 +82,10 @@ private:
     fcIGraphicsDevice *m_dev = nullptr;
     fcExrTaskData *m_task = nullptr;
     TaskGroup m_tasks;
-    std::atomic_int m_active_task_count = { 0 };
+    ContextStats m_stats;
 
     const void *m_frame_prev = nullptr;
-    Buffer *m_src_prev = nullptr;
+    char *m_src_prev = nullptr;
     fcPixelFormat m_fmt_prev = fcPixelFormat_Unknown;
 };
 
@@ -81,6 +98,8 @@ fcExrContext::fcExrContext(const fcExrConfig& conf, fcIGraphicsDevice *dev)
     if (m_conf.max_tasks <= 0) {
         m_conf.max_tasks = std::thread::hardware_concurrency();
     }
+    m_tasks.setMaxTasks(m_conf.max_tasks);
+    m_tasks.setPriority(m_conf.priority);
 }
 
 fcExrContext::~fcExrContext()
@@ -96,17 +115,13 @@ bool fcExrContext::beginFrame(const char *path, int width, int height)
         return false;
     }
 
-    // 実行中のタスクの数が上限に達している場合適当に待つ
-    if (m_active_task_count >= m_conf.max_tasks)
-    {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        if (m_active_task_count >= m_conf.max_tasks)
-        {
-            m_tasks.wait();
-        }
-    }
+    // 実行中のタスクの数が上限に達している場合いずれかが完了するまで待つ
+    m_tasks.waitSlot();
+    // wait until memory usage gets within the budget
+    MemoryBudget::getInstance().charge(0, true, nullptr);
 
-    m_task = new fcExrTaskData(path, width, height, m_conf.compression);
+    m_stats.onSubmit();
+    m_task = new fcExrTaskData(path, width, height, m_conf.compression, &m_stats);
     return true;
 }
 
@@ -121,7 +136,7 @@ bool fcExrContext::addLayerTexture(void *tex, fcPixelFormat fmt, int channel, co
         return false;
     }
 
-    Buffer *raw_frame = nullptr;
+    char *raw_frame = nullptr;
 
     if (tex == m_frame_prev)
     {
@@ -133,45 +148,55 @@ bool fcExrContext::addLayerTexture(void *tex, fcPixelFormat fmt, int channel, co
         m_frame_prev = tex;
 
         m_task->pixels.push_back(Buffer());
-        raw_frame = &m_task->pixels.back();
-        raw_frame->resize(m_task->width * m_task->height * fcGetPixelSize(fmt));
+        auto *buf = &m_task->pixels.back();
+        BufferPool::getInstance().acquire(*buf, m_task->width * m_task->height * fcGetPixelSize(fmt));
+        m_task->charge(buf->size());
 
         // get frame buffer
-        if (!m_dev->readTexture(&(*raw_frame)[0], raw_frame->size(), tex, m_task->width, m_task->height, fmt))
+        bool ok;
         {
+            fcTraceScope("readTexture");
+            ScopedLatency latency(&m_stats, StatsStage::Readback);
+            ok = m_dev->readTexture(buf->data(), buf->size(), tex, m_task->width, m_task->height, fmt);
+        }
+        if (!ok)
+        {
+            BufferPool::getInstance().release(*buf);
             m_task->pixels.pop_back();
             return false;
         }
-        m_src_prev = raw_frame;
+        m_src_prev = raw_frame = buf->data();
 
         // convert pixel format if it is not supported by exr
         if ((fmt & fcPixelFormat_TypeMask) == fcPixelFormat_Type_u8) {
             m_task->pixels.emplace_back(Buffer());
-            auto *buf = &m_task->pixels.back();
+            auto *cbuf = &m_task->pixels.back();
 
             int channels = fmt & fcPixelFormat_ChannelMask;
             auto src_fmt = fmt;
             fmt = fcPixelFormat(fcPixelFormat_Type_f16 | channels);
-            buf->resize(m_task->width * m_task->height * fcGetPixelSize(fmt));
-            fcConvertPixelFormat(&(*buf)[0], fmt, &(*raw_frame)[0], src_fmt, m_task->width * m_task->height);
+            BufferPool::getInstance().acquire(*cbuf, m_task->width * m_task->height * fcGetPixelSize(fmt));
+            m_task->charge(cbuf->size());
+            ScopedLatency latency(&m_stats, StatsStage::Convert);
+            fcConvertPixelFormat(cbuf->data(), fmt, raw_frame, src_fmt, m_task->width * m_task->height);
 
-            m_src_prev = raw_frame = buf;
+            m_src_prev = raw_frame = cbuf->data();
         }
 
         m_fmt_prev = fmt;
     }
 
-    return addLayerImpl(&(*raw_frame)[0], fmt, channel, name);
+    return addLayerImpl(raw_frame, fmt, channel, name);
 }
 
-bool fcExrContext::addLayerPixels(const void *pixels, fcPixelFormat fmt, int channel, const char *name)
+bool fcExrContext::addLayerPixels(const void *pixels, fcPixelFormat fmt, int channel, const char *name, fcReleasePixels release, void *userdata)
 {
     if (m_task == nullptr) {
         fcDebugLog("fcExrContext::addLayerPixels(): maybe beginFrame() is not called.");
         return false;
     }
 
-    Buffer *raw_frame = nullptr;
+    char *raw_frame = nullptr;
 
     if (pixels == m_frame_prev)
     {
@@ -182,67 +207,64 @@ bool fcExrContext::addLayerPixels(const void *pixels, fcPixelFormat fmt, int cha
     {
         m_frame_prev = pixels;
 
-        m_task->pixels.emplace_back(Buffer());
-        raw_frame = &m_task->pixels.back();
-
-        if (m_conf.pixel_format == fcExrPixelFormat::Half) {
-            auto src_fmt = fmt;
-            int channels = fmt & fcPixelFormat_ChannelMask;
+        auto src_fmt = fmt;
+        int channels = fmt & fcPixelFormat_ChannelMask;
+        switch (m_conf.pixel_format) {
+        case fcExrPixelFormat::Half:
             fmt = fcPixelFormat(fcPixelFormat_Type_f16 | channels);
-            raw_frame->resize(m_task->width * m_task->height * fcGetPixelSize(fmt));
-            if (src_fmt != fmt) {
-                fcConvertPixelFormat(raw_frame->data(), fmt, pixels, src_fmt, m_task->width * m_task->height);
-            }
-            else {
-                memcpy(raw_frame->data(), pixels, raw_frame->size());
-            }
-        }
-        else if (m_conf.pixel_format == fcExrPixelFormat::Float) {
-            auto src_fmt = fmt;
-            int channels = fmt & fcPixelFormat_ChannelMask;
+            break;
+        case fcExrPixelFormat::Float:
             fmt = fcPixelFormat(fcPixelFormat_Type_f32 | channels);
-            raw_frame->resize(m_task->width * m_task->height * fcGetPixelSize(fmt));
-            if (src_fmt != fmt) {
-                fcConvertPixelFormat(raw_frame->data(), fmt, pixels, src_fmt, m_task->width * m_task->height);
-            }
-            else {
-                memcpy(raw_frame->data(), pixels, raw_frame->size());
-            }
-
-        }
-        else if (m_conf.pixel_format == fcExrPixelFormat::Int) {
-            auto src_fmt = fmt;
-            int channels = fmt & fcPixelFormat_ChannelMask;
+            break;
+        case fcExrPixelFormat::Int:
             fmt = fcPixelFormat(fcPixelFormat_Type_i32 | channels);
-            raw_frame->resize(m_task->width * m_task->height * fcGetPixelSize(fmt));
-            if (src_fmt != fmt) {
-                fcConvertPixelFormat(raw_frame->data(), fmt, pixels, src_fmt, m_task->width * m_task->height);
-            }
-            else {
-                memcpy(raw_frame->data(), pixels, raw_frame->size());
-            }
-
-        }
-        else { // adaptive
+            break;
+        default: // adaptive
             // convert pixel format if it is not supported by exr
             if ((fmt & fcPixelFormat_TypeMask) == fcPixelFormat_Type_u8) {
-                auto src_fmt = fmt;
-                int channels = fmt & fcPixelFormat_ChannelMask;
                 fmt = fcPixelFormat(fcPixelFormat_Type_f16 | channels);
-                raw_frame->resize(m_task->width * m_task->height * fcGetPixelSize(fmt));
-                fcConvertPixelFormat(raw_frame->data(), fmt, pixels, src_fmt, m_task->width * m_task->height);
+            }
+            break;
+        }
+
+        if (release && src_fmt == fmt) {
+            // borrowed. no copy
+            raw_frame = (char*)pixels;
+        }
+        else {
+            m_task->pixels.emplace_back(Buffer());
+            auto& buf = m_task->pixels.back();
+            BufferPool::getInstance().acquire(buf, m_task->width * m_task->height * fcGetPixelSize(fmt));
+            m_task->charge(buf.size());
+            if (src_fmt != fmt) {
+                ScopedLatency latency(&m_stats, StatsStage::Convert);
+                fcConvertPixelFormat(buf.data(), fmt, pixels, src_fmt, m_task->width * m_task->height);
             }
             else {
-                raw_frame->resize(m_task->width * m_task->height * fcGetPixelSize(fmt));
-                memcpy(raw_frame->data(), pixels, raw_frame->size());
+                memcpy(buf.data(), pixels, buf.size());
             }
+            raw_frame = buf.data();
         }
 
         m_src_prev = raw_frame;
         m_fmt_prev = fmt;
     }
 
-    return addLayerImpl(raw_frame->data(), fmt, channel, name);
+    if (!addLayerImpl(raw_frame, fmt, channel, name)) {
+        return false;
+    }
+    if (release) {
+        if (raw_frame == pixels) {
+            // hold until the image is written
+            m_task->borrowed.emplace_back();
+            m_task->borrowed.back().reset(pixels, release, userdata);
+        }
+        else {
+            // copied or converted. caller's pixels are no longer needed
+            release(userdata, pixels);
+        }
+    }
+    return true;
 }
 
 bool fcExrContext::addLayerImpl(char *pixels, fcPixelFormat fmt, int channel, const char *name)
@@ -287,25 +309,37 @@ bool fcExrContext::endFrame()
 
     fcExrTaskData *exr = m_task;
     m_task = nullptr;
-    ++m_active_task_count;
+    m_stats.onEnqueue();
     m_tasks.run([this, exr](){
         endFrameTask(exr);
-        --m_active_task_count;
     });
     return true;
 }
 
 void fcExrContext::endFrameTask(fcExrTaskData *exr)
 {
+    fcTraceScope("fcExrContext::endFrameTask");
     try {
+        // openexr compresses and writes in one go
+        ScopedLatency latency(&m_stats, StatsStage::Encode);
         Imf::OutputFile fout(exr->path.c_str(), exr->header);
         fout.setFrameBuffer(exr->frame_buffer);
         fout.writePixels(exr->height);
-        delete exr;
+        m_stats.onEncoded();
+        m_stats.onWritten();
     }
     catch (std::string &e) {
         fcDebugLog(e.c_str());
     }
+    // also releases borrowed pixels
+    delete exr;
+    m_stats.onDequeue();
+}
+
+bool fcExrContext::getContextStats(fcContextStats& dst)
+{
+    m_stats.getStats(dst);
+    return true;
 }
 
 
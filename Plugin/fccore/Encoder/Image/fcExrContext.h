@@ -5,7 +5,8 @@ class fcIExrContext : public fcContextBase
 public:
     virtual bool beginFrame(const char *path, int width, int height) = 0;
     virtual bool addLayerTexture(void *tex, fcPixelFormat fmt, int channel, const char *name) = 0;
-    virtual bool addLayerPixels(const void *pixels, fcPixelFormat fmt, int channel, const char *name) = 0;
+    // release: if not null, pixels are borrowed instead of copied
+    virtual bool addLayerPixels(const void *pixels, fcPixelFormat fmt, int channel, const char *name, fcReleasePixels release = nullptr, void *userdata = nullptr) = 0;
     virtual bool endFrame() = 0;
 };
 fcIExrContext* fcExrCreateContextImpl(const fcExrConfig *conf, fcIGraphicsDevice *dev);
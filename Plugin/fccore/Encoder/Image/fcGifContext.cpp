@@ -7,13 +7,19 @@
 #ifdef fcSupportGIF
 #include "jo_gif.i"
 
-typedef jo_gif_frame_t fcGifFrame;
+struct fcGifFrame
+{
+    jo_gif_frame_t data;
+    std::atomic_bool encoded = { false };
+};
 
 struct fcGifTaskData
 {
     fcPixelFormat raw_pixel_format = fcPixelFormat_Unknown;
     Buffer raw_pixels;
+    BorrowedPixels borrowed; // used instead of raw_pixels if valid
     Buffer rgba8_pixels;
+    Buffer dithered_pixels;
     fcGifFrame *gif_frame = nullptr;
     int frame = 0;
     bool local_palette = true;
@@ -28,27 +34,30 @@ public:
 
     void addOutputStream(fcStream *s) override;
     bool addFrameTexture(void *tex, fcPixelFormat fmt, fcTime timestamp) override;
-    bool addFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp) override;
+    bool addFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata) override;
     void forceKeyframe() override;
+    bool getFrameStats(fcFrameStats& dst) override;
+    bool getContextStats(fcContextStats& dst) override;
 
 private:
-    fcGifTaskData&  getTempraryVideoFrame();
-    void            returnTempraryVideoFrame(fcGifTaskData& v);
-
     void addGifFrame(fcGifTaskData& data);
     void kickTask(fcGifTaskData& data);
+    void writeOut(bool flush);
     bool flush();
 
 private:
     fcGifConfig m_conf;
     fcIGraphicsDevice *m_dev = nullptr;
     std::vector<fcStream*> m_streams;
-    std::vector<fcGifTaskData> m_buffers;
-    std::vector<fcGifTaskData*> m_buffers_unused;
-    std::list<fcGifFrame> m_gif_frames;
+    FrameQueue<fcGifTaskData> m_buffers;
+    std::mutex m_frames_mutex;
+    std::list<fcGifFrame> m_gif_frames; // in order. being encoded or waiting to be written
+    std::list<fcGifFrame> m_free_frames; // already written. reused to avoid allocation
+    std::mutex m_write_mutex;
+    int m_num_written = 0;
     jo_gif_t m_gif;
     TaskGroup m_tasks;
-    std::mutex m_mutex;
+    ContextStats m_stats;
     int m_frame = 0;
     bool m_force_keyframe = false;
 };
@@ -59,14 +68,19 @@ fcGifContext::fcGifContext(const fcGifConfig &conf, fcIGraphicsDevice *dev)
     , m_dev(dev)
 {
     m_conf.max_tasks = std::max<int>(m_conf.max_tasks, 1);
+    m_tasks.setMaxTasks(m_conf.max_tasks);
+    m_tasks.setPriority(m_conf.priority);
 
     m_gif = jo_gif_start(m_conf.width, m_conf.height, 0, m_conf.num_colors);
 
-    m_buffers.resize(m_conf.max_tasks);
-    for (auto& buf : m_buffers)
-    {
-        buf.rgba8_pixels.resize(m_conf.width * m_conf.height * fcGetPixelSize(fcPixelFormat_RGBAu8));
-        m_buffers_unused.push_back(&buf);
+    // DropOldest is same as DropNewest and Spill is same as Block, because frames are handed to tasks immediately
+    if (m_conf.backpressure == fcBackpressurePolicy::Spill) {
+        m_conf.backpressure = fcBackpressurePolicy::Block;
+    }
+    m_buffers.setPolicy(m_conf.backpressure, (size_t)m_conf.backpressure_memory_limit * 1024 * 1024);
+    m_buffers.setContextStats(&m_stats);
+    for (int i = 0; i < m_conf.max_tasks; ++i) {
+        m_buffers.emplace();
     }
 }
 
@@ -86,58 +100,105 @@ void fcGifContext::addOutputStream(fcStream *os)
     if (!os) { return; }
     os->addRef();
     m_streams.push_back(os);
-}
-
-fcGifTaskData& fcGifContext::getTempraryVideoFrame()
-{
-    fcGifTaskData *ret = nullptr;
-
-    // wait if all temporaries are in use
-    for (;;) {
-        {
-            std::unique_lock<std::mutex> lock(m_mutex);
-            if (!m_buffers_unused.empty()) {
-                ret = m_buffers_unused.back();
-                m_buffers_unused.pop_back();
-                break;
-            }
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    }
-
-    return *ret;
-}
-
-void fcGifContext::returnTempraryVideoFrame(fcGifTaskData& v)
-{
-    std::unique_lock<std::mutex> lock(m_mutex);
-    m_buffers_unused.push_back(&v);
+    m_stats.addStream(os);
 }
 
 void fcGifContext::addGifFrame(fcGifTaskData& data)
 {
+    const void *raw = data.borrowed ? data.borrowed.data() : data.raw_pixels.data();
     unsigned char *src = nullptr;
     if (data.raw_pixel_format == fcPixelFormat_RGBAu8) {
-        src = (unsigned char*)&data.raw_pixels[0];
+        src = (unsigned char*)raw;
     }
     else {
         // convert pixel format
-        size_t npixels = data.raw_pixels.size() / fcGetPixelSize(data.raw_pixel_format);
-        fcConvertPixelFormat(&data.rgba8_pixels[0], fcPixelFormat_RGBAu8, &data.raw_pixels[0], data.raw_pixel_format, npixels);
+        ScopedLatency latency(&m_stats, StatsStage::Convert);
+        size_t npixels = m_conf.width * m_conf.height;
+        BufferPool::getInstance().acquire(data.rgba8_pixels, npixels * fcGetPixelSize(fcPixelFormat_RGBAu8));
+        fcConvertPixelFormat(&data.rgba8_pixels[0], fcPixelFormat_RGBAu8, raw, data.raw_pixel_format, npixels);
         src = (unsigned char*)&data.rgba8_pixels[0];
     }
 
-    jo_gif_frame(&m_gif, data.gif_frame, src, data.frame, data.local_palette);
-    returnTempraryVideoFrame(data);
+    {
+        ScopedLatency latency(&m_stats, StatsStage::Encode);
+        fcTraceScope("jo_gif_frame");
+        jo_gif_frame(&m_gif, &data.gif_frame->data, src, data.frame, data.local_palette, data.dithered_pixels);
+    }
+    data.gif_frame->encoded = true;
+    data.borrowed.release();
+    BufferPool::getInstance().release(data.raw_pixels);
+    BufferPool::getInstance().release(data.rgba8_pixels);
+    m_stats.onEncoded();
+    m_buffers.release(&data);
+    m_stats.onDequeue();
+}
+
+// frames are written in order as soon as they are encoded, instead of holding all of them until the end.
+// duration of a frame depends on timestamp of the next one, so the last frame is kept until the next comes or flush.
+void fcGifContext::writeOut(bool flush)
+{
+    std::unique_lock<std::mutex> wl(m_write_mutex);
+
+    size_t num_frames = 0;
+    if (flush) {
+        std::unique_lock<std::mutex> l(m_frames_mutex);
+        num_frames = m_gif_frames.size();
+    }
+
+    for (size_t n = 1; ; ++n) {
+        fcGifFrame *cur = nullptr;
+        fcGifFrame *next = nullptr;
+        {
+            std::unique_lock<std::mutex> l(m_frames_mutex);
+            if (m_gif_frames.empty()) { break; }
+            auto i = m_gif_frames.begin();
+            cur = &*i;
+            if (!cur->encoded) { break; }
+            if (++i != m_gif_frames.end()) { next = &*i; }
+            else if (!flush) { break; }
+        }
+
+        int duration = 1; // unit: centi-second
+        if (next) {
+            duration = int((next->data.timestamp - cur->data.timestamp) * 100.0); // seconds to centi-seconds
+        }
+        {
+            ScopedLatency latency(&m_stats, StatsStage::Write);
+            if (m_num_written == 0) {
+                for (auto os : m_streams) jo_gif_write_header(*os, &m_gif);
+            }
+            for (auto os : m_streams) jo_gif_write_frame(*os, &m_gif, &cur->data, nullptr, m_num_written, duration);
+        }
+        ++m_num_written;
+        m_stats.onWritten();
+        if (flush) {
+            setFinalizeProgress(float(n) / float(num_frames));
+        }
+
+        std::unique_lock<std::mutex> l(m_frames_mutex);
+        m_free_frames.splice(m_free_frames.end(), m_gif_frames, m_gif_frames.begin());
+    }
 }
 
 void fcGifContext::kickTask(fcGifTaskData& data)
 {
-    m_gif_frames.push_back(fcGifFrame());
-    data.gif_frame = &m_gif_frames.back();
-    data.gif_frame->timestamp = data.timestamp;
+    {
+        std::unique_lock<std::mutex> l(m_frames_mutex);
+        if (!m_free_frames.empty()) {
+            m_gif_frames.splice(m_gif_frames.end(), m_free_frames, m_free_frames.begin());
+        }
+        else {
+            m_gif_frames.emplace_back();
+        }
+        data.gif_frame = &m_gif_frames.back();
+        data.gif_frame->data.timestamp = data.timestamp;
+        data.gif_frame->encoded = false;
+    }
     data.frame = m_frame++;
+    m_stats.onEnqueue();
 
+    // buffers are reused. local_palette must be reset every frame
+    data.local_palette = false;
     if (data.frame == 0 || (m_conf.keyframe_interval > 0 && data.frame % m_conf.keyframe_interval == 0) || m_force_keyframe)
     {
         data.local_palette = true;
@@ -152,6 +213,8 @@ void fcGifContext::kickTask(fcGifTaskData& data)
     {
         m_tasks.run([this, &data]() {
             addGifFrame(data);
+            // keyframes are encoded on the caller's thread, but written here to keep I/O off it
+            writeOut(false);
         });
     }
 }
@@ -162,12 +225,25 @@ bool fcGifContext::addFrameTexture(void *tex, fcPixelFormat fmt, fcTime timestam
         fcDebugLog("fcGifContext::addFrameTexture(): gfx device is null.");
         return false;
     }
-    fcGifTaskData& data = getTempraryVideoFrame();
+    size_t size = m_conf.width * m_conf.height * fcGetPixelSize(fmt);
+    m_stats.onSubmit();
+    auto *buf = m_buffers.acquire(size);
+    if (!buf) { return false; }
+
+    fcGifTaskData& data = *buf;
     data.timestamp = timestamp >= 0.0 ? timestamp : GetCurrentTimeInSeconds();
-    data.raw_pixels.resize(m_conf.width * m_conf.height * fcGetPixelSize(fmt));
+    BufferPool::getInstance().acquire(data.raw_pixels, size);
     data.raw_pixel_format = fmt;
-    if (!m_dev->readTexture(&data.raw_pixels[0], data.raw_pixels.size(), tex, m_conf.width, m_conf.height, fmt))
+    bool ok;
     {
+        ScopedLatency latency(&m_stats, StatsStage::Readback);
+        fcTraceScope("readTexture");
+        ok = m_dev->readTexture(&data.raw_pixels[0], data.raw_pixels.size(), tex, m_conf.width, m_conf.height, fmt);
+    }
+    if (!ok)
+    {
+        BufferPool::getInstance().release(data.raw_pixels);
+        m_buffers.release(buf);
         return false;
     }
 
@@ -175,12 +251,23 @@ bool fcGifContext::addFrameTexture(void *tex, fcPixelFormat fmt, fcTime timestam
     return true;
 }
 
-bool fcGifContext::addFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp)
+bool fcGifContext::addFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata)
 {
-    fcGifTaskData& data = getTempraryVideoFrame();
+    size_t size = m_conf.width * m_conf.height * fcGetPixelSize(fmt);
+    m_stats.onSubmit();
+    auto *buf = m_buffers.acquire(size);
+    if (!buf) { return false; }
+
+    fcGifTaskData& data = *buf;
     data.timestamp = timestamp >= 0.0 ? timestamp : GetCurrentTimeInSeconds();
     data.raw_pixel_format = fmt;
-    data.raw_pixels.assign((char*)pixels, m_conf.width * m_conf.height * fcGetPixelSize(fmt));
+    if (release) {
+        data.borrowed.reset(pixels, release, userdata);
+    }
+    else {
+        BufferPool::getInstance().acquire(data.raw_pixels, size);
+        memcpy(data.raw_pixels.data(), pixels, size);
+    }
 
     kickTask(data);
     return true;
@@ -191,19 +278,25 @@ void fcGifContext::forceKeyframe()
     m_force_keyframe = true;
 }
 
+bool fcGifContext::getFrameStats(fcFrameStats& dst)
+{
+    dst = m_buffers.getStats();
+    return true;
+}
+
+bool fcGifContext::getContextStats(fcContextStats& dst)
+{
+    m_stats.getStats(dst);
+    return true;
+}
+
 bool fcGifContext::flush()
 {
     m_tasks.wait();
 
-    int frame = 0;
-    for(auto os : m_streams) jo_gif_write_header(*os, &m_gif);
-    for (auto i = m_gif_frames.begin(); i != m_gif_frames.end(); ++i) {
-        auto next = i; ++next;
-        int duration = 1; // unit: centi-second
-        if (next != m_gif_frames.end()) {
-            duration = int((next->timestamp - i->timestamp) * 100.0); // seconds to centi-seconds
-        }
-        for (auto os : m_streams) jo_gif_write_frame(*os, &m_gif, &(*i), nullptr, frame++, duration);
+    writeOut(true);
+    if (m_num_written == 0) {
+        for (auto os : m_streams) jo_gif_write_header(*os, &m_gif);
     }
     for (auto os : m_streams) jo_gif_write_footer(*os, &m_gif);
 
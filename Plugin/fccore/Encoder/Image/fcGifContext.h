@@ -5,7 +5,8 @@ class fcIGifContext : public fcContextBase
 public:
     virtual void addOutputStream(fcStream *s) = 0;
     virtual bool addFrameTexture(void *tex, fcPixelFormat fmt, fcTime timestamp = -1) = 0;
-    virtual bool addFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1) = 0;
+    // release: if not null, pixels are borrowed instead of copied
+    virtual bool addFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1, fcReleasePixels release = nullptr, void *userdata = nullptr) = 0;
     virtual void forceKeyframe() = 0;
 };
 
@@ -15,7 +15,10 @@ struct fcPngTaskData
 {
     std::string path;
     Buffer pixels;
+    BorrowedPixels borrowed; // used instead of pixels if valid
     Buffer buf; // buffer for conversion
+    std::vector<unsigned char*> row_pointers;
+    size_t charged = 0; // bytes charged to MemoryBudget
     int width = 0;
     int height = 0;
     fcPixelFormat format = fcPixelFormat_Unknown;
@@ -29,17 +32,32 @@ public:
     ~fcPngContext() override;
 
     bool exportTexture(const char *path, void *tex, int width, int height, fcPixelFormat fmt, int num_channels) override;
-    bool exportPixels(const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, int num_channels) override;
+    bool exportPixels(const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, int num_channels, fcReleasePixels release, void *userdata) override;
+    bool getContextStats(fcContextStats& dst) override;
 
 private:
     void waitSome();
+    fcPngTaskData* acquireTaskData(size_t frame_size);
+    fcPngTaskData* allocTaskData();
+    void releaseTaskData(fcPngTaskData *data);
+    void kickTask(fcPngTaskData *data);
     bool exportTask(fcPngTaskData& data);
+    bool spill(const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, int num_channels);
+    fcPngTaskData* popSpilled();
+    void exportSpilled();
+    void runTask(const std::function<void()>& body);
 
 private:
     fcPngConfig m_conf;
     fcIGraphicsDevice *m_dev = nullptr;
     TaskGroup m_tasks;
-    std::atomic_int m_active_task_count = { 0 };
+    ContextStats m_stats;
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<fcPngTaskData>> m_task_data;
+    std::vector<fcPngTaskData*> m_free_task_data;
+    SpillQueue m_spill;
+    int m_spill_drainers = 0; // tasks that haven't done their last check of m_spill yet. guarded by m_mutex
+    Buffer m_spill_staging; // texture readback of frames to be spilled
 };
 
 fcPngContext::fcPngContext(const fcPngConfig& conf, fcIGraphicsDevice *dev)
@@ -49,6 +67,11 @@ fcPngContext::fcPngContext(const fcPngConfig& conf, fcIGraphicsDevice *dev)
     if (m_conf.max_tasks <= 0) {
         m_conf.max_tasks = std::thread::hardware_concurrency();
     }
+    m_tasks.setMaxTasks(m_conf.max_tasks);
+    m_tasks.setPriority(m_conf.priority);
+    if (m_conf.backpressure != fcBackpressurePolicy::Spill) {
+        m_conf.backpressure = fcBackpressurePolicy::Block;
+    }
 }
 
 fcPngContext::~fcPngContext()
@@ -62,9 +85,19 @@ bool fcPngContext::exportTexture(const char *path_, void *tex, int width, int he
         fcDebugLog("fcPngContext::exportTexture(): gfx device is null.");
         return false;
     }
-    waitSome();
-
-    auto data = new fcPngTaskData();
+    m_stats.onSubmit();
+    auto data = acquireTaskData(width * height * fcGetPixelSize(fmt));
+    if (!data) {
+        size_t size = width * height * fcGetPixelSize(fmt);
+        BufferPool::getInstance().acquire(m_spill_staging, size);
+        bool ok;
+        {
+            ScopedLatency latency(&m_stats, StatsStage::Readback);
+            fcTraceScope("readTexture");
+            ok = m_dev->readTexture(m_spill_staging.data(), size, tex, width, height, fmt);
+        }
+        return ok && spill(path_, m_spill_staging.data(), width, height, fmt, num_channels);
+    }
     data->path = path_;
     data->width = width;
     data->height = height;
@@ -72,58 +105,201 @@ bool fcPngContext::exportTexture(const char *path_, void *tex, int width, int he
     data->num_channels = num_channels;
 
     // get surface data
-    data->pixels.resize(width * height * fcGetPixelSize(fmt));
-    if (!m_dev->readTexture(&data->pixels[0], data->pixels.size(), tex, width, height, fmt)) {
-        delete data;
+    BufferPool::getInstance().acquire(data->pixels, width * height * fcGetPixelSize(fmt));
+    bool ok;
+    {
+        ScopedLatency latency(&m_stats, StatsStage::Readback);
+        fcTraceScope("readTexture");
+        ok = m_dev->readTexture(&data->pixels[0], data->pixels.size(), tex, width, height, fmt);
+    }
+    if (!ok) {
+        releaseTaskData(data);
         return false;
     }
 
-    // kick export task
-    ++m_active_task_count;
-    m_tasks.run([this, data]() {
-        exportTask(*data);
-        delete data;
-        --m_active_task_count;
-    });
-
+    kickTask(data);
     return false;
 }
 
-bool fcPngContext::exportPixels(const char *path_, const void *pixels_, int width, int height, fcPixelFormat fmt, int num_channels)
+bool fcPngContext::exportPixels(const char *path_, const void *pixels_, int width, int height, fcPixelFormat fmt, int num_channels, fcReleasePixels release, void *userdata)
 {
-    waitSome();
-
-    auto data = new fcPngTaskData();
+    m_stats.onSubmit();
+    auto data = acquireTaskData(width * height * fcGetPixelSize(fmt));
+    if (!data) {
+        if (!spill(path_, pixels_, width, height, fmt, num_channels)) { return false; }
+        // pixels are copied to the spill file
+        if (release) { release(userdata, pixels_); }
+        return true;
+    }
     data->path = path_;
     data->width = width;
     data->height = height;
     data->format = fmt;
     data->num_channels = num_channels;
-    data->pixels.assign((char*)pixels_, width * height * fcGetPixelSize(fmt));
-
-    // kick export task
-    ++m_active_task_count;
-    m_tasks.run([this, data]() {
-        exportTask(*data);
-        delete data;
-        --m_active_task_count;
+    if (release) {
+        data->borrowed.reset(pixels_, release, userdata);
+    }
+    else {
+        size_t size = width * height * fcGetPixelSize(fmt);
+        BufferPool::getInstance().acquire(data->pixels, size);
+        memcpy(data->pixels.data(), pixels_, size);
+    }
+
+    kickTask(data);
+    return true;
+}
+
+void fcPngContext::kickTask(fcPngTaskData *data)
+{
+    m_stats.onEnqueue();
+    runTask([this, data]() {
+        if (exportTask(*data)) {
+            m_stats.onEncoded();
+            m_stats.onWritten();
+        }
+        releaseTaskData(data);
+        m_stats.onDequeue();
+    });
+}
+
+// every task exports spilled frames after its body
+void fcPngContext::runTask(const std::function<void()>& body)
+{
+    {
+        std::unique_lock<std::mutex> l(m_mutex);
+        ++m_spill_drainers;
+    }
+    m_tasks.run([this, body]() {
+        body();
+        exportSpilled();
     });
+}
+
+// image sequences are not real-time, so wait for a task slot and the memory budget instead of dropping frames.
+// Spill: return nullptr instead of waiting. the frame goes to the spill file.
+fcPngTaskData* fcPngContext::acquireTaskData(size_t frame_size)
+{
+    auto& budget = MemoryBudget::getInstance();
+    if (m_conf.backpressure == fcBackpressurePolicy::Spill) {
+        if (m_tasks.isFull() || !budget.charge(frame_size, false, &m_stats)) { return nullptr; }
+    }
+    else {
+        waitSome();
+        budget.charge(frame_size, true, &m_stats);
+    }
+
+    auto ret = allocTaskData();
+    ret->charged = frame_size;
+    return ret;
+}
+
+// task data (and its buffers) are reused to avoid allocation every frame.
+fcPngTaskData* fcPngContext::allocTaskData()
+{
+    fcPngTaskData *ret = nullptr;
+    {
+        std::unique_lock<std::mutex> l(m_mutex);
+        if (m_free_task_data.empty()) {
+            m_task_data.emplace_back(new fcPngTaskData());
+            ret = m_task_data.back().get();
+            // releaseTaskData() must not grow the free list later, when allocations are not expected
+            m_free_task_data.reserve(m_task_data.size());
+        }
+        else {
+            ret = m_free_task_data.back();
+            m_free_task_data.pop_back();
+        }
+    }
+    return ret;
+}
+
+void fcPngContext::releaseTaskData(fcPngTaskData *data)
+{
+    data->borrowed.release();
+    BufferPool::getInstance().release(data->pixels);
+    BufferPool::getInstance().release(data->buf);
+    MemoryBudget::getInstance().release(data->charged, &m_stats);
+    data->charged = 0;
+    std::unique_lock<std::mutex> l(m_mutex);
+    m_free_task_data.push_back(data);
+}
+
+bool fcPngContext::spill(const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, int num_channels)
+{
+    SpillQueue::Header header;
+    header.size = width * height * fcGetPixelSize(fmt);
+    header.format = fmt;
+    header.width = width;
+    header.height = height;
+    header.param = num_channels;
+    if (!m_spill.push(header, pixels, path)) { return false; }
+
+    // tasks export spilled frames before they complete. start one if no task will check m_spill again.
+    // a task that has left exportSpilled() may still hold its slot, so m_tasks.isFull() can't tell this.
+    bool start;
+    {
+        std::unique_lock<std::mutex> l(m_mutex);
+        start = m_spill_drainers == 0;
+    }
+    if (start) {
+        m_stats.onEnqueue();
+        runTask([this]() { m_stats.onDequeue(); });
+    }
     return true;
 }
 
-void fcPngContext::waitSome()
+fcPngTaskData* fcPngContext::popSpilled()
 {
-    if (m_active_task_count >= m_conf.max_tasks) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        if (m_active_task_count >= m_conf.max_tasks) {
-            m_tasks.wait();
+    if (m_spill.empty()) { return nullptr; }
+    auto data = allocTaskData();
+    SpillQueue::Header header;
+    if (!m_spill.pop(header, data->pixels, &data->path)) {
+        releaseTaskData(data);
+        return nullptr;
+    }
+    data->width = header.width;
+    data->height = header.height;
+    data->format = header.format;
+    data->num_channels = header.param;
+    data->charged = header.size;
+    MemoryBudget::getInstance().forceCharge(header.size, &m_stats);
+    return data;
+}
+
+void fcPngContext::exportSpilled()
+{
+    for (;;) {
+        while (auto data = popSpilled()) {
+            if (exportTask(*data)) {
+                m_stats.onEncoded();
+                m_stats.onWritten();
+            }
+            releaseTaskData(data);
+        }
+        // a frame spilled after this check sees no drainer and starts a task
+        std::unique_lock<std::mutex> l(m_mutex);
+        if (m_spill.empty()) {
+            --m_spill_drainers;
+            return;
         }
     }
 }
 
+bool fcPngContext::getContextStats(fcContextStats& dst)
+{
+    m_stats.getStats(dst);
+    return true;
+}
+
+void fcPngContext::waitSome()
+{
+    // wait until any running task completes
+    m_tasks.waitSlot();
+}
+
 bool fcPngContext::exportTask(fcPngTaskData& data)
 {
-    png_bytep pixels = (png_bytep)&data.pixels[0];
+    png_bytep pixels = (png_bytep)(data.borrowed ? data.borrowed.data() : data.pixels.data());
 
     int npixels = data.width * data.height;
     int bit_depth = 0;
@@ -155,10 +331,11 @@ bool fcPngContext::exportTask(fcPngTaskData& data)
     }
 
     // convert pixels (if needed)
+    auto convert_begin = ContextStats::Clock::now();
     switch (dst_fmt) {
     case fcPixelFormat_RGBAu8:
         if (dst_fmt != src_fmt) {
-            data.buf.resize(npixels * 4);
+            BufferPool::getInstance().acquire(data.buf, npixels * 4);
             fcConvertPixelFormat(data.buf.data(), dst_fmt, pixels, src_fmt, npixels);
             pixels = (png_bytep)data.buf.data();
         }
@@ -168,7 +345,7 @@ bool fcPngContext::exportTask(fcPngTaskData& data)
         break;
     case fcPixelFormat_RGBu8:
         if (dst_fmt != src_fmt) {
-            data.buf.resize(npixels * 3);
+            BufferPool::getInstance().acquire(data.buf, npixels * 3);
             fcConvertPixelFormat(data.buf.data(), dst_fmt, pixels, src_fmt, npixels);
             pixels = (png_bytep)data.buf.data();
         }
@@ -178,7 +355,7 @@ bool fcPngContext::exportTask(fcPngTaskData& data)
         break;
     case fcPixelFormat_Ru8:
         if (dst_fmt != src_fmt) {
-            data.buf.resize(npixels * 1);
+            BufferPool::getInstance().acquire(data.buf, npixels * 1);
             fcConvertPixelFormat(data.buf.data(), dst_fmt, pixels, src_fmt, npixels);
             pixels = (png_bytep)data.buf.data();
         }
@@ -189,7 +366,7 @@ bool fcPngContext::exportTask(fcPngTaskData& data)
 
     case fcPixelFormat_RGBAi16:
         if (dst_fmt != src_fmt) {
-            data.buf.resize(npixels * 8);
+            BufferPool::getInstance().acquire(data.buf, npixels * 8);
             fcConvertPixelFormat(data.buf.data(), dst_fmt, pixels, src_fmt, npixels);
             pixels = (png_bytep)data.buf.data();
         }
@@ -199,7 +376,7 @@ bool fcPngContext::exportTask(fcPngTaskData& data)
         break;
     case fcPixelFormat_RGBi16:
         if (dst_fmt != src_fmt) {
-            data.buf.resize(npixels * 6);
+            BufferPool::getInstance().acquire(data.buf, npixels * 6);
             fcConvertPixelFormat(data.buf.data(), dst_fmt, pixels, src_fmt, npixels);
             pixels = (png_bytep)data.buf.data();
         }
@@ -209,7 +386,7 @@ bool fcPngContext::exportTask(fcPngTaskData& data)
         break;
     case fcPixelFormat_Ri16:
         if (dst_fmt != src_fmt) {
-            data.buf.resize(npixels * 2);
+            BufferPool::getInstance().acquire(data.buf, npixels * 2);
             fcConvertPixelFormat(data.buf.data(), dst_fmt, pixels, src_fmt, npixels);
             pixels = (png_bytep)data.buf.data();
         }
@@ -223,7 +400,13 @@ bool fcPngContext::exportTask(fcPngTaskData& data)
         return false;
     }
 
+    if (dst_fmt != src_fmt) {
+        m_stats.getLatency(StatsStage::Convert).record(ContextStats::Clock::now() - convert_begin);
+    }
+
     // export
+    ScopedLatency latency(&m_stats, StatsStage::Encode);
+    fcTraceScope("fcPngContext::exportTask");
 
     png_structp png_ptr = ::png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
     if (png_ptr == nullptr) {
@@ -250,7 +433,8 @@ bool fcPngContext::exportTask(fcPngTaskData& data)
     ::png_write_info(png_ptr, info_ptr);
 
     int pitch = data.width * (bit_depth / 8) * num_channels;
-    std::vector<png_bytep> row_pointers(data.height);
+    auto& row_pointers = data.row_pointers;
+    row_pointers.resize(data.height);
     for (int yi = 0; yi <data.height; ++yi) {
         row_pointers[yi] = &pixels[pitch * yi];
     }
@@ -4,7 +4,8 @@ class fcIPngContext : public fcContextBase
 {
 public:
     virtual bool exportTexture(const char *path, void *tex, int width, int height, fcPixelFormat fmt, int num_channels) = 0;
-    virtual bool exportPixels(const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, int num_channels) = 0;
+    // release: if not null, pixels are borrowed instead of copied
+    virtual bool exportPixels(const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, int num_channels, fcReleasePixels release = nullptr, void *userdata = nullptr) = 0;
 };
 
 fcIPngContext* fcPngCreateContextImpl(const fcPngConfig *conf, fcIGraphicsDevice *dev);
\ No newline at end of file
@@ -213,8 +213,8 @@ static void jo_gif_lzw_write(jo_gif_lzw_t *s, int code)
         s->outBits >>= 8;
         s->curBits -= 8;
         if (s->idx >= 255) {
-            (*s->os) << s->idx;
-            s->os->write((char*)s->buf, s->idx);
+            IOVec vecs[] = { { &s->idx, 1 }, { s->buf, s->idx } };
+            s->os->writev(vecs, 2);
             s->idx = 0;
         }
     }
@@ -280,8 +280,8 @@ CONTINUE:
     jo_gif_lzw_write(&state, 0x101);
     jo_gif_lzw_write(&state, 0);
     if(state.idx) {
-        os << state.idx;
-        os.write((char*)state.buf, state.idx);
+        IOVec vecs[] = { { &state.idx, 1 }, { state.buf, state.idx } };
+        os.writev(vecs, 2);
     }
 }
 
@@ -310,7 +310,8 @@ struct jo_gif_frame_t
     jo_gif_frame_t() : timestamp() {}
 };
 
-void jo_gif_frame(jo_gif_t *gif, jo_gif_frame_t *fdata, unsigned char * rgba, int frame, bool localPalette)
+// dithered: scratch buffer. passed from outside to avoid allocation every frame
+void jo_gif_frame(jo_gif_t *gif, jo_gif_frame_t *fdata, unsigned char * rgba, int frame, bool localPalette, Buffer& dithered)
 {
     short width = gif->width;
     short height = gif->height;
@@ -322,11 +323,15 @@ void jo_gif_frame(jo_gif_t *gif, jo_gif_frame_t *fdata, unsigned char * rgba, in
         jo_gif_quantize(rgba, size*4, 1, palette, gif->numColors);
         fdata->palette.assign((char*)palette, 3 * (1 << (gif->palSize + 1)) );
     }
+    else {
+        fdata->palette.clear(); // frames are reused
+    }
 
-    unsigned char *indexedPixels = (unsigned char *)malloc(size);
+    fdata->indexed_pixels.resize(size);
+    unsigned char *indexedPixels = (unsigned char *)fdata->indexed_pixels.data();
     {
-        unsigned char *ditheredPixels = (unsigned char*)malloc(size*4);
-        memcpy(ditheredPixels, rgba, size*4);
+        dithered.assign((char*)rgba, size*4);
+        unsigned char *ditheredPixels = (unsigned char*)dithered.data();
         for(int k = 0; k < size*4; k+=4) {
             int rgb[3] = { ditheredPixels[k+0], ditheredPixels[k+1], ditheredPixels[k+2] };
             int bestd = 0x7FFFFFFF, best = -1;
@@ -358,17 +363,13 @@ void jo_gif_frame(jo_gif_t *gif, jo_gif_frame_t *fdata, unsigned char * rgba, in
                 }
             }
         }
-        free(ditheredPixels);
     }
 
-    fdata->indexed_pixels.assign((char*)indexedPixels, size);
-
+    fdata->encoded_pixels.clear();
     {
         BufferStream bs(fdata->encoded_pixels);
         jo_gif_lzw_encode(bs, indexedPixels, size);
     }
-
-    free(indexedPixels);
 }
 
 
@@ -397,12 +398,13 @@ void jo_gif_end(jo_gif_t *)
 
 void jo_gif_write_header(BinaryStream &os, jo_gif_t *gif)
 {
-    os.write("GIF89a", 6);
+    ByteWriter<64> w;
+    w.write("GIF89a", 6);
     // Logical Screen Descriptor
-    os.write((char*)&gif->width, 2);
-    os.write((char*)&gif->height, 2);
-    os << uint8_t(0xF0 | gif->palSize);
-    os.write("\x00\x00", 2); // bg color index (unused), aspect ratio
+    w << gif->width << gif->height;
+    w << uint8_t(0xF0 | gif->palSize);
+    w.write("\x00\x00", 2); // bg color index (unused), aspect ratio
+    w.flush(os);
 }
 
 
@@ -422,34 +424,40 @@ void jo_gif_write_frame(BinaryStream &os, jo_gif_t *gif, jo_gif_frame_t *fdata,
         palette_size = (int)fdata->palette.size();
     }
 
+    // headers and palette are built in memory. they and the pixels are written by one writev()
+    ByteWriter<1024> w;
     if (frame == 0) {
         // Global Color Table
-        os.write((char*)palette, palette_size);
+        w.write(palette, palette_size);
         if (gif->repeat >= 0) {
             // Netscape Extension
-            os.write("\x21\xff\x0bNETSCAPE2.0\x03\x01", 16);
-            os.write((char*)&gif->repeat, 2); // loop count (extra iterations, 0=repeat forever)
-            os << uint8_t(0); // block terminator
+            w.write("\x21\xff\x0bNETSCAPE2.0\x03\x01", 16);
+            w << gif->repeat; // loop count (extra iterations, 0=repeat forever)
+            w << uint8_t(0); // block terminator
         }
     }
     // Graphic Control Extension
-    os.write("\x21\xf9\x04\x00", 4);
-    os.write((char*)&delayCsec, 2); // delayCsec x 1/100 sec
-    os.write("\x00\x00", 2); // transparent color index (first byte), currently unused
+    w.write("\x21\xf9\x04\x00", 4);
+    w << delayCsec; // delayCsec x 1/100 sec
+    w.write("\x00\x00", 2); // transparent color index (first byte), currently unused
     // Image Descriptor
-    os.write("\x2c\x00\x00\x00\x00", 5); // header, x,y
-    os.write((char*)&width, 2);
-    os.write((char*)&height, 2);
+    w.write("\x2c\x00\x00\x00\x00", 5); // header, x,y
+    w << width << height;
     if (frame == 0 || !palette) {
-        os << uint8_t(0);
+        w << uint8_t(0);
     }
     else {
-        os << uint8_t(0x80 | gif->palSize);
-        os.write((char*)palette, palette_size);
+        w << uint8_t(0x80 | gif->palSize);
+        w.write(palette, palette_size);
     }
-    os << uint8_t(8); // block terminator
-    os.write(&fdata->encoded_pixels[0], fdata->encoded_pixels.size());
-    os << uint8_t(0); // block terminator
+    w << uint8_t(8); // block terminator
+
+    IOVec vecs[] = {
+        { w.data(), w.size() },
+        { fdata->encoded_pixels.data(), fdata->encoded_pixels.size() },
+        { "\x00", 1 }, // block terminator
+    };
+    os.writev(vecs, 3);
 }
 
 void jo_gif_write_footer(BinaryStream &os, jo_gif_t *)
@@ -19,8 +19,16 @@ public:
     using WriterPtr         = std::unique_ptr<fcMP4Writer>;
     using WriterPtrs        = std::vector<WriterPtr>;
 
-    using VideoBuffer       = Buffer;
-    using VideoBuffers      = SharedResources<VideoBuffer>;
+    struct VideoFrame
+    {
+        Buffer pixels;
+        BorrowedPixels borrowed; // used instead of pixels if valid
+        fcPixelFormat format = fcPixelFormat_Unknown;
+        fcTime timestamp = 0.0;
+
+        const void* data() const { return borrowed ? borrowed.data() : pixels.data(); }
+    };
+    using VideoFrames       = FrameQueue<VideoFrame>;
 
     using AudioBuffer       = RawVector<float>;
     using AudioBuffers      = SharedResources<AudioBuffer>;
@@ -29,14 +37,21 @@ public:
     fcMP4Context(fcMP4Config &conf, fcIGraphicsDevice *dev);
     ~fcMP4Context();
     bool isValid() const override;
+    bool getFrameStats(fcFrameStats& dst) override;
+    bool getContextStats(fcContextStats& dst) override;
 
     const char* getVideoEncoderInfo() override;
     const char* getAudioEncoderInfo() override;
 
     void addOutputStream(fcStream *s) override;
+    void addPacketCallback(fcPacketCallback cb, void *userdata) override;
     bool addVideoFrameTexture(void *tex, fcPixelFormat fmt, fcTime timestamp) override;
-    bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamps) override;
+    bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamps, fcReleasePixels release, void *userdata) override;
     bool addVideoFramePixelsImpl(const void *pixels, fcPixelFormat fmt, fcTime timestamps);
+    void kickVideoFrame(VideoFrame *frame);
+    void kickVideoTask();
+    bool spillVideoFrame(const void *pixels, fcPixelFormat fmt, fcTime timestamp, size_t size);
+    void drainSpilledVideo();
     void flushVideo();
 
     bool addAudioSamples(const float *samples, int num_samples) override;
@@ -51,18 +66,27 @@ private:
         for (auto& s : m_writers) { b(*s); }
     }
 
+    void emitVideoPackets(const fcH264Frame& frame);
+    void emitAudioPackets(const fcAACFrame& frame);
+
 private:
     fcMP4Config         m_conf;
     fcIGraphicsDevice   *m_dev;
 
     WriterPtrs          m_writers;
+    PacketSinks         m_packet_sinks;
+    ContextStats        m_stats;
 
-    TaskQueue           m_video_tasks;
+    SPSCTaskQueue       m_video_tasks;
     VideoEncoderPtr     m_video_encoder;
-    VideoBuffers        m_video_buffers;
+    VideoFrames         m_video_frames;
     fcH264Frame         m_video_frame;
+    Buffer              m_spill_staging;    // texture readback of frames to be spilled
+    Buffer              m_spilled_pixels;   // spilled frame being encoded
+    std::mutex          m_spill_mutex;
+    bool                m_spill_draining = false; // a drainSpilledVideo() task is queued or running. guarded by m_spill_mutex
 
-    TaskQueue           m_audio_tasks;
+    SPSCTaskQueue       m_audio_tasks;
     AudioEncoderPtr     m_audio_encoder;
     AudioBuffers        m_audio_buffers;
     fcAACFrame          m_audio_frame;
@@ -94,6 +118,10 @@ fcMP4Context::fcMP4Context(fcMP4Config &conf, fcIGraphicsDevice *dev)
 
     m_conf.video_max_tasks = std::max<int>(m_conf.video_max_tasks, 1);
     m_conf.audio_max_tasks = std::max<int>(m_conf.audio_max_tasks, 1);
+    m_video_tasks.setPriority(m_conf.priority);
+    m_audio_tasks.setPriority(m_conf.priority);
+    m_video_frames.setPolicy(m_conf.backpressure, (size_t)m_conf.backpressure_memory_limit * 1024 * 1024);
+    m_video_frames.setContextStats(&m_stats);
 
     // create h264 encoder
     m_video_encoder.reset();
@@ -143,7 +171,7 @@ fcMP4Context::fcMP4Context(fcMP4Config &conf, fcIGraphicsDevice *dev)
         if (enc) {
             m_video_encoder.reset(enc);
             for (int i = 0; i < m_conf.video_max_tasks; ++i) {
-                m_video_buffers.emplace();
+                m_video_frames.emplace();
             }
         }
     }
@@ -180,11 +208,17 @@ fcMP4Context::~fcMP4Context()
     flushAudio();
     m_video_tasks.wait();
     m_audio_tasks.wait();
+    setFinalizeProgress(0.5f);
 
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
     m_video_encoder.reset();
     m_audio_encoder.reset();
+    // writers generate index (moov) on destruction
+    for (size_t i = 0; i < m_writers.size(); ++i) {
+        m_writers[i].reset();
+        setFinalizeProgress(0.5f + 0.5f * float(i + 1) / float(m_writers.size()));
+    }
     m_writers.clear();
 
 #ifndef fcMaster
@@ -199,6 +233,18 @@ bool fcMP4Context::isValid() const
     return m_video_encoder || m_audio_encoder;
 }
 
+bool fcMP4Context::getFrameStats(fcFrameStats& dst)
+{
+    dst = m_video_frames.getStats();
+    return true;
+}
+
+bool fcMP4Context::getContextStats(fcContextStats& dst)
+{
+    m_stats.getStats(dst);
+    return true;
+}
+
 const char* fcMP4Context::getAudioEncoderInfo()
 {
     if (!m_audio_encoder) { return ""; }
@@ -218,49 +264,206 @@ void fcMP4Context::addOutputStream(fcStream *s)
         writer->setAACEncoderInfo(m_audio_encoder->getDecoderSpecificInfo());
     }
     m_writers.emplace_back(WriterPtr(writer));
+    m_stats.addStream(s);
+}
+
+void fcMP4Context::addPacketCallback(fcPacketCallback cb, void *userdata)
+{
+    m_packet_sinks.add(cb, userdata);
+}
+
+void fcMP4Context::emitVideoPackets(const fcH264Frame& frame)
+{
+    m_packet_sinks.emitEach([&](const PacketSinks::Emit& emit) {
+        fcPacket packet;
+        packet.codec = fcPacketCodec::H264;
+        packet.timestamp = frame.timestamp;
+        packet.keyframe = (frame.type & (fcH264FrameType_I | fcH264FrameType_IDR)) != 0;
+        frame.eachNALs([&](const char *data, int size) {
+            // same as fcMP4Writer: skip 0x00000001
+            const int offset = 4;
+            packet.data = data + offset;
+            packet.size = size - offset;
+            emit(packet);
+        });
+    });
+}
+
+void fcMP4Context::emitAudioPackets(const fcAACFrame& frame)
+{
+    m_packet_sinks.emitEach([&](const PacketSinks::Emit& emit) {
+        auto& dsi = m_audio_encoder->getDecoderSpecificInfo();
+        fcPacket packet;
+        packet.codec = fcPacketCodec::AAC;
+        packet.keyframe = true;
+        packet.codec_private = dsi.empty() ? nullptr : dsi.data();
+        packet.codec_private_size = dsi.size();
+        frame.eachPackets([&](const char *data, const fcAACFrame::PacketInfo& pinfo) {
+            // skip ADTS header
+            const int offset = 7;
+            packet.data = data + offset;
+            packet.size = pinfo.size - offset;
+            packet.timestamp = pinfo.timestamp;
+            packet.duration = pinfo.duration;
+            emit(packet);
+        });
+    });
 }
 
 bool fcMP4Context::addVideoFrameTexture(void *tex, fcPixelFormat fmt, fcTime timestamp)
 {
     if (!tex || !m_video_encoder || !m_dev) { return false; }
 
-    auto buf = m_video_buffers.acquire();
     size_t psize = fcGetPixelSize(fmt);
     size_t size = m_conf.video_width * m_conf.video_height * psize;
-    buf->resize(size);
-    if (m_dev->readTexture(buf->data(), buf->size(), tex, m_conf.video_width, m_conf.video_height, fmt)) {
-        m_video_tasks.run([this, buf, fmt, timestamp]() {
-            addVideoFramePixelsImpl(buf->data(), fmt, timestamp);
-        });
+    m_stats.onSubmit();
+    auto frame = m_video_frames.acquire(size);
+    if (!frame) {
+        if (m_conf.backpressure != fcBackpressurePolicy::Spill) { return false; }
+        BufferPool::getInstance().acquire(m_spill_staging, size);
+        bool ok;
+        {
+            ScopedLatency latency(&m_stats, StatsStage::Readback);
+            fcTraceScope("readTexture");
+            ok = m_dev->readTexture(m_spill_staging.data(), size, tex, m_conf.video_width, m_conf.video_height, fmt);
+        }
+        return ok && spillVideoFrame(m_spill_staging.data(), fmt, timestamp, size);
+    }
+
+    BufferPool::getInstance().acquire(frame->pixels, size);
+    frame->format = fmt;
+    frame->timestamp = timestamp;
+    bool ok;
+    {
+        ScopedLatency latency(&m_stats, StatsStage::Readback);
+        fcTraceScope("readTexture");
+        ok = m_dev->readTexture(frame->pixels.data(), frame->pixels.size(), tex, m_conf.video_width, m_conf.video_height, fmt);
+    }
+    if (ok) {
+        kickVideoFrame(frame);
     }
     else {
+        BufferPool::getInstance().release(frame->pixels);
+        m_video_frames.release(frame);
         return false;
     }
     return true;
 }
 
-bool fcMP4Context::addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp)
+bool fcMP4Context::addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata)
 {
     if (!pixels || !m_video_encoder) { return false; }
 
-    auto buf = m_video_buffers.acquire();
     size_t psize = fcGetPixelSize(fmt);
     size_t size = m_conf.video_width * m_conf.video_height * psize;
-    buf->resize(size);
-    memcpy(buf->data(), pixels, size);
+    m_stats.onSubmit();
+    auto frame = m_video_frames.acquire(size);
+    if (!frame) {
+        if (!spillVideoFrame(pixels, fmt, timestamp, size)) { return false; }
+        // pixels are copied to the spill file
+        if (release) { release(userdata, pixels); }
+        return true;
+    }
 
-    m_video_tasks.run([this, buf, fmt, timestamp]() {
-        addVideoFramePixelsImpl(buf->data(), fmt, timestamp);
-    });
+    // frames dropped by DropOldest still hold borrowed pixels. reset() releases them.
+    if (release) {
+        frame->borrowed.reset(pixels, release, userdata);
+    }
+    else {
+        frame->borrowed.release();
+        BufferPool::getInstance().acquire(frame->pixels, size);
+        memcpy(frame->pixels.data(), pixels, size);
+    }
+    frame->format = fmt;
+    frame->timestamp = timestamp;
+    kickVideoFrame(frame);
     return true;
+}
+
+void fcMP4Context::kickVideoFrame(VideoFrame *frame)
+{
+    m_video_frames.push(frame);
+    kickVideoTask();
+}
 
+// Spill: frames m_video_frames can't take are written to the spill file. they are newer than queued frames,
+// so one drain task queued after those encodes them in order. a task per spilled frame would fill m_video_tasks,
+// and its waitSlot() would pace the caller to the encoder as Block does.
+bool fcMP4Context::spillVideoFrame(const void *pixels, fcPixelFormat fmt, fcTime timestamp, size_t size)
+{
+    SpillQueue::Header header;
+    header.size = size;
+    header.format = fmt;
+    header.timestamp = timestamp;
+    header.width = m_conf.video_width;
+    header.height = m_conf.video_height;
+    if (!m_video_frames.spill(header, pixels)) { return false; }
+    m_stats.onEnqueue();
+
+    bool start;
+    {
+        std::unique_lock<std::mutex> l(m_spill_mutex);
+        start = !m_spill_draining;
+        m_spill_draining = true;
+    }
+    if (start) {
+        m_video_tasks.run([this]() { drainSpilledVideo(); });
+    }
+    return true;
+}
+
+void fcMP4Context::drainSpilledVideo()
+{
+    SpillQueue::Header header;
+    for (;;) {
+        while (m_video_frames.popSpilled(header, m_spilled_pixels)) {
+            addVideoFramePixelsImpl(m_spilled_pixels.data(), header.format, header.timestamp);
+            m_stats.onDequeue();
+        }
+        // a frame spilled after this check sees no drainer and starts one
+        std::unique_lock<std::mutex> l(m_spill_mutex);
+        if (!m_video_frames.hasSpilled()) {
+            m_spill_draining = false;
+            return;
+        }
+    }
+}
+
+// one task per queued frame
+void fcMP4Context::kickVideoTask()
+{
+    m_stats.onEnqueue();
+    m_video_tasks.run([this]() {
+        // frame can be dropped by backpressure policy before this task runs
+        if (auto frame = m_video_frames.pop()) {
+            addVideoFramePixelsImpl(frame->data(), frame->format, frame->timestamp);
+            frame->borrowed.release();
+            // idle frames don't hold memory. it is shared with other contexts via the pool
+            BufferPool::getInstance().release(frame->pixels);
+            m_video_frames.release(frame);
+        }
+        m_stats.onDequeue();
+    });
 }
 
 bool fcMP4Context::addVideoFramePixelsImpl(const void *pixels, fcPixelFormat fmt, fcTime timestamp)
 {
     // encode!
-    if (m_video_encoder->encode(m_video_frame, pixels, fmt, timestamp)) {
-        eachStreams([this](fcMP4Writer& s) { s.addVideoFrame(m_video_frame); });
+    ContextStats::Binder binder(&m_stats);
+    bool encoded;
+    {
+        ScopedLatency latency(&m_stats, StatsStage::Encode);
+        fcTraceScope("fcIH264Encoder::encode");
+        encoded = m_video_encoder->encode(m_video_frame, pixels, fmt, timestamp);
+    }
+    if (encoded) {
+        m_stats.onEncoded();
+        {
+            ScopedLatency latency(&m_stats, StatsStage::Write);
+            eachStreams([this](fcMP4Writer& s) { s.addVideoFrame(m_video_frame); });
+            emitVideoPackets(m_video_frame);
+        }
+        m_stats.onWritten();
 #ifndef fcMaster
         m_dbg_h264_out->write(m_video_frame.data.data(), m_video_frame.data.size());
 #endif // fcMaster
@@ -279,6 +482,7 @@ void fcMP4Context::flushVideo()
             eachStreams([&](fcMP4Writer& writer) {
                 writer.addVideoFrame(m_video_frame);
             });
+            emitVideoPackets(m_video_frame);
             m_video_frame.clear();
         }
     });
@@ -291,7 +495,7 @@ bool fcMP4Context::addAudioSamples(const float *samples, int num_samples)
         return false;
     }
 
-    auto buf = m_audio_buffers.acquire();
+    auto buf = m_conf.backpressure == fcBackpressurePolicy::Block ? m_audio_buffers.acquire() : m_audio_buffers.acquireOrGrow();
     buf->assign(samples, num_samples);
 
     m_audio_tasks.run([this, buf]() {
@@ -302,8 +506,14 @@ bool fcMP4Context::addAudioSamples(const float *samples, int num_samples)
 
 bool fcMP4Context::addAudioSamplesImpl(const float *samples, int num_samples)
 {
-    if (m_audio_encoder->encode(m_audio_frame, samples, num_samples)) {
+    bool encoded;
+    {
+        fcTraceScope("fcIAACEncoder::encode");
+        encoded = m_audio_encoder->encode(m_audio_frame, samples, num_samples);
+    }
+    if (encoded) {
         eachStreams([this](fcMP4Writer& s) { s.AddAudioSamples(m_audio_frame); });
+        emitAudioPackets(m_audio_frame);
 #ifndef fcMaster
         m_dbg_aac_out->write(m_audio_frame.data.data(), m_audio_frame.data.size());
 #endif // fcMaster
@@ -323,6 +533,7 @@ void fcMP4Context::flushAudio()
             eachStreams([&](fcMP4Writer& writer) {
                 writer.AddAudioSamples(m_audio_frame);
             });
+            emitAudioPackets(m_audio_frame);
             m_audio_frame.clear();
         }
     });
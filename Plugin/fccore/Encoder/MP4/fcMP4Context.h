@@ -9,6 +9,7 @@ public:
     virtual const char* getAudioEncoderInfo() = 0;
 
     virtual void addOutputStream(fcStream *s) = 0;
+    virtual void addPacketCallback(fcPacketCallback cb, void *userdata) = 0;
 
     // assume texture format is RGBA8.
     // timestamp=-1 is treated as current time.
@@ -16,7 +17,8 @@ public:
 
     // assume pixel format is RGBA8 or I420 (color_space indicates)
     // timestamp=-1 is treated as current time.
-    virtual bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1) = 0;
+    // release: if not null, pixels are borrowed instead of copied (see fcMP4AddVideoFramePixelsBorrowed())
+    virtual bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1, fcReleasePixels release = nullptr, void *userdata = nullptr) = 0;
 
     // timestamp=-1 is treated as current time.
     virtual bool addAudioSamples(const float *samples, int num_samples) = 0;
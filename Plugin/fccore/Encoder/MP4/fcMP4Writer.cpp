@@ -12,28 +12,28 @@
 
 namespace {
 
+// atoms are built in memory and written to the stream at once
+using AtomWriter = ByteWriter<4096>;
+
 class Box
 {
 public:
-    Box(BinaryStream& stream) : m_stream(stream) {}
+    Box(AtomWriter& writer) : m_writer(writer) {}
 
     template<class Body>
     void operator()(u32 name, const Body &f)
     {
-        size_t offset = m_stream.tellp();
-        m_stream << u32(0) << name; // reserve
+        size_t offset = m_writer.tellp();
+        m_writer << u32(0) << name; // reserve
 
         f();
 
-        size_t pos = m_stream.tellp();
-        u32 box_size = (u32)(pos - offset);
-        m_stream.seekp(offset);
-        m_stream << u32_be(box_size);
-        m_stream.seekp(pos);
+        u32 box_size = (u32)(m_writer.tellp() - offset);
+        m_writer.patch(offset, u32_be(box_size));
     }
 
 private:
-    BinaryStream& m_stream;
+    AtomWriter& m_writer;
 };
 
 
@@ -61,7 +61,7 @@ fcMP4Writer::~fcMP4Writer()
 
 void fcMP4Writer::mp4Begin()
 {
-    BinaryStream& os = *m_stream;
+    ByteWriter<64> os;
     os  << u32_be(0x18)
         << u32_be('ftyp')
         << u32_be('mp42')
@@ -71,7 +71,7 @@ void fcMP4Writer::mp4Begin()
         << u32_be(0x8)
         << u32_be('free');
 
-    m_mdat_begin = os.tellp();
+    m_mdat_begin = m_stream->tellp() + os.size();
 
     os  << u32_be(0x1) // 32bit mdat length
         << u32_be('mdat')
@@ -79,10 +79,12 @@ void fcMP4Writer::mp4Begin()
         << u64(0) // 64bit mdat length
 #endif // fcMP464BitLength
         ;
+    os.flush(*m_stream);
 }
 
 void fcMP4Writer::addVideoFrame(const fcH264Frame& frame)
 {
+    fcTraceScope("fcMP4Writer::addVideoFrame");
     if (frame.data.empty()) { return; }
     std::unique_lock<std::mutex> lock(m_mutex);
 
@@ -95,6 +97,10 @@ void fcMP4Writer::addVideoFrame(const fcH264Frame& frame)
         m_iframe_ids.push_back((uint32_t)m_video_frame_info.size() + 1);
     }
 
+    // length prefixes and NALs of the frame are written at once.
+    // sizes are stored first, because m_nal_sizes may reallocate while NALs are enumerated.
+    m_nal_sizes.clear();
+    m_iovecs.clear();
     frame.eachNALs([&](const char *data, int size) {
         const int offset = 4; // 0x00000001
         size -= offset;
@@ -107,34 +113,50 @@ void fcMP4Writer::addVideoFrame(const fcH264Frame& frame)
             m_pps.assign(&data[offset], &data[offset] + size);
         }
         else {
-            os << u32_be(size);
-            os.write(&data[offset], size);
+            m_nal_sizes.push_back(u32_be(size));
+            m_iovecs.push_back({ &data[offset], (size_t)size });
             info.size += size + 4;
         }
 
     });
+    if (!m_iovecs.empty()) {
+        size_t n = m_iovecs.size();
+        m_iovecs.resize(n * 2);
+        // interleave as { size[0], nal[0], size[1], nal[1], ... }
+        for (size_t i = n; i-- > 0; ) {
+            m_iovecs[i * 2 + 1] = m_iovecs[i];
+            m_iovecs[i * 2] = { &m_nal_sizes[i], 4 };
+        }
+        os.writev(m_iovecs.data(), (int)m_iovecs.size());
+    }
 
     m_video_frame_info.push_back(info);
 }
 
 void fcMP4Writer::AddAudioSamples(const fcAACFrame& frame)
 {
+    fcTraceScope("fcMP4Writer::AddAudioSamples");
     if (frame.data.empty()) { return; }
     std::unique_lock<std::mutex> lock(m_mutex);
 
     BinaryStream& os = *m_stream;
+    // packets without ADTS headers are written at once
+    m_iovecs.clear();
+    uint64_t file_offset = os.tellp();
     frame.eachPackets([&](const char *data, const fcAACFrame::PacketInfo& pinfo) {
         fcMP4FrameInfo info;
-        info.file_offset = os.tellp();
+        info.file_offset = file_offset;
         info.timestamp = to_usec(pinfo.timestamp);
 
         const int offset = 7;
         int size = pinfo.size - offset;
-        os.write(data + offset, size);
+        m_iovecs.push_back({ data + offset, (size_t)size });
         info.size += size;
+        file_offset += size;
 
         m_audio_frame_info.push_back(info);
     });
+    os.writev(m_iovecs.data(), (int)m_iovecs.size());
 }
 
 void fcMP4Writer::setAACEncoderInfo(const Buffer& aacheader)
@@ -229,9 +251,11 @@ void fcMP4Writer::mp4End()
     // moov section
     //------------------------------------------------------
 
-    BinaryStream& bs = *m_stream;
+    m_mdat_end = m_stream->tellp();
+    AtomWriter bs;
+    // sample tables take most of the space. 16 bytes per sample (stsz + stco + stts + stsc at worst)
+    bs.reserve((m_video_frame_info.size() + m_audio_frame_info.size()) * 16 + 4096);
     Box box = Box(bs);
-    m_mdat_end = bs.tellp();
 
     u32 track_index = 0;
 
@@ -272,11 +296,9 @@ void fcMP4Writer::mp4End()
                 fcDebugLog("fcMP4StreamWriter::mp4End(): m_audio_encoder_info is not set!\n");
             }
 
-            Buffer dd_buf; // decoder descriptor
+            ByteWriter<64> dd; // decoder descriptor
             {
-                Buffer add_buf; //  audio decoder descriptor
-                BufferStream dd(dd_buf);
-                BufferStream add(add_buf);
+                ByteWriter<64> add; //  audio decoder descriptor
                 add << u8(0x40)         // MPEG-4 Audio
                     << u8(0x15)         // stream/type flags.  always 0x15 for my purposes.
                     << u8(0)            // buffer size, just set it to 1536 for both mp3 and aac
@@ -290,8 +312,8 @@ void fcMP4Writer::mp4End()
                 dd << u16(0);   // es id
                 dd << u8(0);    // stream priority
                 dd << u8(4);    // descriptor type
-                dd << u8(add_buf.size());
-                dd.write(add_buf.data(), add_buf.size());
+                dd << u8(add.size());
+                dd.write(add.data(), add.size());
                 dd << u8(0x6);  // config descriptor type
                 dd << u8(1);    // len
                 dd << u8(2);    // SL value(? always 2)
@@ -367,8 +389,8 @@ void fcMP4Writer::mp4End()
                                     box(u32_be('esds'), [&]() {
                                         bs << u32(0);   // version and flags (none)
                                         bs << u8(3);    // ES descriptor type
-                                        bs << u8(dd_buf.size());
-                                        bs.write(dd_buf.data(), dd_buf.size());
+                                        bs << u8(dd.size());
+                                        bs.write(dd.data(), dd.size());
                                     }); // esds
                                 }); // mp4a
                             }); // stsd
@@ -589,21 +611,23 @@ void fcMP4Writer::mp4End()
             }); // trak
         }
     }); // moov
+    bs.flush(*m_stream);
 
     {
-        size_t pos = bs.tellp();
+        BinaryStream& os = *m_stream;
+        size_t pos = os.tellp();
 #ifdef fcMP464BitLength
         // 64bit mdat length
         u64 mdat_size = u64_be(m_mdat_end - m_mdat_begin);
-        bs.seekp(m_mdat_begin + 8);
-        bs.write(&mdat_size, sizeof(mdat_size));
+        os.seekp(m_mdat_begin + 8);
+        os.write(&mdat_size, sizeof(mdat_size));
 #else
         // 32bit mdat length
         u32 mdat_size = u32_be(m_mdat_end - m_mdat_begin);
-        bs.seekp(m_mdat_begin);
-        bs.write(&mdat_size, sizeof(mdat_size));
+        os.seekp(m_mdat_begin);
+        os.write(&mdat_size, sizeof(mdat_size));
 #endif
-        bs.seekp(pos);
+        os.seekp(pos);
     }
 
     fcDebugLog("fcMP4StreamWriter::mp4End() done.\n");
@@ -24,6 +24,9 @@ private:
     RawVector<u8> m_sps;
     RawVector<u32> m_iframe_ids;
     RawVector<u8> m_audio_encoder_info;
+    // per-frame scratch for writev(). kept to avoid reallocation
+    RawVector<u32> m_nal_sizes;
+    RawVector<IOVec> m_iovecs;
 
     size_t m_mdat_begin = 0;
     size_t m_mdat_end = 0;
@@ -30,8 +30,16 @@ public:
 class fcMP4ContextWMF : public fcIMP4Context
 {
 public:
-    using VideoBuffer   = Buffer;
-    using VideoBuffers  = SharedResources<VideoBuffer>;
+    struct VideoFrame
+    {
+        Buffer pixels;
+        BorrowedPixels borrowed; // used instead of pixels if valid
+        fcPixelFormat format = fcPixelFormat_Unknown;
+        fcTime timestamp = 0.0;
+
+        const void* data() const { return borrowed ? borrowed.data() : pixels.data(); }
+    };
+    using VideoFrames   = FrameQueue<VideoFrame>;
 
     using AudioBuffer   = RawVector<float>;
     using AudioBuffers  = SharedResources<AudioBuffer>;
@@ -40,15 +48,22 @@ public:
     fcMP4ContextWMF(const fcMP4Config &conf, fcIGraphicsDevice *dev, const char *path);
     ~fcMP4ContextWMF();
     bool isValid() const override;
+    bool getFrameStats(fcFrameStats& dst) override;
+    bool getContextStats(fcContextStats& dst) override;
 
     const char* getAudioEncoderInfo() override;
     const char* getVideoEncoderInfo() override;
 
     void addOutputStream(fcStream *s) override;
+    void addPacketCallback(fcPacketCallback cb, void *userdata) override;
 
     bool addVideoFrameTexture(void *tex, fcPixelFormat fmt, fcTime timestamp) override;
-    bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp) override;
+    bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata) override;
     bool addVideoFramePixelsImpl(const void *pixels, fcPixelFormat fmt, fcTime timestamp);
+    void kickVideoFrame(VideoFrame *frame);
+    void kickVideoTask();
+    bool spillVideoFrame(const void *pixels, fcPixelFormat fmt, fcTime timestamp, size_t size);
+    void onVideoFrameAdded(fcTime timestamp);
 
     bool addAudioSamples(const float *samples, int num_samples) override;
     void writeOutAudioSamples(double timestamp);
@@ -61,14 +76,17 @@ private:
     fcMP4Config         m_conf;
     fcIGraphicsDevice   *m_gdev = nullptr;
 
-    TaskQueue           m_video_tasks;
-    VideoBuffers        m_video_buffers;
+    SPSCTaskQueue       m_video_tasks;
+    VideoFrames         m_video_frames;
+    Buffer              m_spill_staging;    // texture readback of frames to be spilled
+    Buffer              m_spilled_pixels;   // spilled frame being encoded
+    ContextStats        m_stats;
     Buffer              m_rgba_image;
     I420Image           m_i420_image;
     int                 m_frame_count = 0;
     double              m_last_timestamp = 0.0;
 
-    TaskQueue           m_audio_tasks;
+    SPSCTaskQueue       m_audio_tasks;
     AudioBuffer         m_audio_samples;
     AudioBuffers        m_audio_buffers;
     uint64_t            m_audio_written_samples = 0;
@@ -142,6 +160,10 @@ fcMP4ContextWMF::fcMP4ContextWMF(const fcMP4Config &conf, fcIGraphicsDevice *dev
     g_MFInitializer.get();
     m_conf.video_max_tasks = std::max<int>(m_conf.video_max_tasks, 1);
     m_conf.audio_max_tasks = std::max<int>(m_conf.audio_max_tasks, 1);
+    m_video_tasks.setPriority(m_conf.priority);
+    m_audio_tasks.setPriority(m_conf.priority);
+    m_video_frames.setPolicy(m_conf.backpressure, (size_t)m_conf.backpressure_memory_limit * 1024 * 1024);
+    m_video_frames.setContextStats(&m_stats);
 
     initializeSinkWriter(path);
 }
@@ -163,6 +185,18 @@ bool fcMP4ContextWMF::isValid() const
     return m_mf_writer != nullptr;
 }
 
+bool fcMP4ContextWMF::getFrameStats(fcFrameStats& dst)
+{
+    dst = m_video_frames.getStats();
+    return true;
+}
+
+bool fcMP4ContextWMF::getContextStats(fcContextStats& dst)
+{
+    m_stats.getStats(dst);
+    return true;
+}
+
 const char* fcMP4ContextWMF::getAudioEncoderInfo()
 {
     return nullptr;
@@ -178,6 +212,11 @@ void fcMP4ContextWMF::addOutputStream(fcStream *s)
     // do nothing
 }
 
+void fcMP4ContextWMF::addPacketCallback(fcPacketCallback cb, void *userdata)
+{
+    // do nothing. encoded data stays inside the sink writer
+}
+
 
 static inline HRESULT SetAttributeU32(ComPtr<ICodecAPI>& codec, const GUID& guid, UINT32 value)
 {
@@ -261,7 +300,7 @@ bool fcMP4ContextWMF::initializeSinkWriter(const char *path)
             }
 
             for (int i = 0; i < m_conf.video_max_tasks; ++i) {
-                m_video_buffers.emplace();
+                m_video_frames.emplace();
             }
         }
     }
@@ -323,45 +362,128 @@ bool fcMP4ContextWMF::addVideoFrameTexture(void *tex, fcPixelFormat fmt, fcTime
 {
     if (!isValid() || !m_conf.video || !tex || !m_gdev) { return false; }
 
-    auto buf = m_video_buffers.acquire();
     size_t psize = fcGetPixelSize(fmt);
     size_t size = m_conf.video_width * m_conf.video_height * psize;
-    buf->resize(size);
-    if (m_gdev->readTexture(buf->data(), buf->size(), tex, m_conf.video_width, m_conf.video_height, fmt)) {
-        m_video_tasks.run([this, buf, fmt, timestamp]() {
-            addVideoFramePixelsImpl(buf->data(), fmt, timestamp);
-        });
+    m_stats.onSubmit();
+    auto frame = m_video_frames.acquire(size);
+    if (!frame) {
+        if (m_conf.backpressure != fcBackpressurePolicy::Spill) { return false; }
+        BufferPool::getInstance().acquire(m_spill_staging, size);
+        bool ok;
+        {
+            ScopedLatency latency(&m_stats, StatsStage::Readback);
+            fcTraceScope("readTexture");
+            ok = m_gdev->readTexture(m_spill_staging.data(), size, tex, m_conf.video_width, m_conf.video_height, fmt);
+        }
+        if (!ok || !spillVideoFrame(m_spill_staging.data(), fmt, timestamp, size)) { return false; }
+        onVideoFrameAdded(timestamp);
+        return true;
+    }
+
+    BufferPool::getInstance().acquire(frame->pixels, size);
+    frame->format = fmt;
+    frame->timestamp = timestamp;
+    bool ok;
+    {
+        ScopedLatency latency(&m_stats, StatsStage::Readback);
+        fcTraceScope("readTexture");
+        ok = m_gdev->readTexture(frame->pixels.data(), frame->pixels.size(), tex, m_conf.video_width, m_conf.video_height, fmt);
+    }
+    if (ok) {
+        kickVideoFrame(frame);
     }
     else {
+        BufferPool::getInstance().release(frame->pixels);
+        m_video_frames.release(frame);
         return false;
     }
 
-    ++m_frame_count;
-    if(m_frame_count % 30 == 0) { writeOutAudioSamples(timestamp); }
-    m_last_timestamp = timestamp;
+    onVideoFrameAdded(timestamp);
     return true;
 }
 
-bool fcMP4ContextWMF::addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp)
+bool fcMP4ContextWMF::addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata)
 {
     if (!isValid() || !m_conf.video || !pixels) { return false; }
 
-    auto buf = m_video_buffers.acquire();
     size_t psize = fcGetPixelSize(fmt);
     size_t size = m_conf.video_width * m_conf.video_height * psize;
-    buf->resize(size);
-    memcpy(buf->data(), pixels, size);
+    m_stats.onSubmit();
+    auto frame = m_video_frames.acquire(size);
+    if (!frame) {
+        if (!spillVideoFrame(pixels, fmt, timestamp, size)) { return false; }
+        // pixels are copied to the spill file
+        if (release) { release(userdata, pixels); }
+        onVideoFrameAdded(timestamp);
+        return true;
+    }
 
-    m_video_tasks.run([this, buf, fmt, timestamp]() {
-        addVideoFramePixelsImpl(buf->data(), fmt, timestamp);
-    });
+    // frames dropped by DropOldest still hold borrowed pixels. reset() releases them.
+    if (release) {
+        frame->borrowed.reset(pixels, release, userdata);
+    }
+    else {
+        frame->borrowed.release();
+        BufferPool::getInstance().acquire(frame->pixels, size);
+        memcpy(frame->pixels.data(), pixels, size);
+    }
+    frame->format = fmt;
+    frame->timestamp = timestamp;
+    kickVideoFrame(frame);
+
+    onVideoFrameAdded(timestamp);
+    return true;
+}
 
+void fcMP4ContextWMF::onVideoFrameAdded(fcTime timestamp)
+{
     ++m_frame_count;
     if (m_frame_count % 30 == 0) { writeOutAudioSamples(timestamp); }
     m_last_timestamp = timestamp;
+}
+
+void fcMP4ContextWMF::kickVideoFrame(VideoFrame *frame)
+{
+    m_video_frames.push(frame);
+    kickVideoTask();
+}
+
+// Spill: frames m_video_frames can't take are written to the spill file, and encoded by tasks in order
+bool fcMP4ContextWMF::spillVideoFrame(const void *pixels, fcPixelFormat fmt, fcTime timestamp, size_t size)
+{
+    SpillQueue::Header header;
+    header.size = size;
+    header.format = fmt;
+    header.timestamp = timestamp;
+    header.width = m_conf.video_width;
+    header.height = m_conf.video_height;
+    if (!m_video_frames.spill(header, pixels)) { return false; }
+    kickVideoTask();
     return true;
 }
 
+// one task per frame. it encodes a queued frame, or a spilled one if none (spilled frames are always newer)
+void fcMP4ContextWMF::kickVideoTask()
+{
+    m_stats.onEnqueue();
+    m_video_tasks.run([this]() {
+        // frame can be dropped by backpressure policy before this task runs
+        if (auto frame = m_video_frames.pop()) {
+            addVideoFramePixelsImpl(frame->data(), frame->format, frame->timestamp);
+            frame->borrowed.release();
+            BufferPool::getInstance().release(frame->pixels);
+            m_video_frames.release(frame);
+        }
+        else {
+            SpillQueue::Header header;
+            if (m_video_frames.popSpilled(header, m_spilled_pixels)) {
+                addVideoFramePixelsImpl(m_spilled_pixels.data(), header.format, header.timestamp);
+            }
+        }
+        m_stats.onDequeue();
+    });
+}
+
 bool fcMP4ContextWMF::addVideoFramePixelsImpl(const void *pixels, fcPixelFormat fmt, fcTime timestamp)
 {
     const LONGLONG start = to_hnsec(timestamp);
@@ -370,6 +492,7 @@ bool fcMP4ContextWMF::addVideoFramePixelsImpl(const void *pixels, fcPixelFormat
     const DWORD buffer_size = size + (size >> 2) + (size >> 2);
 
     // convert image to I420
+    ContextStats::Binder binder(&m_stats);
     AnyToI420(m_i420_image, m_rgba_image, pixels, fmt, m_conf.video_width, m_conf.video_height);
     auto& i420 = m_i420_image.data();
 
@@ -389,7 +512,14 @@ bool fcMP4ContextWMF::addVideoFramePixelsImpl(const void *pixels, fcPixelFormat
     pSample->AddBuffer(pBuffer.Get());
     pSample->SetSampleTime(start);
     pSample->SetSampleDuration(duration);
-    m_mf_writer->WriteSample(m_mf_video_index, pSample.Get());
+    {
+        // sink writer encodes and writes in one call
+        ScopedLatency latency(&m_stats, StatsStage::Encode);
+        fcTraceScope("IMFSinkWriter::WriteSample");
+        m_mf_writer->WriteSample(m_mf_video_index, pSample.Get());
+    }
+    m_stats.onEncoded();
+    m_stats.onWritten();
 
     return true;
 }
@@ -403,7 +533,7 @@ bool fcMP4ContextWMF::addAudioSamples(const float *samples, int num_samples)
         m_audio_samples.append(samples, num_samples);
     }
     else {
-        auto buf = m_audio_buffers.acquire();
+        auto buf = m_conf.backpressure == fcBackpressurePolicy::Block ? m_audio_buffers.acquire() : m_audio_buffers.acquireOrGrow();
         buf->assign(samples, num_samples);
 
         m_audio_tasks.run([this, buf, num_samples]() {
@@ -423,7 +553,7 @@ void fcMP4ContextWMF::writeOutAudioSamples(double timestamp)
     num_write = std::min<uint64_t>(num_write, m_audio_samples.size());
     if (num_write == 0) { return; }
 
-    auto buf = m_audio_buffers.acquire();
+    auto buf = m_conf.backpressure == fcBackpressurePolicy::Block ? m_audio_buffers.acquire() : m_audio_buffers.acquireOrGrow();
     buf->assign(m_audio_samples.data(), (int)num_write);
     m_audio_samples.erase(m_audio_samples.begin(), m_audio_samples.begin() + num_write);
 
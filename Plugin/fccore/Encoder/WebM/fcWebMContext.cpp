@@ -16,8 +16,16 @@ public:
     using AudioEncoderPtr   = std::unique_ptr<fcIWebMAudioEncoder>;
     using WriterPtr         = std::unique_ptr<fcWebMWriter>;
     using WriterPtrs        = std::vector<WriterPtr>;
-    using VideoBuffer       = Buffer;
-    using VideoBuffers      = SharedResources<VideoBuffer>;
+    struct VideoFrame
+    {
+        Buffer pixels;
+        BorrowedPixels borrowed; // used instead of pixels if valid
+        fcPixelFormat format = fcPixelFormat_Unknown;
+        fcTime timestamp = 0.0;
+
+        const void* data() const { return borrowed ? borrowed.data() : pixels.data(); }
+    };
+    using VideoFrames       = FrameQueue<VideoFrame>;
     using AudioBuffer       = RawVector<float>;
     using AudioBuffers      = SharedResources<AudioBuffer>;
     using MKVFramePtr       = std::unique_ptr<mkvmuxer::Frame>;
@@ -26,16 +34,24 @@ public:
 
     fcWebMContext(fcWebMConfig &conf, fcIGraphicsDevice *gd);
     void addOutputStream(fcStream *s) override;
+    void addPacketCallback(fcPacketCallback cb, void *userdata) override;
     bool addVideoFrameTexture(void *tex, fcPixelFormat fmt, fcTime timestamp) override;
-    bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp) override;
+    bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata) override;
     bool addAudioSamples(const float *samples, int num_samples) override;
+    bool getFrameStats(fcFrameStats& dst) override;
+    bool getContextStats(fcContextStats& dst) override;
 
 private:
     ~fcWebMContext() override;
+    void kickVideoFrame(VideoFrame *frame);
+    void kickVideoTask();
+    bool spillVideoFrame(const void *pixels, fcPixelFormat fmt, fcTime timestamp, size_t size);
+    void drainSpilledVideo();
     void addVideoFramePixelsImpl(const void *pixels, fcPixelFormat fmt, fcTime timestamp);
     void flushVideo();
     void flushAudio();
     void addMkvFrames(fcWebMFrameData& data, int track, double& last_timestamp);
+    void emitPackets(const fcWebMFrameData& data, int track);
     void writeOut(double timestamp);
 
 private:
@@ -44,15 +60,22 @@ private:
 
     std::mutex          m_mutex;
     WriterPtrs          m_writers;
+    PacketSinks         m_packet_sinks;
+    ContextStats        m_stats;
     MKVFramePtrs        m_mkv_frames;
+    MKVFramePtrs        m_mkv_frame_pool;
 
-    TaskQueue           m_video_tasks;
+    SPSCTaskQueue       m_video_tasks;
     VideoEncoderPtr     m_video_encoder;
-    VideoBuffers        m_video_buffers;
+    VideoFrames         m_video_frames;
     fcWebMFrameData     m_video_frame;
+    Buffer              m_spill_staging;    // texture readback of frames to be spilled
+    Buffer              m_spilled_pixels;   // spilled frame being encoded
+    std::mutex          m_spill_mutex;
+    bool                m_spill_draining = false; // a drainSpilledVideo() task is queued or running. guarded by m_spill_mutex
     double              m_video_last_timestamp = 0.0;
 
-    TaskQueue           m_audio_tasks;
+    SPSCTaskQueue       m_audio_tasks;
     AudioEncoderPtr     m_audio_encoder;
     AudioBuffers        m_audio_buffers;
     fcWebMFrameData     m_audio_frame;
@@ -66,6 +89,10 @@ fcWebMContext::fcWebMContext(fcWebMConfig &conf, fcIGraphicsDevice *gd)
 {
     m_conf.video_max_tasks = std::max<int>(m_conf.video_max_tasks, 1);
     m_conf.audio_max_tasks = std::max<int>(m_conf.audio_max_tasks, 1);
+    m_video_tasks.setPriority(m_conf.priority);
+    m_audio_tasks.setPriority(m_conf.priority);
+    m_video_frames.setPolicy(m_conf.backpressure, (size_t)m_conf.backpressure_memory_limit * 1024 * 1024);
+    m_video_frames.setContextStats(&m_stats);
 
     if (conf.video) {
         fcVPXEncoderConfig econf;
@@ -88,7 +115,7 @@ fcWebMContext::fcWebMContext(fcWebMConfig &conf, fcIGraphicsDevice *gd)
         }
 
         for (int i = 0; i < m_conf.video_max_tasks; ++i) {
-            m_video_buffers.emplace();
+            m_video_frames.emplace();
         }
     }
 
@@ -120,11 +147,20 @@ fcWebMContext::~fcWebMContext()
     flushAudio();
     m_video_tasks.wait();
     m_audio_tasks.wait();
+    setFinalizeProgress(0.5f);
 
     if (m_conf.video && m_conf.audio) {
         writeOut(m_video_last_timestamp);
     }
+    for (auto& mkvf : m_mkv_frames) {
+        MemoryBudget::getInstance().release((size_t)mkvf->length(), &m_stats);
+    }
     m_mkv_frames.clear();
+    // writers finalize segment on destruction
+    for (size_t i = 0; i < m_writers.size(); ++i) {
+        m_writers[i].reset();
+        setFinalizeProgress(0.5f + 0.5f * float(i + 1) / float(m_writers.size()));
+    }
     m_writers.clear();
 
     m_video_encoder.reset();
@@ -135,47 +171,174 @@ void fcWebMContext::addOutputStream(fcStream *s)
 {
     if (!s) { return; }
     m_writers.emplace_back(new fcWebMWriter(s, m_conf, m_video_encoder.get(), m_audio_encoder.get()));
+    m_stats.addStream(s);
+}
+
+void fcWebMContext::addPacketCallback(fcPacketCallback cb, void *userdata)
+{
+    m_packet_sinks.add(cb, userdata);
 }
 
 bool fcWebMContext::addVideoFrameTexture(void *tex, fcPixelFormat fmt, fcTime timestamp)
 {
     if (!tex || !m_video_encoder || !m_gdev) { return false; }
 
-    auto buf = m_video_buffers.acquire();
     size_t psize = fcGetPixelSize(fmt);
     size_t size = m_conf.video_width * m_conf.video_height * psize;
-    buf->resize(size);
-    if (m_gdev->readTexture(buf->data(), buf->size(), tex, m_conf.video_width, m_conf.video_height, fmt)) {
-        m_video_tasks.run([this, buf, fmt, timestamp]() {
-            addVideoFramePixelsImpl(buf->data(), fmt, timestamp);
-        });
+    m_stats.onSubmit();
+    auto frame = m_video_frames.acquire(size);
+    if (!frame) {
+        if (m_conf.backpressure != fcBackpressurePolicy::Spill) { return false; }
+        BufferPool::getInstance().acquire(m_spill_staging, size);
+        bool ok;
+        {
+            ScopedLatency latency(&m_stats, StatsStage::Readback);
+            fcTraceScope("readTexture");
+            ok = m_gdev->readTexture(m_spill_staging.data(), size, tex, m_conf.video_width, m_conf.video_height, fmt);
+        }
+        return ok && spillVideoFrame(m_spill_staging.data(), fmt, timestamp, size);
+    }
+
+    BufferPool::getInstance().acquire(frame->pixels, size);
+    frame->format = fmt;
+    frame->timestamp = timestamp;
+    bool ok;
+    {
+        ScopedLatency latency(&m_stats, StatsStage::Readback);
+        fcTraceScope("readTexture");
+        ok = m_gdev->readTexture(frame->pixels.data(), frame->pixels.size(), tex, m_conf.video_width, m_conf.video_height, fmt);
+    }
+    if (ok) {
+        kickVideoFrame(frame);
     }
     else {
+        BufferPool::getInstance().release(frame->pixels);
+        m_video_frames.release(frame);
         return false;
     }
     return true;
 }
 
-bool fcWebMContext::addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp)
+bool fcWebMContext::addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata)
 {
     if (!pixels || !m_video_encoder) { return false; }
 
-    auto buf = m_video_buffers.acquire();
     size_t psize = fcGetPixelSize(fmt);
     size_t size = m_conf.video_width * m_conf.video_height * psize;
-    buf->resize(size);
-    memcpy(buf->data(), pixels, size);
+    m_stats.onSubmit();
+    auto frame = m_video_frames.acquire(size);
+    if (!frame) {
+        if (!spillVideoFrame(pixels, fmt, timestamp, size)) { return false; }
+        // pixels are copied to the spill file
+        if (release) { release(userdata, pixels); }
+        return true;
+    }
 
-    m_video_tasks.run([this, buf, fmt, timestamp]() {
-        addVideoFramePixelsImpl(buf->data(), fmt, timestamp);
+    // frames dropped by DropOldest still hold borrowed pixels. reset() releases them.
+    if (release) {
+        frame->borrowed.reset(pixels, release, userdata);
+    }
+    else {
+        frame->borrowed.release();
+        BufferPool::getInstance().acquire(frame->pixels, size);
+        memcpy(frame->pixels.data(), pixels, size);
+    }
+    frame->format = fmt;
+    frame->timestamp = timestamp;
+    kickVideoFrame(frame);
+    return true;
+}
+
+void fcWebMContext::kickVideoFrame(VideoFrame *frame)
+{
+    m_video_frames.push(frame);
+    kickVideoTask();
+}
+
+// Spill: frames m_video_frames can't take are written to the spill file. they are newer than queued frames,
+// so one drain task queued after those encodes them in order. a task per spilled frame would fill m_video_tasks,
+// and its waitSlot() would pace the caller to the encoder as Block does.
+bool fcWebMContext::spillVideoFrame(const void *pixels, fcPixelFormat fmt, fcTime timestamp, size_t size)
+{
+    SpillQueue::Header header;
+    header.size = size;
+    header.format = fmt;
+    header.timestamp = timestamp;
+    header.width = m_conf.video_width;
+    header.height = m_conf.video_height;
+    if (!m_video_frames.spill(header, pixels)) { return false; }
+    m_stats.onEnqueue();
+
+    bool start;
+    {
+        std::unique_lock<std::mutex> l(m_spill_mutex);
+        start = !m_spill_draining;
+        m_spill_draining = true;
+    }
+    if (start) {
+        m_video_tasks.run([this]() { drainSpilledVideo(); });
+    }
+    return true;
+}
+
+void fcWebMContext::drainSpilledVideo()
+{
+    SpillQueue::Header header;
+    for (;;) {
+        while (m_video_frames.popSpilled(header, m_spilled_pixels)) {
+            addVideoFramePixelsImpl(m_spilled_pixels.data(), header.format, header.timestamp);
+            m_stats.onDequeue();
+        }
+        // a frame spilled after this check sees no drainer and starts one
+        std::unique_lock<std::mutex> l(m_spill_mutex);
+        if (!m_video_frames.hasSpilled()) {
+            m_spill_draining = false;
+            return;
+        }
+    }
+}
+
+// one task per queued frame
+void fcWebMContext::kickVideoTask()
+{
+    m_stats.onEnqueue();
+    m_video_tasks.run([this]() {
+        // frame can be dropped by backpressure policy before this task runs
+        if (auto frame = m_video_frames.pop()) {
+            addVideoFramePixelsImpl(frame->data(), frame->format, frame->timestamp);
+            frame->borrowed.release();
+            BufferPool::getInstance().release(frame->pixels);
+            m_video_frames.release(frame);
+        }
+        m_stats.onDequeue();
     });
+}
+
+bool fcWebMContext::getFrameStats(fcFrameStats& dst)
+{
+    dst = m_video_frames.getStats();
+    return true;
+}
+
+bool fcWebMContext::getContextStats(fcContextStats& dst)
+{
+    m_stats.getStats(dst);
     return true;
 }
 
 void fcWebMContext::addVideoFramePixelsImpl(const void *pixels, fcPixelFormat fmt, fcTime timestamp)
 {
-    if (m_video_encoder->encode(m_video_frame, pixels, fmt, timestamp)) {
+    ContextStats::Binder binder(&m_stats);
+    bool encoded;
+    {
+        ScopedLatency latency(&m_stats, StatsStage::Encode);
+        fcTraceScope("fcIWebMVideoEncoder::encode");
+        encoded = m_video_encoder->encode(m_video_frame, pixels, fmt, timestamp);
+    }
+    if (encoded) {
+        m_stats.onEncoded();
         {
+            ScopedLatency latency(&m_stats, StatsStage::Write);
             std::unique_lock<std::mutex> lock(m_mutex);
             addMkvFrames(m_video_frame, fcWebMWriter::VideoTrackIndex, m_video_last_timestamp);
             if (!m_conf.audio) {
@@ -185,6 +348,7 @@ void fcWebMContext::addVideoFramePixelsImpl(const void *pixels, fcPixelFormat fm
                 writeOut(std::min<double>(m_video_last_timestamp, m_audio_last_timestamp) - 1.0);
             }
         }
+        m_stats.onWritten();
         m_video_frame.clear();
     }
 }
@@ -209,11 +373,16 @@ bool fcWebMContext::addAudioSamples(const float *samples, int num_samples)
 {
     if (!samples || !m_audio_encoder) { return false; }
 
-    auto buf = m_audio_buffers.acquire();
+    auto buf = m_conf.backpressure == fcBackpressurePolicy::Block ? m_audio_buffers.acquire() : m_audio_buffers.acquireOrGrow();
     buf->assign(samples, num_samples);
 
     m_audio_tasks.run([this, buf]() {
-        if (m_audio_encoder->encode(m_audio_frame, buf->data(), buf->size())) {
+        bool encoded;
+        {
+            fcTraceScope("fcIWebMAudioEncoder::encode");
+            encoded = m_audio_encoder->encode(m_audio_frame, buf->data(), buf->size());
+        }
+        if (encoded) {
             {
                 std::unique_lock<std::mutex> lock(m_mutex);
                 addMkvFrames(m_audio_frame, fcWebMWriter::AudioTrackIndex, m_audio_last_timestamp);
@@ -247,14 +416,64 @@ void fcWebMContext::flushAudio()
 
 void fcWebMContext::addMkvFrames(fcWebMFrameData& fd, int track, double& last_timestamp)
 {
+    emitPackets(fd, track);
+    if (m_writers.empty()) {
+        // packet callbacks only. no need to keep frames for interleaving
+        if (!fd.packets.empty()) {
+            last_timestamp = fd.packets.back().timestamp;
+        }
+        return;
+    }
+
     fd.eachPackets([this, track, &last_timestamp](const char *data, const fcWebMPacketInfo& pinfo) {
         last_timestamp = pinfo.timestamp;
-        auto mkvf = new mkvmuxer::Frame();
+        MKVFramePtr mkvf;
+        if (m_mkv_frame_pool.empty()) {
+            mkvf.reset(new mkvmuxer::Frame());
+        }
+        else {
+            mkvf = std::move(m_mkv_frame_pool.back());
+            m_mkv_frame_pool.pop_back();
+        }
         mkvf->Init((const uint8_t*)data, pinfo.size);
         mkvf->set_track_number(track);
         mkvf->set_timestamp(to_nsec(last_timestamp));
         mkvf->set_is_key(pinfo.keyframe);
-        m_mkv_frames.emplace_back(mkvf);
+        // encoded frames wait here until the other track catches up. they can't be dropped, but count toward the budget.
+        MemoryBudget::getInstance().forceCharge(pinfo.size, &m_stats);
+
+        // keep frames sorted by timestamp. inserting after equal ones keeps the order stable,
+        // and unlike std::stable_sort() this doesn't need temporary buffer.
+        auto pos = std::upper_bound(m_mkv_frames.begin(), m_mkv_frames.end(), mkvf,
+            [](const MKVFramePtr& a, const MKVFramePtr& b) { return a->timestamp() < b->timestamp(); });
+        m_mkv_frames.insert(pos, std::move(mkvf));
+    });
+}
+
+void fcWebMContext::emitPackets(const fcWebMFrameData& fd, int track)
+{
+    m_packet_sinks.emitEach([&](const PacketSinks::Emit& emit) {
+        fcPacket packet;
+        const Buffer *codec_private;
+        if (track == fcWebMWriter::VideoTrackIndex) {
+            packet.codec = m_conf.video_encoder == fcWebMVideoEncoder::VPX_VP8 ? fcPacketCodec::VP8 : fcPacketCodec::VP9;
+            codec_private = &m_video_encoder->getCodecPrivate();
+        }
+        else {
+            packet.codec = m_conf.audio_encoder == fcWebMAudioEncoder::Vorbis ? fcPacketCodec::Vorbis : fcPacketCodec::Opus;
+            codec_private = &m_audio_encoder->getCodecPrivate();
+        }
+        if (!codec_private->empty()) {
+            packet.codec_private = codec_private->data();
+            packet.codec_private_size = codec_private->size();
+        }
+        fd.eachPackets([&](const char *data, const fcWebMPacketInfo& pinfo) {
+            packet.data = data;
+            packet.size = pinfo.size;
+            packet.timestamp = pinfo.timestamp;
+            packet.keyframe = pinfo.keyframe != 0;
+            emit(packet);
+        });
     });
 }
 
@@ -262,11 +481,6 @@ void fcWebMContext::writeOut(double timestamp_)
 {
     if (timestamp_ < 0.0) { return; }
 
-    if (m_conf.video && m_conf.audio) {
-        std::stable_sort(m_mkv_frames.begin(), m_mkv_frames.end(),
-            [](const MKVFramePtr& a, const MKVFramePtr& b) { return a->timestamp() < b->timestamp(); });
-    }
-
     int num_added = 0;
     auto timestamp = to_nsec(timestamp_);
     for (auto& mkvf : m_mkv_frames) {
@@ -280,6 +494,11 @@ void fcWebMContext::writeOut(double timestamp_)
             break;
         }
     }
+    // written frames are reused by addMkvFrames()
+    for (int i = 0; i < num_added; ++i) {
+        MemoryBudget::getInstance().release((size_t)m_mkv_frames[i]->length(), &m_stats);
+        m_mkv_frame_pool.emplace_back(std::move(m_mkv_frames[i]));
+    }
     m_mkv_frames.erase(m_mkv_frames.begin(), m_mkv_frames.begin() + num_added);
 }
 
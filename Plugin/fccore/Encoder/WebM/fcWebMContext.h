@@ -4,12 +4,14 @@ class fcIWebMContext : public fcContextBase
 {
 public:
     virtual void addOutputStream(fcStream *s) = 0;
+    virtual void addPacketCallback(fcPacketCallback cb, void *userdata) = 0;
 
     // timestamp=-1 is treated as current time.
     virtual bool addVideoFrameTexture(void *tex, fcPixelFormat fmt, fcTime timestamp = -1.0) = 0;
 
     // timestamp=-1 is treated as current time.
-    virtual bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1.0) = 0;
+    // release: if not null, pixels are borrowed instead of copied (see fcWebMAddVideoFramePixelsBorrowed())
+    virtual bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1.0, fcReleasePixels release = nullptr, void *userdata = nullptr) = 0;
 
     virtual bool addAudioSamples(const float *samples, int num_samples) = 0;
 };
@@ -10,29 +10,66 @@
 #endif // _MSC_VER
 
 
+// mkvmuxer writes element IDs and sizes in pieces of a few bytes. they are held until the next payload
+// and written together with it by writev(), instead of a stream write per piece.
+// in live mode, fcWebMWriter::addFrame() flushes them after each frame, as the consumer reads the stream while it is written.
 class fcMkvStream : public mkvmuxer::IMkvWriter
 {
 public:
-    fcMkvStream(BinaryStream *stream) : m_stream(stream) { m_stream->addRef(); }
-    ~fcMkvStream() { m_stream->release(); }
-    int32_t Write(const void* buf, uint32_t len) override { m_stream->write(buf, len); return 0; }
-    mkvmuxer::int64 Position() const override { return m_stream->tellp(); }
-    mkvmuxer::int32 Position(mkvmuxer::int64 position) override { m_stream->seekp((size_t)position); return 0; }
-    bool Seekable() const override { return true; }
+    fcMkvStream(BinaryStream *stream, bool seekable) : m_stream(stream), m_seekable(seekable) { m_stream->addRef(); }
+    ~fcMkvStream() { flush(); m_stream->release(); }
+
+    int32_t Write(const void* buf, uint32_t len) override
+    {
+        if (len < PendingThreshold) {
+            m_pending.append((const char*)buf, len);
+            if (m_pending.size() >= PendingThreshold) { flush(); }
+        }
+        else if (!m_pending.empty()) {
+            IOVec vecs[] = { { m_pending.data(), m_pending.size() }, { buf, len } };
+            m_stream->writev(vecs, 2);
+            m_pending.clear();
+        }
+        else {
+            m_stream->write(buf, len);
+        }
+        return 0;
+    }
+    mkvmuxer::int64 Position() const override { return m_stream->tellp() + m_pending.size(); }
+    mkvmuxer::int32 Position(mkvmuxer::int64 position) override { flush(); m_stream->seekp((size_t)position); return 0; }
+    bool Seekable() const override { return m_seekable; }
     void ElementStartNotify(mkvmuxer::uint64 element_id, mkvmuxer::int64 position) override {}
+
+    void flush()
+    {
+        if (m_pending.empty()) { return; }
+        m_stream->write(m_pending.data(), m_pending.size());
+        m_pending.clear();
+    }
+
 private:
+    static const uint32_t PendingThreshold = 256;
+
     BinaryStream *m_stream = nullptr;
+    bool m_seekable = true;
+    Buffer m_pending;
 };
 
 
 fcWebMWriter::fcWebMWriter(
     BinaryStream *stream, const fcWebMConfig &conf,
     const fcIWebMVideoEncoder *vinfo, const fcIWebMAudioEncoder *ainfo)
-    : m_stream(new fcMkvStream(stream))
+    : m_stream(new fcMkvStream(stream, !conf.live))
 {
     m_segment.Init(m_stream.get());
-    m_segment.set_mode(mkvmuxer::Segment::kFile);
-    m_segment.set_estimate_file_duration(true);
+    if (conf.live) {
+        // clusters are written as they are completed, and nothing is patched afterwards
+        m_segment.set_mode(mkvmuxer::Segment::kLive);
+    }
+    else {
+        m_segment.set_mode(mkvmuxer::Segment::kFile);
+        m_segment.set_estimate_file_duration(true);
+    }
 
     if (conf.video && vinfo) {
         m_video_track_id = m_segment.AddVideoTrack(conf.video_width, conf.video_height, VideoTrackIndex);
@@ -71,7 +108,10 @@ fcWebMWriter::~fcWebMWriter()
 
 void fcWebMWriter::addFrame(mkvmuxer::Frame& f)
 {
+    fcTraceScope("fcWebMWriter::addFrame");
     m_segment.AddGenericFrame(&f);
+    // payloads below PendingThreshold (e.g. small audio packets) would otherwise wait for the next frame
+    if (!m_stream->Seekable()) { m_stream->flush(); }
 }
 
 
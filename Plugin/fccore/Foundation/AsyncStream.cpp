@@ -0,0 +1,192 @@
+#include "pch.h"
+#include "fcInternal.h"
+#include "AsyncStream.h"
+#include "Trace.h"
+
+namespace {
+
+// writes are packed into chunks of this size at most, so that the queue holds a few large writes instead of many small ones
+const size_t ChunkSize = 256 * 1024;
+
+} // namespace
+
+
+AsyncStream::AsyncStream(BinaryStream *sink, const fcAsyncStreamConfig& conf)
+    : m_sink(sink)
+    , m_conf(conf)
+{
+    m_conf.max_queue_size = std::max<int>(m_conf.max_queue_size, 1024);
+    m_sink->addRef();
+    m_wpos = m_sink_pos = m_sink->tellp();
+    m_thread = std::thread([this]() { process(); });
+}
+
+AsyncStream::~AsyncStream()
+{
+    {
+        Lock l(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    m_thread.join();
+    m_sink->release();
+}
+
+size_t AsyncStream::tellg()
+{
+    flush();
+    return m_sink->tellg();
+}
+
+void AsyncStream::seekg(size_t pos)
+{
+    flush();
+    m_sink->seekg(pos);
+}
+
+size_t AsyncStream::read(void *dst, size_t len)
+{
+    flush();
+    return m_sink->read(dst, len);
+}
+
+size_t AsyncStream::tellp()
+{
+    return (size_t)m_wpos;
+}
+
+void AsyncStream::seekp(size_t pos)
+{
+    // the next write() starts a new chunk at pos
+    m_wpos = pos;
+}
+
+size_t AsyncStream::write(const void *data_, size_t len)
+{
+    if (len == 0) { return 0; }
+    fcTraceScope("AsyncStream::write");
+
+    auto data = (const char*)data_;
+    {
+        Lock l(m_mutex);
+        if (m_detached) {
+            // accept and discard, so that the context keeps feeding other sinks. discarded bytes are not counted, as in RingStream
+            m_wpos += len;
+            return 0;
+        }
+
+        // a write larger than the queue is let through when the queue is empty
+        size_t limit = (size_t)m_conf.max_queue_size;
+        if (m_queued > 0 && m_queued + len > limit) {
+            if (m_conf.lag_policy == fcSinkLagPolicy::Detach) {
+                fcDebugLog("AsyncStream::write(): the sink is %d bytes behind. detached\n", (int)m_queued);
+                detach();
+                l.unlock();
+                m_condition.notify_all();
+                m_wpos += len;
+                return 0;
+            }
+            fcTraceScope("AsyncStream::write (wait)");
+            ++m_stalls;
+            // a plain wait, not ThreadPool::waitUntil(): writers hold their context's lock here,
+            // and a nested task of the same context (e.g. its audio task) would lock it again on this thread.
+            m_condition.wait(l, [&]() { return m_queued == 0 || m_queued + len <= limit; });
+        }
+
+        bool appendable = !m_pending.empty() && [&]() {
+            auto& back = m_pending.back();
+            return back.pos + back.data.size() == m_wpos && back.data.size() + len <= ChunkSize;
+        }();
+        if (!appendable) {
+            Chunk chunk;
+            if (!m_free.empty()) {
+                chunk.data.swap(m_free.back());
+                m_free.pop_back();
+                chunk.data.clear();
+            }
+            chunk.pos = m_wpos;
+            chunk.time = Clock::now();
+            m_pending.push_back(std::move(chunk));
+        }
+        m_pending.back().data.append(data, len);
+        m_queued += len;
+        m_peak_queued = std::max(m_peak_queued, m_queued);
+    }
+    m_condition.notify_all();
+    m_wpos += len;
+    return addWrittenBytes(len);
+}
+
+uint64_t AsyncStream::getPendingBytes() const
+{
+    Lock l(m_mutex);
+    return m_queued;
+}
+
+void AsyncStream::flush()
+{
+    fcTraceScope("AsyncStream::flush");
+    Lock l(m_mutex);
+    m_condition.wait(l, [this]() { return m_pending.empty() && !m_writing; });
+}
+
+void AsyncStream::getStats(fcAsyncStreamStats& dst)
+{
+    {
+        Lock l(m_mutex);
+        dst.queued_bytes = m_queued;
+        dst.peak_queued_bytes = m_peak_queued;
+        dst.stalls = m_stalls;
+        dst.detached = m_detached;
+    }
+    dst.written_bytes = m_sink->getWrittenBytes();
+    dst.lag = m_lag.get();
+}
+
+// m_mutex must be locked. queued data is discarded and the sink gets no more writes.
+// the chunk being written (if any) is completed and leaves m_queued by process()
+void AsyncStream::detach()
+{
+    m_detached = true;
+    while (!m_pending.empty()) {
+        m_queued -= m_pending.front().data.size();
+        m_free.emplace_back();
+        m_free.back().swap(m_pending.front().data);
+        m_pending.pop_front();
+    }
+}
+
+void AsyncStream::process()
+{
+    Tracer::getInstance().setThreadName("fcAsyncStream");
+    Chunk chunk;
+    for (;;) {
+        {
+            Lock l(m_mutex);
+            m_condition.wait(l, [this]() { return m_stop || !m_pending.empty(); });
+            if (m_pending.empty()) { break; }
+            chunk = std::move(m_pending.front());
+            m_pending.pop_front();
+            m_writing = true;
+        }
+
+        {
+            fcTraceScope("AsyncStream::process (sink)");
+            if (m_sink_pos != chunk.pos) {
+                m_sink->seekp((size_t)chunk.pos);
+            }
+            m_sink->write(chunk.data.data(), chunk.data.size());
+            m_sink_pos = chunk.pos + chunk.data.size();
+        }
+        m_lag.record(Clock::now() - chunk.time);
+
+        {
+            Lock l(m_mutex);
+            m_queued -= chunk.data.size();
+            m_free.emplace_back();
+            m_free.back().swap(chunk.data);
+            m_writing = false;
+        }
+        m_condition.notify_all();
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include "Buffer.h"
+#include "RingQueue.h"
+#include "Stats.h"
+
+
+// BinaryStream that queues writes and passes them to the sink stream on its own thread, for fcCreateAsyncStream().
+// contexts write to all their output streams in a loop, so a slow sink (network, USB disk, managed callback)
+// would stall the other sinks and the encoder. with this in between, write() only copies into the queue.
+// queued data carries its offset, so seekp() (header patch-ups) is replayed on the sink in order.
+// when the queue is full, lag_policy decides whether the writer waits or the sink is cut off.
+class AsyncStream : public BinaryStream
+{
+public:
+    AsyncStream(BinaryStream *sink, const fcAsyncStreamConfig& conf);
+    ~AsyncStream() override;
+
+    // reads flush pending writes first and go to the sink
+    size_t  tellg() override;
+    void    seekg(size_t pos) override;
+    size_t  read(void *dst, size_t len) override;
+
+    size_t  tellp() override;
+    void    seekp(size_t pos) override;
+    size_t  write(const void *data, size_t len) override;
+    uint64_t getPendingBytes() const override;
+
+    // wait until all queued data reaches the sink
+    void flush();
+    void getStats(fcAsyncStreamStats& dst);
+
+private:
+    using Lock = std::unique_lock<std::mutex>;
+    using Clock = LatencyHistogram::Clock;
+    struct Chunk
+    {
+        Buffer data;
+        uint64_t pos = 0;       // offset of data[0] in the sink
+        Clock::time_point time; // when the first byte was queued
+    };
+
+    void detach();
+    void process();
+
+    BinaryStream *m_sink;
+    fcAsyncStreamConfig m_conf;
+    std::thread m_thread;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    RingQueue<Chunk> m_pending;     // the back one takes more writes until it is full
+    std::vector<Buffer> m_free;
+    size_t m_queued = 0;            // bytes in m_pending and being written
+    size_t m_peak_queued = 0;
+    uint64_t m_stalls = 0;
+    bool m_writing = false;
+    bool m_detached = false;
+    bool m_stop = false;
+    LatencyHistogram m_lag;
+
+    // touched only by the writer (caller of write() / seekp())
+    uint64_t m_wpos = 0;
+    // touched only by the sink thread
+    uint64_t m_sink_pos = 0;
+};
@@ -1,9 +1,17 @@
 #include "pch.h"
 #include "fcInternal.h"
 #include "Buffer.h"
+#ifdef __linux__
+    #include <sys/mman.h>
+    #include <unistd.h>
+    #define fcEnableLargeAlloc
+#endif
+
+static std::atomic<uint64_t> g_aligned_alloc_count = { 0 };
 
 fcAPI void* AlignedAlloc(size_t size, size_t alignment)
 {
+    g_aligned_alloc_count.fetch_add(1, std::memory_order_relaxed);
     size_t mask = alignment - 1;
     size = (size + mask) & (~mask);
 #ifdef _WIN32
@@ -23,3 +31,150 @@ fcAPI void AlignedFree(void *addr)
     free(addr);
 #endif
 }
+
+fcAPI uint64_t GetAlignedAllocCount()
+{
+    return g_aligned_alloc_count.load(std::memory_order_relaxed);
+}
+
+
+namespace {
+
+// placed right before data. size is 0x20 to keep data 32 byte aligned.
+struct BufferHeader
+{
+    size_t mapped_size; // 0 if allocated by AlignedAlloc()
+    size_t pad[3];
+};
+static_assert(sizeof(BufferHeader) == 0x20, "");
+
+// size of a huge page on x86-64 and arm64. smaller blocks gain nothing from mmap().
+const size_t HugePageSize = 2 * 1024 * 1024;
+std::atomic<size_t> g_large_alloc_threshold = { HugePageSize };
+
+inline BufferHeader* GetHeader(void *addr) { return (BufferHeader*)addr - 1; }
+
+#ifdef fcEnableLargeAlloc
+size_t GetPageSize()
+{
+    static const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+// large blocks are mapped as [one page, header at its end][data], and data starts at a huge page boundary.
+// a header in front of data on the same page would shift data off the boundary, and then no part of it could be a huge page.
+size_t GetMappedSize(size_t size)
+{
+    size_t page_size = GetPageSize();
+    return page_size + ((size + page_size - 1) & ~(page_size - 1));
+}
+
+char* GetMappedBase(BufferHeader *header)
+{
+    return (char*)(header + 1) - GetPageSize();
+}
+
+// map mapped_size bytes so that the data part is huge page aligned. over-allocate and trim both ends.
+char* MapAligned(size_t mapped_size)
+{
+    size_t page_size = GetPageSize();
+    size_t len = mapped_size + HugePageSize;
+    void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) { return nullptr; }
+
+    char *begin = (char*)p;
+    char *end = begin + len;
+    char *data = (char*)(((uintptr_t)begin + page_size + HugePageSize - 1) & ~(uintptr_t)(HugePageSize - 1));
+    char *base = data - page_size;
+    if (base > begin) { munmap(begin, base - begin); }
+    if (end > base + mapped_size) { munmap(base + mapped_size, end - (base + mapped_size)); }
+    return base;
+}
+
+bool IsLarge(size_t size)
+{
+    size_t threshold = g_large_alloc_threshold.load(std::memory_order_relaxed);
+    return threshold != 0 && size >= threshold;
+}
+
+void* OnMapped(void *base, size_t mapped_size)
+{
+    size_t page_size = GetPageSize();
+    char *data = (char*)base + page_size;
+    // transparent huge pages reduce TLB misses on big frame buffers. this is only a hint and may be ignored.
+    madvise(data, mapped_size - page_size, MADV_HUGEPAGE);
+    g_aligned_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    auto header = GetHeader(data);
+    header->mapped_size = mapped_size;
+    return data;
+}
+#endif
+
+} // namespace
+
+fcAPI void* BufferAlloc(size_t size)
+{
+#ifdef fcEnableLargeAlloc
+    if (IsLarge(size)) {
+        size_t mapped_size = GetMappedSize(size);
+        if (char *base = MapAligned(mapped_size)) {
+            return OnMapped(base, mapped_size);
+        }
+        // fall back to AlignedAlloc()
+    }
+#endif
+    auto header = (BufferHeader*)AlignedAlloc(sizeof(BufferHeader) + size, 0x20);
+    if (!header) { return nullptr; }
+    header->mapped_size = 0;
+    return header + 1;
+}
+
+fcAPI void* BufferRealloc(void *addr, size_t used, size_t new_size)
+{
+    if (!addr) { return BufferAlloc(new_size); }
+
+#ifdef fcEnableLargeAlloc
+    auto header = GetHeader(addr);
+    if (header->mapped_size != 0 && IsLarge(new_size)) {
+        // page table entries are moved instead of copying contents. the block is moved onto an aligned range,
+        // as mremap() itself keeps only page alignment. if it fails, the old mapping is intact and copied below.
+        size_t mapped_size = GetMappedSize(new_size);
+        if (char *target = MapAligned(mapped_size)) {
+            void *p = mremap(GetMappedBase(header), header->mapped_size, mapped_size, MREMAP_MAYMOVE | MREMAP_FIXED, target);
+            if (p != MAP_FAILED) {
+                return OnMapped(p, mapped_size);
+            }
+            munmap(target, mapped_size);
+        }
+    }
+#endif
+    void *ret = BufferAlloc(new_size);
+    if (ret) {
+        memcpy(ret, addr, std::min<size_t>(used, new_size));
+        BufferFree(addr);
+    }
+    return ret;
+}
+
+fcAPI void BufferFree(void *addr)
+{
+    if (!addr) { return; }
+    auto header = GetHeader(addr);
+#ifdef fcEnableLargeAlloc
+    if (header->mapped_size != 0) {
+        munmap(GetMappedBase(header), header->mapped_size);
+        return;
+    }
+#endif
+    AlignedFree(header);
+}
+
+fcAPI void SetLargeAllocThreshold(size_t size)
+{
+    g_large_alloc_threshold = size;
+}
+
+fcAPI size_t GetLargeAllocThreshold()
+{
+    return g_large_alloc_threshold;
+}
@@ -3,9 +3,23 @@
 #include <vector>
 #include <algorithm>
 #include <cstring>
+#include <new>
+#include "Trace.h"
 
 fcAPI void* AlignedAlloc(size_t size, size_t align);
 fcAPI void  AlignedFree(void *p);
+// total number of AlignedAlloc() and large buffer allocation / growth. for allocation regression tests
+fcAPI uint64_t GetAlignedAllocCount();
+
+// allocation for RawVector. on linux, blocks larger than the large alloc threshold are mmap()-ed with transparent huge pages
+// and BufferRealloc() grows them by mremap() without copying. otherwise AlignedAlloc() is used. returned memory is 32 byte aligned.
+fcAPI void* BufferAlloc(size_t size);
+// used: bytes to keep from the old block. returns nullptr on failure, and then addr stays valid (as realloc())
+fcAPI void* BufferRealloc(void *addr, size_t used, size_t new_size);
+fcAPI void  BufferFree(void *addr);
+// 0 disables large allocation. can be changed anytime; blocks remember how they were allocated.
+fcAPI void  SetLargeAllocThreshold(size_t size);
+fcAPI size_t GetLargeAllocThreshold();
 
 
 // low-level vector<>. T must be POD type
@@ -35,17 +49,19 @@ public:
     RawVector& operator=(RawVector&& v)
     {
         clear();
+        shrink_to_fit();
         std::swap(m_data, v.m_data);
         std::swap(m_size, v.m_size);
         std::swap(m_capacity, v.m_capacity);
         return *this;
     }
-    ~RawVector() { clear(); }
+    ~RawVector() { deallocate(m_data, sizeof(T) * m_capacity); }
 
     value_type&         operator[](size_t i) { return m_data[i]; }
     const value_type&   operator[](size_t i) const { return m_data[i]; }
 
     size_t          size() const    { return m_size; }
+    size_t          capacity() const { return m_capacity; }
     bool            empty() const   { return m_size == 0; }
     iterator        begin()         { return m_data; }
     const_iterator  begin() const   { return m_data; }
@@ -60,20 +76,17 @@ public:
     const T& back() const   { return m_data[m_size - 1]; }
 
 
-    static void* allocate(size_t size) { return AlignedAlloc(size, 0x20); }
-    static void deallocate(void *addr, size_t size) { AlignedFree(addr); }
+    static void* allocate(size_t size) { return BufferAlloc(size); }
+    static void deallocate(void *addr, size_t size) { BufferFree(addr); }
 
     void reserve(size_t s)
     {
         if (s > m_capacity) {
             s = std::max<size_t>(s, m_size * 2);
-            size_t newsize = sizeof(T) * s;
-            size_t oldsize = sizeof(T) * m_size;
-
-            T *newdata = (T*)allocate(newsize);
-            memcpy(newdata, m_data, oldsize);
-            deallocate(m_data, oldsize);
-            m_data = newdata;
+            T *data = (T*)BufferRealloc(m_data, sizeof(T) * m_size, sizeof(T) * s);
+            // as std::vector. contents are kept, and the caller doesn't write past the end
+            if (!data) { throw std::bad_alloc(); }
+            m_data = data;
             m_capacity = s;
         }
     }
@@ -84,12 +97,20 @@ public:
         m_size = s;
     }
 
+    // keeps storage, so that per-frame buffers don't reallocate on next use. use shrink_to_fit() to release it.
     void clear()
     {
-        size_t oldsize = sizeof(T) * m_size;
-        deallocate(m_data, oldsize);
-        m_data = nullptr;
-        m_size = m_capacity = 0;
+        m_size = 0;
+    }
+
+    void shrink_to_fit()
+    {
+        if (m_capacity == m_size) { return; }
+        T *newdata = m_size > 0 ? (T*)allocate(sizeof(T) * m_size) : nullptr;
+        if (newdata) { memcpy(newdata, m_data, sizeof(T) * m_size); }
+        deallocate(m_data, sizeof(T) * m_capacity);
+        m_data = newdata;
+        m_capacity = m_size;
     }
 
     void swap(RawVector &other)
@@ -161,6 +182,52 @@ protected:
 typedef RawVector<char> Buffer;
 
 
+// caller-owned pixels passed to *Borrowed() APIs instead of copying them into a Buffer.
+// release() (or destructor) hands them back to the caller by calling the release callback once.
+class BorrowedPixels
+{
+public:
+    BorrowedPixels() {}
+    BorrowedPixels(const BorrowedPixels&) = delete;
+    BorrowedPixels& operator=(const BorrowedPixels&) = delete;
+    ~BorrowedPixels() { release(); }
+
+    // release previous pixels if any
+    void reset(const void *data, fcReleasePixels cb, void *userdata)
+    {
+        release();
+        m_data = data;
+        m_cb = cb;
+        m_userdata = userdata;
+    }
+
+    void release()
+    {
+        if (m_cb) {
+            auto cb = m_cb;
+            m_cb = nullptr;
+            cb(m_userdata, m_data);
+        }
+        m_data = nullptr;
+    }
+
+    const void* data() const { return m_data; }
+    explicit operator bool() const { return m_data != nullptr; }
+
+private:
+    const void *m_data = nullptr;
+    fcReleasePixels m_cb = nullptr;
+    void *m_userdata = nullptr;
+};
+
+
+// one piece of BinaryStream::writev()
+struct IOVec
+{
+    const void *data;
+    size_t size;
+};
+
 class BinaryStream
 {
 protected:
@@ -185,9 +252,32 @@ public:
     virtual size_t  tellp() = 0;
     virtual void    seekp(size_t pos) = 0;
     virtual size_t  write(const void *data, size_t len) = 0;
+    // gathered write. same result as write() of each piece in order, but in one call.
+    // streams override this to copy or hand the pieces over at once.
+    virtual size_t  writev(const IOVec *vecs, int num)
+    {
+        size_t ret = 0;
+        for (int i = 0; i < num; ++i) {
+            ret += write(vecs[i].data, vecs[i].size);
+        }
+        return ret;
+    }
+
+    // total bytes passed to write(). can be read from any thread (for statistics)
+    uint64_t getWrittenBytes() const { return m_written_bytes.load(std::memory_order_relaxed); }
+    // bytes accepted by write() but not passed to the destination yet (AsyncStream). can be read from any thread
+    virtual uint64_t getPendingBytes() const { return 0; }
+
+protected:
+    size_t addWrittenBytes(size_t len)
+    {
+        m_written_bytes.fetch_add(len, std::memory_order_relaxed);
+        return len;
+    }
 
 private:
     std::atomic_int m_ref_count = { 1 };
+    std::atomic<uint64_t> m_written_bytes = { 0 };
 };
 
 inline BinaryStream& operator<<(BinaryStream &o, const int8_t&   v) { o.write(&v, 1); return o; }
@@ -261,7 +351,23 @@ public:
         }
         memcpy(&m_buf[m_wpos], data, len);
         m_wpos += len;
-        return len;
+        return addWrittenBytes(len);
+    }
+
+    size_t writev(const IOVec *vecs, int num) override
+    {
+        size_t len = 0;
+        for (int i = 0; i < num; ++i) { len += vecs[i].size; }
+        size_t required_size = m_wpos + len;
+        if (m_buf.size() < required_size) {
+            m_buf.resize(required_size);
+        }
+        for (int i = 0; i < num; ++i) {
+            if (vecs[i].size == 0) { continue; }
+            memcpy(&m_buf[m_wpos], vecs[i].data, vecs[i].size);
+            m_wpos += vecs[i].size;
+        }
+        return addWrittenBytes(len);
     }
 
 protected:
@@ -299,8 +405,20 @@ public:
 
     size_t write(const void *data, size_t len) override
     {
+        fcTraceScope("StdOStream::write");
         m_os.write((const char*)data, len);
-        return len;
+        return addWrittenBytes(len);
+    }
+
+    size_t writev(const IOVec *vecs, int num) override
+    {
+        fcTraceScope("StdOStream::writev");
+        size_t len = 0;
+        for (int i = 0; i < num; ++i) {
+            m_os.write((const char*)vecs[i].data, vecs[i].size);
+            len += vecs[i].size;
+        }
+        return addWrittenBytes(len);
     }
 
 protected:
@@ -385,8 +503,20 @@ public:
 
     size_t write(const void *data, size_t len) override
     {
+        fcTraceScope("StdIOStream::write");
         m_ios.write((const char*)data, len);
-        return len;
+        return addWrittenBytes(len);
+    }
+
+    size_t writev(const IOVec *vecs, int num) override
+    {
+        fcTraceScope("StdIOStream::writev");
+        size_t len = 0;
+        for (int i = 0; i < num; ++i) {
+            m_ios.write((const char*)vecs[i].data, vecs[i].size);
+            len += vecs[i].size;
+        }
+        return addWrittenBytes(len);
     }
 
 protected:
@@ -457,9 +587,38 @@ public:
 
     size_t write(const void *data, size_t len) override
     {
-        return m_csd.write(m_csd.obj, data, len);
+        fcTraceScope("CustomStream::write");
+        return addWrittenBytes(m_csd.write(m_csd.obj, data, len));
+    }
+
+    // each callback may cross into managed code, so small pieces are packed into one call.
+    // large pieces are passed as they are to avoid copying them.
+    size_t writev(const IOVec *vecs, int num) override
+    {
+        fcTraceScope("CustomStream::writev");
+        size_t ret = 0;
+        m_gather.clear();
+        for (int i = 0; i < num; ++i) {
+            auto& v = vecs[i];
+            if (v.size < GatherThreshold) {
+                m_gather.append((const char*)v.data, v.size);
+                continue;
+            }
+            if (!m_gather.empty()) {
+                ret += m_csd.write(m_csd.obj, m_gather.data(), m_gather.size());
+                m_gather.clear();
+            }
+            ret += m_csd.write(m_csd.obj, v.data, v.size);
+        }
+        if (!m_gather.empty()) {
+            ret += m_csd.write(m_csd.obj, m_gather.data(), m_gather.size());
+        }
+        return addWrittenBytes(ret);
     }
 
 private:
+    static const size_t GatherThreshold = 16 * 1024;
+
     CustomStreamData m_csd;
+    Buffer m_gather;
 };
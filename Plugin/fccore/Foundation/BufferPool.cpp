@@ -0,0 +1,137 @@
+#include "pch.h"
+#include "fcInternal.h"
+#include "BufferPool.h"
+
+namespace {
+    const int MinClassLog2 = 12; // log2(BufferPool::MinClassSize)
+
+    int Log2Floor(size_t v)
+    {
+        int r = 0;
+        while (v >>= 1) { ++r; }
+        return r;
+    }
+}
+
+
+BufferPool& BufferPool::getInstance()
+{
+    static BufferPool s_instance;
+    return s_instance;
+}
+
+// round_up: smallest class that can hold size. otherwise largest class that fits in size (-1 if none).
+int BufferPool::getClass(size_t size, bool round_up)
+{
+    if (size < MinClassSize) { return round_up ? 0 : -1; }
+    int e = Log2Floor(size);
+    int sub = (int)(size >> (e - 2)) & 3;
+    int c = (e - MinClassLog2) * 4 + sub;
+    if (round_up && getClassSize(c) < size) { ++c; }
+    return c;
+}
+
+size_t BufferPool::getClassSize(int c)
+{
+    int e = c / 4 + MinClassLog2;
+    int sub = c % 4;
+    return (size_t)(4 + sub) << (e - 2);
+}
+
+void BufferPool::acquire(Buffer& buf, size_t size)
+{
+    if (buf.capacity() >= size) {
+        buf.resize(size);
+        return;
+    }
+
+    int c = getClass(size, true);
+    size_t class_size = getClassSize(c);
+    Buffer tmp;
+    {
+        Lock l(m_mutex);
+        release(buf, l);
+        if ((int)m_classes.size() > c && !m_classes[c].empty()) {
+            auto& idle = m_classes[c];
+            tmp.swap(idle.back());
+            idle.pop_back();
+            m_stats.idle_bytes -= tmp.capacity();
+            ++m_stats.num_reuses;
+        }
+        else {
+            ++m_stats.num_allocations;
+        }
+        m_stats.in_use_bytes += std::max<size_t>(tmp.capacity(), class_size);
+        m_stats.peak_in_use_bytes = std::max(m_stats.peak_in_use_bytes, m_stats.in_use_bytes);
+    }
+    if (tmp.capacity() == 0) {
+        tmp.reserve(class_size);
+    }
+    tmp.resize(size);
+    buf.swap(tmp);
+}
+
+void BufferPool::release(Buffer& buf)
+{
+    if (buf.capacity() == 0) { return; }
+    Lock l(m_mutex);
+    release(buf, l);
+}
+
+void BufferPool::release(Buffer& buf, Lock&)
+{
+    size_t capacity = buf.capacity();
+    if (capacity == 0) { return; }
+
+    // buffers not taken from the pool may be released too. in_use_bytes is approximate in that case.
+    m_stats.in_use_bytes -= std::min<uint64_t>(m_stats.in_use_bytes, capacity);
+
+    int c = getClass(capacity, false);
+    if (c < 0 || m_stats.idle_bytes + capacity > m_max_idle_bytes) {
+        buf.clear();
+        buf.shrink_to_fit();
+        ++m_stats.num_trimmed;
+        return;
+    }
+
+    if ((int)m_classes.size() <= c) {
+        m_classes.resize(c + 1);
+    }
+    auto& idle = m_classes[c];
+    idle.emplace_back();
+    idle.back().swap(buf);
+    buf.clear();
+    m_stats.idle_bytes += capacity;
+    m_stats.peak_idle_bytes = std::max(m_stats.peak_idle_bytes, m_stats.idle_bytes);
+}
+
+void BufferPool::setMaxIdleBytes(uint64_t v)
+{
+    Lock l(m_mutex);
+    m_max_idle_bytes = v;
+    trim(v, l);
+}
+
+void BufferPool::trim(uint64_t max_idle_bytes)
+{
+    Lock l(m_mutex);
+    trim(max_idle_bytes, l);
+}
+
+void BufferPool::trim(uint64_t max_idle_bytes, Lock&)
+{
+    for (int c = (int)m_classes.size() - 1; c >= 0 && m_stats.idle_bytes > max_idle_bytes; --c) {
+        auto& idle = m_classes[c];
+        while (!idle.empty() && m_stats.idle_bytes > max_idle_bytes) {
+            m_stats.idle_bytes -= idle.back().capacity();
+            idle.pop_back();
+            ++m_stats.num_trimmed;
+        }
+    }
+}
+
+void BufferPool::getStats(fcBufferPoolStats& dst)
+{
+    Lock l(m_mutex);
+    dst = m_stats;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include "Buffer.h"
+
+
+// process-wide pool of idle frame buffers shared by all contexts.
+// contexts return buffers of finished frames here, so that recorders of the same resolution share idle memory
+// instead of each holding its own. buffers are grouped by size class (1/4 steps of power of two), so a buffer
+// wastes at most 25% of its size.
+class BufferPool
+{
+public:
+    static const size_t MinClassSize = 4096;
+    static const uint64_t DefaultMaxIdleBytes = 256 * 1024 * 1024;
+
+    static BufferPool& getInstance();
+
+    // resize buf to size. if buf doesn't have enough capacity, its storage is returned and a pooled (or new) buffer is taken.
+    // contents are not kept in that case.
+    void acquire(Buffer& buf, size_t size);
+    // move storage of buf to the pool. buf becomes empty.
+    void release(Buffer& buf);
+
+    void setMaxIdleBytes(uint64_t v);
+    // free idle buffers (larger ones first) until idle bytes <= max_idle_bytes
+    void trim(uint64_t max_idle_bytes);
+    void getStats(fcBufferPoolStats& dst);
+
+private:
+    using Lock = std::unique_lock<std::mutex>;
+    static int getClass(size_t size, bool round_up);
+    static size_t getClassSize(int c);
+    // these require m_mutex locked
+    void release(Buffer& buf, Lock& l);
+    void trim(uint64_t max_idle_bytes, Lock& l);
+
+    std::mutex m_mutex;
+    std::vector<std::vector<Buffer>> m_classes;
+    uint64_t m_max_idle_bytes = DefaultMaxIdleBytes;
+    fcBufferPoolStats m_stats;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <type_traits>
+#include "Buffer.h"
+
+
+// serializer for container headers (mp4 atoms, gif / wave headers).
+// operator<< is an inline append to local memory instead of a virtual BinaryStream::write() per integer,
+// sizes are patched in place with patch(), and the result goes to the stream by one write (flush()).
+// the first StackSize bytes live in the object itself, so small headers don't touch the heap.
+// byte order is as is, same as BinaryStream. use u32_be() etc. for big-endian fields.
+template<size_t StackSize = 1024>
+class ByteWriter
+{
+public:
+    ByteWriter() : m_data(m_stack), m_capacity(StackSize) {}
+    ByteWriter(const ByteWriter&) = delete;
+    ByteWriter& operator=(const ByteWriter&) = delete;
+
+    const char* data() const    { return m_data; }
+    size_t size() const         { return m_size; }
+    size_t tellp() const        { return m_size; }
+    bool empty() const          { return m_size == 0; }
+    void clear()                { m_size = 0; }
+
+    void reserve(size_t size)
+    {
+        if (size <= m_capacity) { return; }
+        size_t capacity = std::max<size_t>(size, m_capacity * 2);
+        bool on_stack = m_data == m_stack;
+        m_heap.resize(capacity); // keeps the contents once on the heap
+        if (on_stack) {
+            memcpy(m_heap.data(), m_stack, m_size);
+        }
+        m_data = m_heap.data();
+        m_capacity = capacity;
+    }
+
+    void write(const void *data, size_t len)
+    {
+        if (m_size + len > m_capacity) { reserve(m_size + len); }
+        memcpy(m_data + m_size, data, len);
+        m_size += len;
+    }
+
+    template<class T>
+    ByteWriter& operator<<(const T& v)
+    {
+        static_assert(std::is_arithmetic<T>::value, "ByteWriter: only arithmetic types");
+        write(&v, sizeof(T));
+        return *this;
+    }
+
+    // overwrite already written bytes. e.g. size field of a box
+    template<class T>
+    void patch(size_t pos, const T& v)
+    {
+        static_assert(std::is_arithmetic<T>::value, "ByteWriter: only arithmetic types");
+        memcpy(m_data + pos, &v, sizeof(T));
+    }
+
+    // write everything to the stream at once and clear
+    void flush(BinaryStream& os)
+    {
+        if (m_size > 0) {
+            os.write(m_data, m_size);
+            m_size = 0;
+        }
+    }
+
+private:
+    char *m_data;
+    size_t m_size = 0;
+    size_t m_capacity;
+    Buffer m_heap;
+    char m_stack[StackSize];
+};
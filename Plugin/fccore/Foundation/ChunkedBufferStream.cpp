@@ -0,0 +1,124 @@
+#include "pch.h"
+#include "fcInternal.h"
+#include "ChunkedBufferStream.h"
+#include "Trace.h"
+
+
+ChunkedBufferStream::ChunkedBufferStream(size_t segment_size)
+    : m_segment_size(std::max<size_t>(segment_size, 4096))
+{
+}
+
+size_t ChunkedBufferStream::tellg()
+{
+    return m_rpos;
+}
+
+void ChunkedBufferStream::seekg(size_t pos)
+{
+    m_rpos = std::min<size_t>(pos, m_size);
+}
+
+size_t ChunkedBufferStream::read(void *dst_, size_t len)
+{
+    auto dst = (char*)dst_;
+    len = std::min<size_t>(len, m_size - m_rpos);
+    size_t remaining = len;
+    while (remaining > 0) {
+        size_t contiguous;
+        const char *src = locate(m_rpos, contiguous);
+        size_t n = std::min<size_t>(remaining, contiguous);
+        memcpy(dst, src, n);
+        dst += n;
+        m_rpos += n;
+        remaining -= n;
+    }
+    return len;
+}
+
+size_t ChunkedBufferStream::tellp()
+{
+    return m_wpos;
+}
+
+void ChunkedBufferStream::seekp(size_t pos)
+{
+    m_wpos = std::min<size_t>(pos, m_size);
+}
+
+size_t ChunkedBufferStream::write(const void *data_, size_t len)
+{
+    auto data = (const char*)data_;
+    size_t remaining = len;
+    while (remaining > 0) {
+        size_t contiguous;
+        char *dst = locate(m_wpos, contiguous);
+        size_t n = std::min<size_t>(remaining, contiguous);
+        memcpy(dst, data, n);
+        data += n;
+        m_wpos += n;
+        remaining -= n;
+    }
+    m_size = std::max(m_size, m_wpos);
+    return addWrittenBytes(len);
+}
+
+int ChunkedBufferStream::getNumChunks() const
+{
+    size_t tail = m_size - m_head.size();
+    return (m_head.empty() ? 0 : 1) + (int)((tail + m_segment_size - 1) / m_segment_size);
+}
+
+fcBufferData ChunkedBufferStream::getChunk(int i)
+{
+    fcBufferData ret;
+    if (i < 0 || i >= getNumChunks()) { return ret; }
+    if (!m_head.empty()) {
+        if (i == 0) {
+            ret.data = m_head.data();
+            ret.size = m_head.size();
+            return ret;
+        }
+        --i;
+    }
+    size_t begin = m_segment_size * i;
+    ret.data = m_segments[i].data();
+    ret.size = std::min<size_t>(m_segment_size, m_size - m_head.size() - begin);
+    return ret;
+}
+
+fcBufferData ChunkedBufferStream::compact()
+{
+    if (!m_segments.empty()) {
+        fcTraceScope("ChunkedBufferStream::compact");
+        size_t pos = m_head.size();
+        m_head.resize(m_size);
+        for (int i = 0; pos < m_size; ++i) {
+            size_t n = std::min<size_t>(m_segment_size, m_size - pos);
+            memcpy(m_head.data() + pos, m_segments[i].data(), n);
+            pos += n;
+        }
+        m_segments.clear();
+    }
+
+    fcBufferData ret;
+    ret.data = m_head.data();
+    ret.size = m_head.size();
+    return ret;
+}
+
+char* ChunkedBufferStream::locate(size_t pos, size_t& contiguous)
+{
+    if (pos < m_head.size()) {
+        contiguous = m_head.size() - pos;
+        return m_head.data() + pos;
+    }
+    size_t offset = pos - m_head.size();
+    size_t index = offset / m_segment_size;
+    while (index >= m_segments.size()) {
+        m_segments.emplace_back();
+        m_segments.back().resize(m_segment_size);
+    }
+    contiguous = m_segment_size - offset % m_segment_size;
+    return m_segments[index].data() + offset % m_segment_size;
+}
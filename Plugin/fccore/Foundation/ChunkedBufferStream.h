@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include "Buffer.h"
+
+
+// memory stream made of fixed-size segments, for fcCreateMemoryStream().
+// unlike BufferStream, growing never copies what has been written, and no single allocation has to hold the whole recording.
+// seekp() + write() overwrite in place, so header patch-ups of mp4 / wave / webm work as usual.
+// getChunk() lets callers drain the data piece by piece. compact() makes it contiguous on demand:
+// data is moved into one head buffer and writes after that continue in new segments.
+class ChunkedBufferStream : public BinaryStream
+{
+public:
+    static const size_t DefaultSegmentSize = 1024 * 1024;
+
+    ChunkedBufferStream(size_t segment_size = DefaultSegmentSize);
+
+    size_t  tellg() override;
+    void    seekg(size_t pos) override;
+    size_t  read(void *dst, size_t len) override;
+
+    size_t  tellp() override;
+    void    seekp(size_t pos) override;
+    size_t  write(const void *data, size_t len) override;
+
+    size_t size() const { return m_size; }
+    // chunks in order. their concatenation is the whole data. pointers are valid until the next write() or compact()
+    int getNumChunks() const;
+    fcBufferData getChunk(int i);
+    // move all data into one contiguous buffer and return it. valid until the next write() or compact()
+    fcBufferData compact();
+
+private:
+    // address of pos and how many bytes are contiguous from there. allocates the segment if needed
+    char* locate(size_t pos, size_t& contiguous);
+
+    size_t m_segment_size;
+    Buffer m_head;                  // made by compact(). covers [0, m_head.size())
+    std::vector<Buffer> m_segments; // cover [m_head.size(), m_size)
+    size_t m_size = 0;
+    size_t m_wpos = 0;
+    size_t m_rpos = 0;
+};
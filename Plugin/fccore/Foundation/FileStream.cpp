@@ -0,0 +1,514 @@
+#include "pch.h"
+#include "fcInternal.h"
+#include "FileStream.h"
+#include "Trace.h"
+
+#ifdef fcWindows
+    #include <io.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+
+// O_DIRECT requires file offset, size and memory address to be aligned to the logical block size of the device.
+// 4096 covers both 512 and 4096 byte devices.
+const uint64_t DirectIOAlignment = 4096;
+
+#ifdef fcWindows
+    // no pwrite() / pread() on Windows. only the I/O thread writes, so seek + write is fine
+    int64_t WriteAt(int fd, uint64_t pos, const void *data, size_t size)
+    {
+        if (_lseeki64(fd, pos, SEEK_SET) < 0) { return -1; }
+        return _write(fd, data, (unsigned int)size);
+    }
+    int64_t ReadAt(int fd, uint64_t pos, void *dst, size_t size)
+    {
+        if (_lseeki64(fd, pos, SEEK_SET) < 0) { return -1; }
+        return _read(fd, dst, (unsigned int)size);
+    }
+#else
+    int64_t WriteAt(int fd, uint64_t pos, const void *data, size_t size)
+    {
+        return ::pwrite(fd, data, size, (off_t)pos);
+    }
+    int64_t ReadAt(int fd, uint64_t pos, void *dst, size_t size)
+    {
+        return ::pread(fd, dst, size, (off_t)pos);
+    }
+#endif
+
+    // write all of data, continuing after short writes. return 0 or errno
+    int WriteAll(int fd, uint64_t pos, const char *data, size_t size)
+    {
+        while (size > 0) {
+            int64_t r = WriteAt(fd, pos, data, size);
+            if (r < 0) {
+                if (errno == EINTR) { continue; }
+                return errno;
+            }
+            if (r == 0) {
+                // no progress. the disk is full
+                return ENOSPC;
+            }
+            data += r;
+            pos += r;
+            size -= (size_t)r;
+        }
+        return 0;
+    }
+
+} // namespace
+
+
+FileStream::FileStream(const char *path, const fcFileStreamConfig& conf)
+    : m_conf(conf)
+    , m_path(path)
+{
+    m_conf.buffer_size = std::max<int>(m_conf.buffer_size, 4096);
+    m_conf.num_buffers = std::max<int>(m_conf.num_buffers, 1);
+
+#ifdef __linux__
+    if (m_conf.direct_io) {
+        m_fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if (m_fd != -1) {
+            m_direct = true;
+        }
+        else {
+            fcDebugLog("FileStream::FileStream(): O_DIRECT is not supported for %s. using the page cache\n", path);
+        }
+    }
+#endif
+    if (m_fd == -1) {
+#ifdef fcWindows
+        m_fd = _open(path, _O_BINARY | _O_RDWR | _O_CREAT | _O_TRUNC, _S_IREAD | _S_IWRITE);
+#else
+        m_fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+#endif
+    }
+    if (m_fd == -1) {
+        fcDebugLog("FileStream::FileStream(): failed to open %s\n", path);
+        return;
+    }
+#ifdef fcMac
+    if (m_conf.direct_io) {
+        // no alignment requirement unlike O_DIRECT
+        ::fcntl(m_fd, F_NOCACHE, 1);
+    }
+#endif
+
+    m_current.data.reserve(m_conf.buffer_size);
+    m_num_buffers = 1;
+    if (m_direct) {
+        // unaligned edges of buffers need the I/O thread's staging buffer
+        m_direct_stage = (char*)AlignedAlloc(m_conf.buffer_size + DirectIOAlignment * 2, DirectIOAlignment);
+        m_direct_tail.resize(DirectIOAlignment);
+    }
+    else if (m_conf.use_io_uring && initializeRing()) {
+        return;
+    }
+    m_thread = std::thread([this]() { process(); });
+}
+
+FileStream::~FileStream()
+{
+    if (m_fd == -1) { return; }
+
+    flush();
+    if (m_thread.joinable()) {
+        {
+            Lock l(m_mutex);
+            m_stop = true;
+        }
+        m_condition.notify_all();
+        m_thread.join();
+    }
+
+#ifdef fcWindows
+    _close(m_fd);
+    if (m_read_fd != -1) { _close(m_read_fd); }
+#else
+    // free preallocated space and padding of direct I/O beyond the end of data
+    if ((m_preallocated > m_file_size || m_direct) && ::ftruncate(m_fd, (off_t)m_file_size) != 0) {
+        fcDebugLog("FileStream::~FileStream(): ftruncate failed (errno %d)\n", errno);
+    }
+    ::close(m_fd);
+    if (m_read_fd != -1) { ::close(m_read_fd); }
+#endif
+    if (m_direct_stage) { AlignedFree(m_direct_stage); }
+}
+
+bool FileStream::isValid() const
+{
+    return m_fd != -1;
+}
+
+
+size_t FileStream::tellg()
+{
+    return (size_t)m_rpos;
+}
+
+void FileStream::seekg(size_t pos)
+{
+    m_rpos = pos;
+}
+
+size_t FileStream::read(void *dst, size_t len)
+{
+    if (m_fd == -1) { return 0; }
+    flush();
+
+    // O_DIRECT reads need alignment too. read through another descriptor with the page cache
+    int fd = m_fd;
+#ifndef fcWindows
+    if (m_direct) {
+        if (m_read_fd == -1) {
+            m_read_fd = ::open(m_path.c_str(), O_RDONLY);
+            if (m_read_fd == -1) { return 0; }
+        }
+        fd = m_read_fd;
+    }
+#endif
+    int64_t r = ReadAt(fd, m_rpos, dst, len);
+    if (r <= 0) { return 0; }
+    m_rpos += r;
+    return (size_t)r;
+}
+
+
+size_t FileStream::tellp()
+{
+    return (size_t)m_wpos;
+}
+
+void FileStream::seekp(size_t pos)
+{
+    // seeking inside the current buffer just moves the write position. otherwise start a new buffer at pos
+    auto& cur = m_current;
+    if (pos < cur.pos || pos > cur.pos + cur.data.size()) {
+        submit();
+        m_current.pos = pos;
+    }
+    m_wpos = pos;
+}
+
+size_t FileStream::write(const void *data, size_t len)
+{
+    if (m_fd == -1 || getError()) { return 0; }
+    append((const char*)data, len);
+    return addWrittenBytes(len);
+}
+
+size_t FileStream::writev(const IOVec *vecs, int num)
+{
+    if (m_fd == -1 || getError()) { return 0; }
+    size_t len = 0;
+    for (int i = 0; i < num; ++i) {
+        append((const char*)vecs[i].data, vecs[i].size);
+        len += vecs[i].size;
+    }
+    return addWrittenBytes(len);
+}
+
+void FileStream::append(const char *data, size_t len)
+{
+    size_t remaining = len;
+    while (remaining > 0) {
+        auto& cur = m_current;
+        size_t offset = size_t(m_wpos - cur.pos);
+        size_t n = std::min<size_t>(remaining, m_conf.buffer_size - offset);
+        if (offset + n > cur.data.size()) {
+            cur.data.resize(offset + n);
+        }
+        memcpy(cur.data.data() + offset, data, n);
+        data += n;
+        remaining -= n;
+        m_wpos += n;
+        m_file_size = std::max(m_file_size, m_wpos);
+        if (cur.data.size() == (size_t)m_conf.buffer_size) {
+            submit();
+            m_current.pos = m_wpos;
+        }
+    }
+}
+
+bool FileStream::flush()
+{
+    if (m_fd == -1) { return false; }
+
+    fcTraceScope("FileStream::flush");
+    submit();
+    m_current.pos = m_wpos;
+    if (m_ring) {
+        reapRing(0);
+    }
+    else {
+        Lock l(m_mutex);
+        m_condition.wait(l, [this]() { return m_pending.empty() && !m_writing; });
+    }
+    return getError() == 0;
+}
+
+int FileStream::getError() const
+{
+    return m_error.load(std::memory_order_acquire);
+}
+
+// keep the first error. later ones are likely caused by it
+void FileStream::setError(int err)
+{
+    int expected = 0;
+    if (m_error.compare_exchange_strong(expected, err)) {
+        fcDebugLog("FileStream: write to %s failed (errno %d). later writes are rejected\n", m_path.c_str(), err);
+    }
+}
+
+// hand the current buffer to the I/O thread and take a free one. blocks if all buffers are waiting for the disk.
+void FileStream::submit()
+{
+    if (m_current.data.empty()) { return; }
+    if (m_ring) {
+        submitRing();
+        return;
+    }
+
+    Buffer next;
+    {
+        Lock l(m_mutex);
+        m_pending.push_back(std::move(m_current));
+        if (m_free.empty() && m_num_buffers < m_conf.num_buffers) {
+            ++m_num_buffers;
+        }
+        else {
+            if (m_free.empty()) {
+                fcTraceScope("FileStream::submit (wait)");
+                m_condition.notify_all();
+                m_condition.wait(l, [this]() { return !m_free.empty(); });
+            }
+            next.swap(m_free.back());
+            m_free.pop_back();
+        }
+    }
+    m_condition.notify_all();
+
+    if (next.capacity() == 0) {
+        next.reserve(m_conf.buffer_size);
+    }
+    next.clear();
+    m_current.data.swap(next);
+}
+
+void FileStream::process()
+{
+    Tracer::getInstance().setThreadName("fcFileIO");
+    Block block;
+    for (;;) {
+        {
+            Lock l(m_mutex);
+            m_condition.wait(l, [this]() { return m_stop || !m_pending.empty(); });
+            if (m_pending.empty()) { break; }
+            block = std::move(m_pending.front());
+            m_pending.pop_front();
+            m_writing = true;
+        }
+
+        writeBlock(block);
+
+        {
+            Lock l(m_mutex);
+            m_free.emplace_back();
+            m_free.back().swap(block.data);
+            m_writing = false;
+        }
+        m_condition.notify_all();
+    }
+}
+
+bool FileStream::writeBlock(const Block& block)
+{
+    fcTraceScope("FileStream::writeBlock");
+    if (m_direct) {
+        return writeBlockDirect(block);
+    }
+    preallocate(block.pos + block.data.size());
+
+    int err = WriteAll(m_fd, block.pos, block.data.data(), block.data.size());
+    if (err) {
+        setError(err);
+        return false;
+    }
+    return true;
+}
+
+// write the block as whole aligned blocks. unaligned head and tail are merged with the file contents
+bool FileStream::writeBlockDirect(const Block& block)
+{
+    const uint64_t A = DirectIOAlignment;
+    uint64_t pos = block.pos;
+    uint64_t end = pos + block.data.size();
+    uint64_t abegin = pos / A * A;
+    uint64_t aend = (end + A - 1) / A * A;
+
+    char *stage = m_direct_stage;
+    bool head = pos != abegin;
+    bool tail = end != aend && !(head && aend - A == abegin);
+    if (head) { loadDirectBlock(stage, abegin); }
+    if (tail) { loadDirectBlock(stage + (aend - A - abegin), aend - A); }
+    memcpy(stage + (pos - abegin), block.data.data(), block.data.size());
+    preallocate(aend);
+
+    int err = WriteAll(m_fd, abegin, stage, size_t(aend - abegin));
+    if (err) {
+        setError(err);
+        return false;
+    }
+
+    m_direct_size = std::max(m_direct_size, end);
+    uint64_t last = m_direct_size / A * A;
+    if (m_direct_size != last && last >= abegin && last < aend) {
+        memcpy(m_direct_tail.data(), stage + (last - abegin), A);
+    }
+    return true;
+}
+
+// dst: aligned. pos: offset of an aligned block
+void FileStream::loadDirectBlock(char *dst, uint64_t pos)
+{
+    const uint64_t A = DirectIOAlignment;
+    uint64_t last = m_direct_size / A * A;
+    if (pos == last && m_direct_size != last) {
+        // the last partial block. sequential writes always come here, so no read is needed
+        memcpy(dst, m_direct_tail.data(), A);
+        return;
+    }
+
+    int64_t r = 0;
+    if (pos < m_direct_size) {
+        r = ReadAt(m_fd, pos, dst, A);
+        if (r < 0) { r = 0; }
+    }
+    if ((uint64_t)r < A) {
+        memset(dst + r, 0, size_t(A - r));
+    }
+}
+
+// reserve disk space in chunks, so that the file is less fragmented and writes don't allocate blocks one by one.
+// preallocated space beyond the end of data is freed on close.
+void FileStream::preallocate(uint64_t end)
+{
+#ifdef __linux__
+    if (m_conf.preallocate_size > 0 && end > m_preallocated) {
+        uint64_t chunk = m_conf.preallocate_size;
+        uint64_t size = (end + chunk - 1) / chunk * chunk;
+        if (::fallocate(m_fd, FALLOC_FL_KEEP_SIZE, (off_t)m_preallocated, (off_t)(size - m_preallocated)) == 0) {
+            m_preallocated = size;
+        }
+        else {
+            // not supported by the file system
+            m_conf.preallocate_size = 0;
+        }
+    }
+#endif
+}
+
+
+bool FileStream::initializeRing()
+{
+    m_ring.reset(new IOUring());
+    if (!m_ring->initialize(m_conf.num_buffers)) {
+        fcDebugLog("FileStream: io_uring is not available. using the I/O thread instead\n");
+        m_ring.reset();
+        return false;
+    }
+
+    int n = m_conf.num_buffers;
+    m_free.resize(n - 1);
+    for (auto& buf : m_free) { buf.reserve(m_conf.buffer_size); }
+    m_num_buffers = n;
+    m_ring_blocks.resize(n);
+    m_ring_addrs.push_back(m_current.data.data());
+    for (auto& buf : m_free) { m_ring_addrs.push_back(buf.data()); }
+
+    // registered buffers save page pinning on every write. fails if memlock limit is small, then plain writes are used
+    std::vector<size_t> sizes(n, m_conf.buffer_size);
+    m_ring_registered = m_ring->registerBuffers(m_ring_addrs.data(), sizes.data(), n);
+    return true;
+}
+
+void FileStream::submitRing()
+{
+    fcTraceScope("FileStream::submitRing");
+    size_t index = std::find(m_ring_addrs.begin(), m_ring_addrs.end(), (void*)m_current.data.data()) - m_ring_addrs.begin();
+    bool queued = false;
+    if (index < m_ring_blocks.size() && !m_ring_failed) {
+        auto& block = m_ring_blocks[index];
+        block.data.swap(m_current.data);
+        block.pos = m_current.pos;
+
+        uint64_t end = block.pos + block.data.size();
+        preallocate(end);
+        // io_uring doesn't keep order of writes. overwrites of earlier data (header patch-ups) wait for preceding writes.
+        bool drain = block.pos < m_ring_end;
+        m_ring_end = std::max(m_ring_end, end);
+        queued = m_ring->write(m_fd, block.data.data(), block.data.size(), block.pos, m_ring_registered ? (int)index : -1, index, drain) &&
+            m_ring->submit();
+        if (queued) {
+            ++m_ring_inflight;
+        }
+        else {
+            m_current.data.swap(block.data);
+        }
+    }
+    if (!queued) {
+        // the ring failed. write synchronously after preceding writes
+        reapRing(0);
+        writeBlock(m_current);
+        m_current.data.clear();
+        return;
+    }
+
+    reapRing(m_num_buffers - 1);
+    if (m_free.empty()) {
+        // waiting for completion failed
+        m_free.emplace_back();
+        m_free.back().reserve(m_conf.buffer_size);
+    }
+    m_current.data.swap(m_free.back());
+    m_current.data.clear();
+    m_free.pop_back();
+}
+
+// take completions until in-flight writes <= max_inflight
+void FileStream::reapRing(int max_inflight)
+{
+    for (;;) {
+        uint64_t index;
+        int result;
+        while (m_ring->peek(index, result)) {
+            auto& block = m_ring_blocks[index];
+            if (result < 0) {
+                // write it synchronously instead, and don't use the ring any more. if the error persists (e.g. ENOSPC),
+                // writeBlock() fails too and keeps the error for flush() / fcFileStreamGetError()
+                fcDebugLog("FileStream::reapRing(): write failed (errno %d). writing synchronously\n", -result);
+                m_ring_failed = true;
+                writeBlock(block);
+            }
+            else if ((size_t)result < block.data.size()) {
+                Block rest;
+                rest.pos = block.pos + result;
+                rest.data.assign(block.data.data() + result, block.data.size() - result);
+                writeBlock(rest);
+            }
+            m_free.emplace_back();
+            m_free.back().swap(block.data);
+            --m_ring_inflight;
+        }
+        if (m_ring_inflight <= max_inflight) { break; }
+        fcTraceScope("FileStream::reapRing (wait)");
+        if (!m_ring->submit(1)) { break; }
+    }
+}
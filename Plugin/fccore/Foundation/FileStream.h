@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include "Buffer.h"
+#include "RingQueue.h"
+#include "IOUring.h"
+
+
+// BinaryStream on a native file descriptor, for fcCreateBufferedFileStream().
+// small writes (operator<<) are packed into a write-behind buffer without going through iostream.
+// full buffers are written to the file by a background I/O thread, so encoder threads don't wait for the disk.
+// every buffer carries its file offset, so seekp() (header patch-ups of mp4 / wave) just starts a new buffer at that offset.
+// buffers are written in order, so later data always overwrites earlier one.
+// with use_io_uring (linux), the writer queues buffers to io_uring by itself instead of handing them to the I/O thread.
+// with direct_io, data bypasses the page cache (linux: O_DIRECT, mac: F_NOCACHE). O_DIRECT needs aligned offset and size,
+// so the I/O thread merges unaligned edges of each buffer with the file contents and writes whole blocks. the padding
+// past the end of data is truncated on close.
+class FileStream : public BinaryStream
+{
+public:
+    FileStream(const char *path, const fcFileStreamConfig& conf);
+    ~FileStream() override;
+    bool isValid() const;
+
+    // reads flush pending writes first
+    size_t  tellg() override;
+    void    seekg(size_t pos) override;
+    size_t  read(void *dst, size_t len) override;
+
+    size_t  tellp() override;
+    void    seekp(size_t pos) override;
+    size_t  write(const void *data, size_t len) override;
+    size_t  writev(const IOVec *vecs, int num) override;
+
+    // wait until all written data reaches the file. return false if any write has failed
+    bool flush();
+    // errno of the first failed write, or 0. once set, write() rejects data and returns 0
+    int getError() const;
+    // false if use_io_uring is not set or io_uring is not available
+    bool isIOUringEnabled() const { return m_ring != nullptr; }
+    // false if direct_io is not set or O_DIRECT is not supported (e.g. tmpfs)
+    bool isDirectIOEnabled() const { return m_direct; }
+
+private:
+    using Lock = std::unique_lock<std::mutex>;
+    struct Block
+    {
+        Buffer data;
+        uint64_t pos = 0; // file offset of data[0]
+    };
+
+    void append(const char *data, size_t len);
+    void setError(int err);
+    void submit();
+    void process();
+    bool writeBlock(const Block& block);
+    bool writeBlockDirect(const Block& block);
+    void loadDirectBlock(char *dst, uint64_t pos);
+    void preallocate(uint64_t end);
+    bool initializeRing();
+    void submitRing();
+    void reapRing(int max_inflight);
+
+    fcFileStreamConfig m_conf;
+    std::string m_path;
+    int m_fd = -1; // CRT file descriptor on Windows
+    int m_read_fd = -1; // for read() in direct I/O mode
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    RingQueue<Block> m_pending; // waiting for the I/O thread
+    std::vector<Buffer> m_free;
+    int m_num_buffers = 0;      // allocated buffers
+    bool m_writing = false;     // the I/O thread is writing a block
+    bool m_stop = false;
+    std::atomic_int m_error = { 0 };
+    uint64_t m_preallocated = 0; // touched only by the I/O thread (the writer in io_uring mode)
+
+    // direct I/O mode. touched only by the I/O thread
+    bool m_direct = false;
+    char *m_direct_stage = nullptr; // aligned. buffer_size + 2 blocks
+    Buffer m_direct_tail;           // contents of the last partial block, for the next sequential write
+    uint64_t m_direct_size = 0;     // end of data written to the file
+
+    // io_uring mode. buffers are allocated up front and registered, so their storage never moves
+    std::unique_ptr<IOUring> m_ring;
+    std::vector<Block> m_ring_blocks;   // in flight. same index as m_ring_addrs
+    std::vector<void*> m_ring_addrs;
+    bool m_ring_registered = false;
+    bool m_ring_failed = false;         // a write failed. the rest is written synchronously
+    int m_ring_inflight = 0;
+    uint64_t m_ring_end = 0;            // end of queued writes
+
+    // these are touched only by the writer (caller of write() / seekp())
+    Block m_current;
+    uint64_t m_wpos = 0;
+    uint64_t m_rpos = 0;
+    uint64_t m_file_size = 0;   // end of written data
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "ThreadPool.h"
+#include "RingQueue.h"
+#include "MemoryBudget.h"
+#include "SpillQueue.h"
+
+
+// frame buffers shared between the game thread (producer) and an encoder task (consumer), with backpressure policy.
+// producer: acquire() -> fill -> push(). consumer: pop() -> encode -> release().
+// frames that are handed to tasks directly can skip push() / pop() and just release() when done.
+// acquired frames are charged to the global MemoryBudget until released.
+// with fcBackpressurePolicy::Spill, frames acquire() rejects go to spill() and come back from popSpilled() in order.
+template<class T>
+class FrameQueue
+{
+public:
+    using Lock = std::unique_lock<std::mutex>;
+    using FramePtr = std::unique_ptr<T>;
+
+    FrameQueue() {}
+    ~FrameQueue()
+    {
+        for (auto c : m_charges) { MemoryBudget::getInstance().release(c, nullptr); }
+    }
+
+    // memory_limit: max total size of frames in bytes. used by fcBackpressurePolicy::Grow
+    void setPolicy(fcBackpressurePolicy policy, size_t memory_limit)
+    {
+        Lock l(m_mutex);
+        m_policy = policy;
+        m_memory_limit = memory_limit;
+    }
+
+    // memory usage of frames is accumulated to stats. must be set before acquire()
+    void setContextStats(ContextStats *v) { m_context_stats = v; }
+
+    template<typename ...Params>
+    void emplace(Params&&... params)
+    {
+        Lock l(m_mutex);
+        m_frames.emplace_back(new T(std::forward<Params>(params)...));
+        m_charges.push_back(0);
+        m_free.push_back(m_frames.back().get());
+    }
+
+    // frame_size: approximate memory size of one frame. return nullptr if the frame should be dropped (or spilled).
+    T* acquire(size_t frame_size)
+    {
+        Lock l(m_mutex);
+        ++m_stats.frames;
+        if (m_policy == fcBackpressurePolicy::Spill && !m_spill.empty()) {
+            // keep order. frames go to the spill file until the consumer catches up
+            return nullptr;
+        }
+        if (m_free.empty()) {
+            switch (m_policy) {
+            case fcBackpressurePolicy::Grow:
+                if ((m_frames.size() + 1) * frame_size <= m_memory_limit) {
+                    m_frames.emplace_back(new T());
+                    m_charges.push_back(0);
+                    m_free.push_back(m_frames.back().get());
+                }
+                break;
+            case fcBackpressurePolicy::DropOldest:
+                if (!m_pending.empty()) {
+                    dropOldest();
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        if (m_free.empty()) {
+            if (m_policy == fcBackpressurePolicy::Block) {
+                ++m_stats.late_frames;
+                while (m_free.empty()) {
+                    l.unlock();
+                    ThreadPool::getInstance().waitUntil(m_mutex, m_condition, [this]() { return !m_free.empty(); });
+                    l.lock();
+                }
+            }
+            else {
+                return reject();
+            }
+        }
+
+        T *ret = m_free.back();
+        m_free.pop_back();
+        if (!chargeBudget(l, frame_size)) {
+            m_free.push_back(ret);
+            return reject();
+        }
+        chargeOf(ret) = frame_size;
+        return ret;
+    }
+
+    // queue frame for the consumer
+    void push(T *v)
+    {
+        Lock l(m_mutex);
+        m_pending.push_back(v);
+    }
+
+    // take oldest queued frame. return nullptr if it was dropped.
+    T* pop()
+    {
+        Lock l(m_mutex);
+        if (m_pending.empty()) { return nullptr; }
+        T *ret = m_pending.front();
+        m_pending.pop_front();
+        return ret;
+    }
+
+    // store a frame rejected by acquire() to the spill file. return false if it should be dropped (policy is not Spill or write failed).
+    // the caller must kick a consumer task for it, as with push().
+    bool spill(const SpillQueue::Header& header, const void *pixels)
+    {
+        {
+            Lock l(m_mutex);
+            if (m_policy != fcBackpressurePolicy::Spill) { return false; }
+        }
+        bool ok = m_spill.push(header, pixels);
+        Lock l(m_mutex);
+        if (ok) { ++m_stats.spilled_frames; }
+        else    { ++m_stats.dropped_frames; }
+        return ok;
+    }
+
+    // take oldest spilled frame. consumers should try pop() first.
+    bool popSpilled(SpillQueue::Header& header, Buffer& dst)
+    {
+        return m_spill.pop(header, dst);
+    }
+
+    bool hasSpilled() { return !m_spill.empty(); }
+
+    void release(T *v)
+    {
+        {
+            Lock l(m_mutex);
+            m_free.push_back(v);
+            releaseBudget(v);
+        }
+        m_condition.notify_one();
+    }
+
+    fcFrameStats getStats()
+    {
+        Lock l(m_mutex);
+        return m_stats;
+    }
+
+private:
+    // these require m_mutex locked
+    T* reject()
+    {
+        // Spill: the caller writes the frame to spill() instead
+        if (m_policy != fcBackpressurePolicy::Spill) {
+            ++m_stats.dropped_frames;
+        }
+        return nullptr;
+    }
+
+    size_t& chargeOf(T *v)
+    {
+        size_t i = 0;
+        while (m_frames[i].get() != v) { ++i; }
+        return m_charges[i];
+    }
+
+    void releaseBudget(T *v)
+    {
+        auto& charge = chargeOf(v);
+        MemoryBudget::getInstance().release(charge, m_context_stats);
+        charge = 0;
+    }
+
+    void dropOldest()
+    {
+        T *v = m_pending.front();
+        m_pending.pop_front();
+        m_free.push_back(v);
+        releaseBudget(v);
+        ++m_stats.dropped_frames;
+    }
+
+    // apply backpressure policy if the frame doesn't fit in the global memory budget
+    bool chargeBudget(Lock& l, size_t size)
+    {
+        auto& budget = MemoryBudget::getInstance();
+        if (budget.charge(size, false, m_context_stats)) { return true; }
+
+        switch (m_policy) {
+        case fcBackpressurePolicy::Block:
+            ++m_stats.late_frames;
+            l.unlock();
+            budget.charge(size, true, m_context_stats);
+            l.lock();
+            return true;
+        case fcBackpressurePolicy::DropOldest:
+            while (!m_pending.empty()) {
+                dropOldest();
+                if (budget.charge(size, false, m_context_stats)) { return true; }
+            }
+            return false;
+        default:
+            return false;
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<FramePtr> m_frames;
+    std::vector<size_t> m_charges; // bytes charged to MemoryBudget. same index as m_frames
+    std::vector<T*> m_free;
+    RingQueue<T*> m_pending;
+    fcBackpressurePolicy m_policy = fcBackpressurePolicy::Block;
+    size_t m_memory_limit = 0;
+    fcFrameStats m_stats;
+    ContextStats *m_context_stats = nullptr;
+    SpillQueue m_spill;
+};
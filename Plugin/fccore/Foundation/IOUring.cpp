@@ -0,0 +1,170 @@
+#include "pch.h"
+#include "fcInternal.h"
+#include "IOUring.h"
+
+// needs linux 5.6+ headers (IORING_OP_WRITE, IORING_REGISTER_PROBE). with older ones initialize() just returns false
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        #ifdef IO_URING_OP_SUPPORTED
+            #define fcEnableIOUring
+        #endif
+    #endif
+#endif
+#ifdef fcEnableIOUring
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <sys/uio.h>
+    #include <unistd.h>
+#endif
+
+
+IOUring::IOUring()
+{
+}
+
+#ifdef fcEnableIOUring
+
+namespace {
+    template<class T> inline T* Offset(void *base, uint32_t offset) { return (T*)((char*)base + offset); }
+}
+
+IOUring::~IOUring()
+{
+    if (m_sqes) { ::munmap(m_sqes, m_sqes_size); }
+    if (m_cq_ring && m_cq_ring != m_sq_ring) { ::munmap(m_cq_ring, m_cq_ring_size); }
+    if (m_sq_ring) { ::munmap(m_sq_ring, m_sq_ring_size); }
+    if (m_fd != -1) { ::close(m_fd); }
+}
+
+bool IOUring::initialize(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_fd = (int)::syscall(__NR_io_uring_setup, entries, &params);
+    if (m_fd < 0) {
+        m_fd = -1;
+        return false;
+    }
+    if (!probe()) { return false; }
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+    }
+
+    void *sq = ::mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) { return false; }
+    m_sq_ring = sq;
+    if (single_mmap) {
+        m_cq_ring = m_sq_ring;
+    }
+    else {
+        void *cq = ::mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) { return false; }
+        m_cq_ring = cq;
+    }
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = ::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) { return false; }
+    m_sqes = sqes;
+
+    m_sq_head   = Offset<unsigned>(m_sq_ring, params.sq_off.head);
+    m_sq_tail   = Offset<unsigned>(m_sq_ring, params.sq_off.tail);
+    m_sq_array  = Offset<unsigned>(m_sq_ring, params.sq_off.array);
+    m_sq_mask   = *Offset<unsigned>(m_sq_ring, params.sq_off.ring_mask);
+    m_sq_entries = params.sq_entries;
+    m_cq_head   = Offset<unsigned>(m_cq_ring, params.cq_off.head);
+    m_cq_tail   = Offset<unsigned>(m_cq_ring, params.cq_off.tail);
+    m_cqes      = Offset<void>(m_cq_ring, params.cq_off.cqes);
+    m_cq_mask   = *Offset<unsigned>(m_cq_ring, params.cq_off.ring_mask);
+    return true;
+}
+
+// setup succeeds on linux 5.1 - 5.5, but IORING_OP_WRITE came with 5.6 and every write fails with -EINVAL there.
+// IORING_REGISTER_PROBE came with 5.6 too, so if the probe itself fails, writes aren't supported either.
+bool IOUring::probe()
+{
+    std::vector<char> buf(sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op));
+    auto *p = (io_uring_probe*)buf.data();
+    if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, p, IORING_OP_LAST) < 0) { return false; }
+
+    auto supported = [p](int op) { return op <= p->last_op && (p->ops[op].flags & IO_URING_OP_SUPPORTED) != 0; };
+    return supported(IORING_OP_WRITE) && supported(IORING_OP_WRITE_FIXED);
+}
+
+bool IOUring::registerBuffers(void *const *addrs, const size_t *sizes, int num)
+{
+    std::vector<iovec> iov(num);
+    for (int i = 0; i < num; ++i) {
+        iov[i].iov_base = addrs[i];
+        iov[i].iov_len = sizes[i];
+    }
+    return ::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, iov.data(), num) == 0;
+}
+
+bool IOUring::write(int fd, const void *data, size_t size, uint64_t pos, int buf_index, uint64_t user_data, bool drain)
+{
+    unsigned tail = *m_sq_tail;
+    if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries) {
+        // queue is full. let the kernel consume it
+        if (!submit()) { return false; }
+        if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries) { return false; }
+    }
+
+    unsigned index = tail & m_sq_mask;
+    auto& sqe = ((io_uring_sqe*)m_sqes)[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = buf_index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe.flags = drain ? IOSQE_IO_DRAIN : 0;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)(uintptr_t)data;
+    sqe.len = (uint32_t)size;
+    sqe.off = pos;
+    sqe.buf_index = buf_index >= 0 ? (uint16_t)buf_index : 0;
+    sqe.user_data = user_data;
+    m_sq_array[index] = index;
+    __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++m_to_submit;
+    return true;
+}
+
+bool IOUring::submit(unsigned wait_nr)
+{
+    for (;;) {
+        unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+        int r = (int)::syscall(__NR_io_uring_enter, m_fd, m_to_submit, wait_nr, flags, nullptr, 0);
+        if (r < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        m_to_submit -= std::min<unsigned>(m_to_submit, (unsigned)r);
+        return true;
+    }
+}
+
+bool IOUring::peek(uint64_t& user_data, int& result)
+{
+    unsigned head = *m_cq_head;
+    if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) { return false; }
+
+    auto& cqe = ((io_uring_cqe*)m_cqes)[head & m_cq_mask];
+    user_data = cqe.user_data;
+    result = cqe.res;
+    __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#else // fcEnableIOUring
+
+IOUring::~IOUring() {}
+bool IOUring::initialize(unsigned) { return false; }
+bool IOUring::probe() { return false; }
+bool IOUring::registerBuffers(void *const *, const size_t *, int) { return false; }
+bool IOUring::write(int, const void *, size_t, uint64_t, int, uint64_t, bool) { return false; }
+bool IOUring::submit(unsigned) { return false; }
+bool IOUring::peek(uint64_t&, int&) { return false; }
+
+#endif // fcEnableIOUring
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+
+// minimal io_uring (linux) on raw system calls, for async file writes without liburing.
+// on other platforms (or kernels / headers older than linux 5.6, or io_uring disabled by sysctl / seccomp) initialize() returns false.
+// not thread safe: one thread queues, submits and reaps.
+class IOUring
+{
+public:
+    IOUring();
+    ~IOUring();
+    IOUring(const IOUring&) = delete;
+    IOUring& operator=(const IOUring&) = delete;
+
+    bool initialize(unsigned entries);
+    // register buffers for IORING_OP_WRITE_FIXED. fails if the memlock limit is too small
+    bool registerBuffers(void *const *addrs, const size_t *sizes, int num);
+
+    // queue a write. buf_index: index of registered buffer, or -1.
+    // drain: start after all previously queued writes complete (for overwrites of earlier data)
+    bool write(int fd, const void *data, size_t size, uint64_t pos, int buf_index, uint64_t user_data, bool drain);
+    // submit queued writes and wait until at least wait_nr completions are available
+    bool submit(unsigned wait_nr = 0);
+    // take one completion. result: bytes written or -errno. return false if none
+    bool peek(uint64_t& user_data, int& result);
+
+private:
+    bool probe();
+
+    int m_fd = -1;
+    void *m_sq_ring = nullptr;
+    void *m_cq_ring = nullptr;
+    void *m_sqes = nullptr;
+    size_t m_sq_ring_size = 0;
+    size_t m_cq_ring_size = 0;
+    size_t m_sqes_size = 0;
+
+    unsigned *m_sq_head = nullptr;
+    unsigned *m_sq_tail = nullptr;
+    unsigned *m_sq_array = nullptr;
+    unsigned m_sq_mask = 0;
+    unsigned m_sq_entries = 0;
+    unsigned *m_cq_head = nullptr;
+    unsigned *m_cq_tail = nullptr;
+    void *m_cqes = nullptr;
+    unsigned m_cq_mask = 0;
+    unsigned m_to_submit = 0;
+};
@@ -0,0 +1,67 @@
+#include "pch.h"
+#include "fcInternal.h"
+#include "MemoryBudget.h"
+#include "ThreadPool.h"
+#include "Stats.h"
+
+
+MemoryBudget& MemoryBudget::getInstance()
+{
+    static MemoryBudget s_instance;
+    return s_instance;
+}
+
+void MemoryBudget::setBudget(uint64_t v)
+{
+    {
+        Lock l(m_mutex);
+        m_budget = v;
+    }
+    m_condition.notify_all();
+}
+
+bool MemoryBudget::fits(size_t size) const
+{
+    uint64_t budget = m_budget;
+    uint64_t usage = m_usage;
+    return budget == 0 || usage == 0 || usage + size <= budget;
+}
+
+void MemoryBudget::add(size_t size, ContextStats *stats)
+{
+    uint64_t usage = m_usage += size;
+    if (usage > m_peak_usage) { m_peak_usage = usage; }
+    if (stats) { stats->onCharge(size); }
+}
+
+bool MemoryBudget::charge(size_t size, bool block, ContextStats *stats)
+{
+    for (;;) {
+        {
+            Lock l(m_mutex);
+            if (fits(size)) {
+                add(size, stats);
+                return true;
+            }
+        }
+        if (!block) { return false; }
+        ThreadPool::getInstance().waitUntil(m_mutex, m_condition, [this, size]() { return fits(size); });
+    }
+}
+
+void MemoryBudget::forceCharge(size_t size, ContextStats *stats)
+{
+    Lock l(m_mutex);
+    add(size, stats);
+}
+
+void MemoryBudget::release(size_t size, ContextStats *stats)
+{
+    if (size == 0) { return; }
+    {
+        Lock l(m_mutex);
+        m_usage -= size;
+        if (stats) { stats->onRelease(size); }
+    }
+    m_condition.notify_all();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+class ContextStats;
+
+
+// process-wide budget of frame data held by contexts: frames waiting for or being encoded,
+// and encoded data waiting to be written. contexts charge it before they take a new frame, and apply their
+// backpressure policy if it doesn't fit.
+class MemoryBudget
+{
+public:
+    static MemoryBudget& getInstance();
+
+    // 0: unlimited
+    void setBudget(uint64_t v);
+    uint64_t getBudget() const      { return m_budget; }
+    uint64_t getUsage() const       { return m_usage; }
+    uint64_t getPeakUsage() const   { return m_peak_usage; }
+
+    // charge size if it fits in the budget. if block is true, wait until it fits instead of failing.
+    // size always fits if nothing is charged, so that a budget smaller than one frame doesn't stall forever.
+    // stats (can be null) accumulates usage of the context.
+    bool charge(size_t size, bool block, ContextStats *stats);
+    // charge regardless of the budget. for data that can't be dropped (e.g. encoded frames waiting to be muxed)
+    void forceCharge(size_t size, ContextStats *stats);
+    void release(size_t size, ContextStats *stats);
+
+private:
+    using Lock = std::unique_lock<std::mutex>;
+    bool fits(size_t size) const; // m_mutex must be locked
+    void add(size_t size, ContextStats *stats); // m_mutex must be locked
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::atomic<uint64_t> m_budget = { 0 };
+    std::atomic<uint64_t> m_usage = { 0 };
+    std::atomic<uint64_t> m_peak_usage = { 0 };
+};
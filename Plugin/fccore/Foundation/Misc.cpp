@@ -104,8 +104,8 @@ double GetCurrentTimeInSeconds()
     return double(t.QuadPart) / double(g_freq.QuadPart);
 #else
     timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    return (double)ts.tv_nsec / 1000000000.0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
 #endif
 }
 
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+
+// callbacks registered by fcMP4AddPacketCallback() / fcWebMAddPacketCallback().
+// contexts pass encoded packets here in addition to (or instead of) their container writers.
+// video and audio are encoded on separate threads, so calls are serialized here to spare the callbacks from locking.
+class PacketSinks
+{
+public:
+    void add(fcPacketCallback cb, void *userdata)
+    {
+        if (!cb) { return; }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sinks.push_back({ cb, userdata });
+    }
+
+    bool empty() const { return m_sinks.empty(); }
+
+    // passes a packet to all sinks. only valid inside emitEach()
+    struct Emit
+    {
+        PacketSinks *self;
+        void operator()(const fcPacket& p) const
+        {
+            for (auto& s : self->m_sinks) { s.cb(s.userdata, &p); }
+        }
+    };
+
+    // Body: [](const PacketSinks::Emit& emit) -> void. calls emit() for each packet of a frame.
+    // the lock is held over the whole frame, so its packets are not interleaved with the other track's.
+    template<class Body>
+    void emitEach(const Body& body)
+    {
+        if (m_sinks.empty()) { return; }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        body(Emit{ this });
+    }
+
+private:
+    struct Sink
+    {
+        fcPacketCallback cb;
+        void *userdata;
+    };
+    std::mutex m_mutex;
+    std::vector<Sink> m_sinks;
+};
@@ -298,6 +298,7 @@ const void* fcConvertPixelFormat_ISPC(void *dst, fcPixelFormat dstfmt, const voi
 
 fcAPI const void* fcConvertPixelFormat(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size)
 {
+    fcTraceScope("fcConvertPixelFormat");
     return fcConvertPixelFormat_ISPC(dst, dstfmt, src, srcfmt, size);
 }
 
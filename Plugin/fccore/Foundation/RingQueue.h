@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+
+
+// FIFO queue on a growable ring buffer. unlike std::deque, storage is kept and reused,
+// so push_back() / pop_front() don't allocate once the queue has grown to its peak size. not thread safe.
+template<class T>
+class RingQueue
+{
+public:
+    bool empty() const  { return m_size == 0; }
+    size_t size() const { return m_size; }
+    T& front()          { return m_items[m_head]; }
+    const T& front() const { return m_items[m_head]; }
+    T& back()           { return m_items[(m_head + m_size - 1) & (m_items.size() - 1)]; }
+    const T& back() const { return m_items[(m_head + m_size - 1) & (m_items.size() - 1)]; }
+
+    void push_back(T&& v)
+    {
+        if (m_size == m_items.size()) { grow(); }
+        m_items[(m_head + m_size) & (m_items.size() - 1)] = std::move(v);
+        ++m_size;
+    }
+
+    void push_back(const T& v)
+    {
+        T tmp(v);
+        push_back(std::move(tmp));
+    }
+
+    void pop_front()
+    {
+        m_items[m_head] = T(); // release resources the item holds
+        m_head = (m_head + 1) & (m_items.size() - 1);
+        --m_size;
+    }
+
+private:
+    void grow()
+    {
+        // capacity is kept power of two
+        std::vector<T> items(m_items.empty() ? 16 : m_items.size() * 2);
+        for (size_t i = 0; i < m_size; ++i) {
+            items[i] = std::move(m_items[(m_head + i) & (m_items.size() - 1)]);
+        }
+        m_items.swap(items);
+        m_head = 0;
+    }
+
+    std::vector<T> m_items;
+    size_t m_head = 0;
+    size_t m_size = 0;
+};
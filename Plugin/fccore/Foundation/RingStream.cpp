@@ -0,0 +1,147 @@
+#include "pch.h"
+#include "fcInternal.h"
+#include "RingStream.h"
+#include "Trace.h"
+
+
+RingStream::RingStream(size_t capacity, fcSinkLagPolicy lag_policy)
+    : m_lag_policy(lag_policy)
+{
+    m_buf.resize(std::max<size_t>(capacity, 4096));
+}
+
+size_t RingStream::tellp()
+{
+    return (size_t)m_wpos;
+}
+
+void RingStream::seekp(size_t pos)
+{
+    Lock l(m_mutex);
+    m_wpos = std::min<uint64_t>(pos, m_end);
+}
+
+size_t RingStream::write(const void *data_, size_t len)
+{
+    fcTraceScope("RingStream::write");
+    auto data = (const char*)data_;
+    size_t remaining = len;
+
+    Lock l(m_mutex);
+    if (m_closed) {
+        // discarded. only the position moves
+        m_wpos += len;
+        return 0;
+    }
+
+    // overwrite of written bytes. only the part the consumer hasn't seen can be changed
+    if (m_wpos < m_end) {
+        size_t n = (size_t)std::min<uint64_t>(remaining, m_end - m_wpos);
+        if (m_wpos < m_peeked) {
+            size_t skip = (size_t)std::min<uint64_t>(n, m_peeked - m_wpos);
+            m_dropped_patch_bytes += skip;
+            copyIn(m_wpos + skip, data + skip, n - skip);
+        }
+        else {
+            copyIn(m_wpos, data, n);
+        }
+        data += n;
+        m_wpos += n;
+        remaining -= n;
+    }
+
+    // append. data larger than the free space goes in pieces as the consumer advances
+    while (remaining > 0) {
+        size_t space = m_buf.size() - (size_t)(m_end - m_read);
+        if (space == 0) {
+            if (m_lag_policy == fcSinkLagPolicy::Detach) {
+                fcDebugLog("RingStream::write(): the ring is full. detached\n");
+                m_closed = true;
+                m_condition.notify_all();
+            }
+            else {
+                fcTraceScope("RingStream::write (wait)");
+                // a plain wait as in AsyncStream::write(): the writer may hold its context's lock
+                m_condition.wait(l, [this]() { return m_closed || m_end - m_read < m_buf.size(); });
+            }
+            if (m_closed) {
+                m_wpos += remaining;
+                break;
+            }
+            continue;
+        }
+        size_t n = std::min<size_t>(remaining, space);
+        copyIn(m_end, data, n);
+        m_end += n;
+        m_wpos = m_end;
+        data += n;
+        remaining -= n;
+        m_condition.notify_all();
+    }
+    // bytes discarded by close() are not counted
+    return addWrittenBytes(len - remaining);
+}
+
+uint64_t RingStream::getPendingBytes() const
+{
+    Lock l(m_mutex);
+    return m_end - m_read;
+}
+
+bool RingStream::peek(fcBufferData& dst, int timeout_ms)
+{
+    Lock l(m_mutex);
+    auto ready = [this]() { return m_closed || m_end > m_read; };
+    if (timeout_ms < 0) {
+        m_condition.wait(l, ready);
+    }
+    else if (!m_condition.wait_for(l, std::chrono::milliseconds(timeout_ms), ready)) {
+        return false;
+    }
+    if (m_end == m_read) { return false; } // closed and drained
+
+    size_t offset = (size_t)(m_read % m_buf.size());
+    size_t n = (size_t)std::min<uint64_t>(m_end - m_read, m_buf.size() - offset);
+    dst.data = m_buf.data() + offset;
+    dst.size = n;
+    m_peeked = std::max(m_peeked, m_read + n);
+    return true;
+}
+
+void RingStream::advance(size_t n)
+{
+    {
+        Lock l(m_mutex);
+        m_read += std::min<uint64_t>(n, m_end - m_read);
+        m_peeked = std::max(m_peeked, m_read);
+    }
+    m_condition.notify_all();
+}
+
+void RingStream::close()
+{
+    {
+        Lock l(m_mutex);
+        m_closed = true;
+    }
+    m_condition.notify_all();
+}
+
+uint64_t RingStream::getDroppedPatchBytes() const
+{
+    Lock l(m_mutex);
+    return m_dropped_patch_bytes;
+}
+
+// m_mutex must be locked
+void RingStream::copyIn(uint64_t pos, const char *data, size_t len)
+{
+    while (len > 0) {
+        size_t offset = (size_t)(pos % m_buf.size());
+        size_t n = std::min<size_t>(len, m_buf.size() - offset);
+        memcpy(m_buf.data() + offset, data, n);
+        pos += n;
+        data += n;
+        len -= n;
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include "Buffer.h"
+
+
+// BinaryStream on a fixed-size ring buffer, for fcCreateRingStream().
+// the writer (a context) appends, and a consumer thread takes the bytes in place by peek() / advance().
+// while the ring is full, write() waits (fcSinkLagPolicy::Block) or closes the stream (Detach).
+// close() ends the stream: the consumer drains what is left and later writes are discarded.
+// backward seekp() + write() (container header patch-ups) can only change bytes the consumer hasn't peeked yet.
+// bytes peeked or consumed already are left as they are, and the skipped bytes are counted in getDroppedPatchBytes().
+class RingStream : public BinaryStream
+{
+public:
+    RingStream(size_t capacity, fcSinkLagPolicy lag_policy = fcSinkLagPolicy::Block);
+
+    // the consumer side reads by peek() / advance()
+    size_t  tellg() override { return 0; }
+    void    seekg(size_t /*pos*/) override {}
+    size_t  read(void* /*dst*/, size_t /*len*/) override { return 0; }
+
+    size_t  tellp() override;
+    void    seekp(size_t pos) override;
+    size_t  write(const void *data, size_t len) override;
+    uint64_t getPendingBytes() const override;
+
+    // contiguous readable bytes from the read cursor. timeout_ms: -1 waits forever.
+    // return false if nothing is readable in time, or the stream is closed and drained
+    bool peek(fcBufferData& dst, int timeout_ms);
+    void advance(size_t n);
+    void close();
+    uint64_t getDroppedPatchBytes() const;
+
+private:
+    using Lock = std::unique_lock<std::mutex>;
+
+    void copyIn(uint64_t pos, const char *data, size_t len);
+
+    Buffer m_buf;
+    fcSinkLagPolicy m_lag_policy;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    // absolute offsets in the stream. m_read <= m_peeked <= m_end, and m_end - m_read <= capacity
+    uint64_t m_read = 0;    // consumer cursor
+    uint64_t m_peeked = 0;  // end of bytes handed out by peek(). patches never go below this
+    uint64_t m_end = 0;     // end of written bytes
+    uint64_t m_dropped_patch_bytes = 0;
+    bool m_closed = false;
+
+    // touched only by the writer
+    uint64_t m_wpos = 0;
+};
@@ -0,0 +1,247 @@
+#include "pch.h"
+#include "fcInternal.h"
+#include "SpillQueue.h"
+#include "BufferPool.h"
+#include "Trace.h"
+
+#ifdef fcWindows
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+    const uint64_t RecordAlignment = 64;
+    const uint64_t MinFileSize = 64 * 1024 * 1024;
+    const uint64_t FileSizeGranularity = 64 * 1024; // allocation granularity of file mapping on Windows
+
+    struct RecordHeader
+    {
+        SpillQueue::Header header;
+        uint32_t name_size;
+    };
+
+    inline uint64_t RoundUp(uint64_t v, uint64_t a) { return (v + a - 1) / a * a; }
+
+    std::mutex g_spill_dir_mutex;
+    std::string g_spill_dir;
+    std::atomic_int g_spill_file_count = { 0 };
+}
+
+void SetSpillDirectory(const char *path)
+{
+    std::unique_lock<std::mutex> l(g_spill_dir_mutex);
+    g_spill_dir = path ? path : "";
+}
+
+std::string GetSpillDirectory()
+{
+    {
+        std::unique_lock<std::mutex> l(g_spill_dir_mutex);
+        if (!g_spill_dir.empty()) { return g_spill_dir; }
+    }
+#ifdef fcWindows
+    char buf[MAX_PATH + 1];
+    DWORD len = ::GetTempPathA(sizeof(buf), buf);
+    return len > 0 ? std::string(buf, len) : std::string(".");
+#else
+    const char *tmp = getenv("TMPDIR");
+    return tmp && *tmp ? tmp : "/tmp";
+#endif
+}
+
+
+SpillQueue::SpillQueue()
+{
+}
+
+SpillQueue::~SpillQueue()
+{
+    close();
+}
+
+bool SpillQueue::empty()
+{
+    Lock l(m_mutex);
+    return m_count == 0;
+}
+
+size_t SpillQueue::size()
+{
+    Lock l(m_mutex);
+    return m_count;
+}
+
+bool SpillQueue::open()
+{
+    char filename[128];
+    sprintf(filename, "/fcSpill_%d_%d.tmp", (int)
+#ifdef fcWindows
+        ::GetCurrentProcessId(),
+#else
+        ::getpid(),
+#endif
+        g_spill_file_count++);
+    std::string path = GetSpillDirectory() + filename;
+
+#ifdef fcWindows
+    // deleted by the system when closed
+    HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_NEW,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        fcDebugLog("SpillQueue::open(): failed to create %s\n", path.c_str());
+        return false;
+    }
+    m_file = file;
+#else
+    m_file = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (m_file == -1) {
+        fcDebugLog("SpillQueue::open(): failed to create %s\n", path.c_str());
+        return false;
+    }
+    // unlink right away. the file is removed when closed, even if the process crashes
+    ::unlink(path.c_str());
+#endif
+    return true;
+}
+
+void SpillQueue::close()
+{
+#ifdef fcWindows
+    if (m_view) { ::UnmapViewOfFile(m_view); }
+    if (m_mapping) { ::CloseHandle(m_mapping); }
+    if (m_file) { ::CloseHandle(m_file); }
+    m_mapping = m_file = nullptr;
+#else
+    if (m_view) { ::munmap(m_view, m_capacity); }
+    if (m_file != -1) { ::close(m_file); }
+    m_file = -1;
+#endif
+    m_view = nullptr;
+    m_capacity = 0;
+}
+
+bool SpillQueue::reserve(uint64_t size)
+{
+    if (size <= m_capacity) { return true; }
+    uint64_t capacity = RoundUp(std::max<uint64_t>(std::max<uint64_t>(size, m_capacity * 2), MinFileSize), FileSizeGranularity);
+
+    // on failure the current mapping is kept as it is, so frames already spilled stay readable.
+
+#ifdef fcWindows
+    // creating a mapping larger than the file extends the file
+    HANDLE mapping = ::CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, DWORD(capacity >> 32), DWORD(capacity), nullptr);
+    if (!mapping) { return false; }
+    char *view = (char*)::MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)capacity);
+    if (!view) {
+        ::CloseHandle(mapping);
+        return false;
+    }
+    if (m_view) { ::UnmapViewOfFile(m_view); }
+    if (m_mapping) { ::CloseHandle(m_mapping); }
+    m_mapping = mapping;
+    m_view = view;
+#else
+    if (::ftruncate(m_file, (off_t)capacity) != 0) { return false; }
+    void *view = MAP_FAILED;
+#ifdef __linux__
+    if (m_view) {
+        view = ::mremap(m_view, m_capacity, capacity, MREMAP_MAYMOVE);
+    }
+    else {
+        view = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+    }
+    if (view == MAP_FAILED) { return false; }
+#else
+    view = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+    if (view == MAP_FAILED) { return false; }
+    if (m_view) { ::munmap(m_view, m_capacity); }
+#endif
+    m_view = (char*)view;
+#endif
+    m_capacity = capacity;
+    return true;
+}
+
+// ftruncate() makes a sparse file and discard() punches holes. writing to a hole on a full disk
+// raises SIGBUS instead of returning an error, so the blocks for [begin, end) are allocated before writing.
+bool SpillQueue::allocate(uint64_t begin, uint64_t end)
+{
+#ifdef __linux__
+    int err = ::posix_fallocate(m_file, (off_t)begin, (off_t)(end - begin));
+    // EINVAL / EOPNOTSUPP: the file system can't preallocate. go on as before
+    return err == 0 || err == EINVAL || err == EOPNOTSUPP;
+#else
+    return true;
+#endif
+}
+
+// hand back disk space and page cache of frames already read. best effort
+void SpillQueue::discard(uint64_t begin, uint64_t end)
+{
+#ifdef __linux__
+    static const uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    begin = RoundUp(begin, page_size);
+    end = end / page_size * page_size;
+    if (begin < end) {
+        ::madvise(m_view + begin, end - begin, MADV_REMOVE);
+    }
+#endif
+}
+
+bool SpillQueue::push(const Header& header, const void *pixels, const char *name)
+{
+    fcTraceScope("SpillQueue::push");
+    Lock l(m_mutex);
+
+#ifdef fcWindows
+    if (!m_file && !open()) { return false; }
+#else
+    if (m_file == -1 && !open()) { return false; }
+#endif
+
+    RecordHeader rh;
+    rh.header = header;
+    rh.name_size = name ? (uint32_t)strlen(name) : 0;
+    uint64_t pixels_pos = RoundUp(m_write_pos + sizeof(RecordHeader) + rh.name_size, RecordAlignment);
+    uint64_t end = RoundUp(pixels_pos + header.size, RecordAlignment);
+    if (!reserve(end) || !allocate(m_write_pos, end)) {
+        fcDebugLog("SpillQueue::push(): failed to extend spill file\n");
+        return false;
+    }
+
+    memcpy(m_view + m_write_pos, &rh, sizeof(rh));
+    if (rh.name_size) { memcpy(m_view + m_write_pos + sizeof(rh), name, rh.name_size); }
+    memcpy(m_view + pixels_pos, pixels, header.size);
+    m_write_pos = end;
+    ++m_count;
+    return true;
+}
+
+bool SpillQueue::pop(Header& header, Buffer& dst, std::string *name)
+{
+    fcTraceScope("SpillQueue::pop");
+    Lock l(m_mutex);
+    if (m_count == 0) { return false; }
+
+    RecordHeader rh;
+    memcpy(&rh, m_view + m_read_pos, sizeof(rh));
+    if (name) { name->assign(m_view + m_read_pos + sizeof(rh), rh.name_size); }
+    uint64_t pixels_pos = RoundUp(m_read_pos + sizeof(RecordHeader) + rh.name_size, RecordAlignment);
+    uint64_t end = RoundUp(pixels_pos + rh.header.size, RecordAlignment);
+
+    header = rh.header;
+    BufferPool::getInstance().acquire(dst, header.size);
+    memcpy(dst.data(), m_view + pixels_pos, header.size);
+
+    discard(m_read_pos, end);
+    m_read_pos = end;
+    if (--m_count == 0) {
+        // start over from the beginning of the file
+        discard(0, m_write_pos);
+        m_read_pos = m_write_pos = 0;
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include "Buffer.h"
+
+
+// FIFO of raw frames backed by a memory-mapped temporary file. used by fcBackpressurePolicy::Spill,
+// so that offline captures can go on while the encoder is behind, without blocking or holding the frames in memory.
+// frames are stored as Buffer + fcPixelFormat metadata, so it works for any format. thread safe.
+class SpillQueue
+{
+public:
+    struct Header
+    {
+        size_t size = 0; // bytes of pixels
+        fcPixelFormat format = fcPixelFormat_Unknown;
+        fcTime timestamp = 0.0;
+        int width = 0;
+        int height = 0;
+        int param = 0; // context-defined. e.g. number of channels of png
+    };
+
+    SpillQueue();
+    ~SpillQueue();
+
+    bool empty();
+    size_t size(); // number of frames
+
+    // name: optional. e.g. output path of image sequences. the file is created on first push().
+    bool push(const Header& header, const void *pixels, const char *name = nullptr);
+    // take the oldest frame. pixels are stored into dst via BufferPool.
+    bool pop(Header& header, Buffer& dst, std::string *name = nullptr);
+
+private:
+    using Lock = std::unique_lock<std::mutex>;
+    bool open();
+    void close();
+    bool reserve(uint64_t size);
+    bool allocate(uint64_t begin, uint64_t end);
+    void discard(uint64_t begin, uint64_t end);
+
+    std::mutex m_mutex;
+#ifdef fcWindows
+    void *m_file = nullptr;
+    void *m_mapping = nullptr;
+#else
+    int m_file = -1;
+#endif
+    char *m_view = nullptr;
+    uint64_t m_capacity = 0;
+    uint64_t m_read_pos = 0;
+    uint64_t m_write_pos = 0;
+    size_t m_count = 0;
+};
+
+// directory to create spill files. default: system temporary directory
+void SetSpillDirectory(const char *path);
+std::string GetSpillDirectory();
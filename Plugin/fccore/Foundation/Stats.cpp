@@ -0,0 +1,131 @@
+#include "pch.h"
+#include "fcInternal.h"
+#include "Stats.h"
+#include "Buffer.h"
+#include <cmath>
+
+namespace {
+    thread_local ContextStats *g_current_stats = nullptr;
+
+    int Log2Floor(uint64_t v)
+    {
+        int r = 0;
+        while (v >>= 1) { ++r; }
+        return r;
+    }
+
+    int ToBucket(uint64_t us)
+    {
+        if (us < 4) { return (int)us; }
+        int e = Log2Floor(us);
+        int sub = (int)(us >> (e - 2)) & 3;
+        return std::min<int>((e - 1) * 4 + sub, LatencyHistogram::NumBuckets - 1);
+    }
+
+    // center of the bucket in microseconds
+    double FromBucket(int i)
+    {
+        if (i < 4) { return (double)i + 0.5; }
+        int e = i / 4 + 1;
+        int sub = i % 4;
+        double width = (double)(1ull << (e - 2));
+        return (4 + sub) * width + width * 0.5;
+    }
+}
+
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (auto& b : m_buckets) { b = 0; }
+}
+
+void LatencyHistogram::record(Clock::duration elapsed)
+{
+    uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    m_buckets[ToBucket(us)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = m_max_us.load(std::memory_order_relaxed);
+    while (us > max && !m_max_us.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+}
+
+fcLatencyStats LatencyHistogram::get() const
+{
+    uint64_t counts[NumBuckets];
+    uint64_t total = 0;
+    for (int i = 0; i < NumBuckets; ++i) {
+        counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    auto percentile = [&](double p) {
+        uint64_t target = std::max<uint64_t>((uint64_t)std::ceil((double)total * p), 1);
+        uint64_t sum = 0;
+        for (int i = 0; i < NumBuckets; ++i) {
+            sum += counts[i];
+            if (sum >= target) { return (float)(FromBucket(i) / 1000.0); }
+        }
+        return 0.0f;
+    };
+
+    fcLatencyStats ret;
+    ret.count = total;
+    if (total > 0) {
+        ret.p50 = percentile(0.5);
+        ret.p99 = percentile(0.99);
+        ret.max = (float)((double)m_max_us.load(std::memory_order_relaxed) / 1000.0);
+    }
+    return ret;
+}
+
+
+void ContextStats::onEnqueue()
+{
+    int depth = ++m_queue_depth;
+    int peak = m_peak_queue_depth.load(std::memory_order_relaxed);
+    while (depth > peak && !m_peak_queue_depth.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {}
+}
+
+void ContextStats::addStream(BinaryStream *s)
+{
+    std::unique_lock<std::mutex> l(m_mutex);
+    m_streams.push_back(s);
+}
+
+void ContextStats::getStats(fcContextStats& dst)
+{
+    dst.frames_submitted = m_submitted;
+    dst.frames_encoded = m_encoded;
+    dst.frames_written = m_written;
+    dst.queue_depth = m_queue_depth;
+    dst.peak_queue_depth = m_peak_queue_depth;
+    {
+        std::unique_lock<std::mutex> l(m_mutex);
+        dst.num_streams = (int)m_streams.size();
+        for (int i = 0; i < dst.num_streams && i < fcMaxStatsStreams; ++i) {
+            dst.stream_bytes[i] = m_streams[i]->getWrittenBytes();
+            dst.stream_pending_bytes[i] = m_streams[i]->getPendingBytes();
+        }
+    }
+    dst.readback = getLatency(StatsStage::Readback).get();
+    dst.convert  = getLatency(StatsStage::Convert).get();
+    dst.yuv      = getLatency(StatsStage::YUV).get();
+    dst.encode   = getLatency(StatsStage::Encode).get();
+    dst.write    = getLatency(StatsStage::Write).get();
+    dst.memory_bytes = m_memory_bytes;
+}
+
+ContextStats* ContextStats::getCurrent()
+{
+    return g_current_stats;
+}
+
+ContextStats::Binder::Binder(ContextStats *v)
+    : m_prev(g_current_stats)
+{
+    g_current_stats = v;
+}
+
+ContextStats::Binder::~Binder()
+{
+    g_current_stats = m_prev;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include "../fccore.h"
+
+class BinaryStream;
+
+
+// log-scale latency histogram. record() is a few arithmetic ops and one relaxed atomic increment, so it can be left on.
+// 4 buckets per power of 2 of microseconds. percentiles are accurate to about 1/8 of the value.
+class LatencyHistogram
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    static const int NumBuckets = 128;
+
+    LatencyHistogram();
+    void record(Clock::duration elapsed);
+    fcLatencyStats get() const;
+
+private:
+    std::atomic<uint64_t> m_buckets[NumBuckets];
+    std::atomic<uint64_t> m_max_us = { 0 };
+};
+
+
+enum class StatsStage
+{
+    Readback,
+    Convert,
+    YUV,
+    Encode,
+    Write,
+    Count,
+};
+
+// per-context pipeline statistics. all counters are lock-free.
+class ContextStats
+{
+public:
+    using Clock = LatencyHistogram::Clock;
+
+    void onSubmit()     { ++m_submitted; }
+    void onEncoded()    { ++m_encoded; }
+    void onWritten()    { ++m_written; }
+    void onEnqueue();
+    void onDequeue()    { --m_queue_depth; }
+    void onCharge(size_t size)  { m_memory_bytes += size; }
+    void onRelease(size_t size) { m_memory_bytes -= size; }
+    LatencyHistogram& getLatency(StatsStage stage) { return m_latencies[(int)stage]; }
+
+    // streams must outlive this or be removed before destroyed
+    void addStream(BinaryStream *s);
+    void getStats(fcContextStats& dst);
+
+    // shared helpers (e.g. AnyToI420()) record into stats bound to current thread
+    static ContextStats* getCurrent();
+    class Binder
+    {
+    public:
+        Binder(ContextStats *v);
+        ~Binder();
+    private:
+        ContextStats *m_prev;
+    };
+
+private:
+    std::atomic<uint64_t> m_submitted = { 0 };
+    std::atomic<uint64_t> m_encoded = { 0 };
+    std::atomic<uint64_t> m_written = { 0 };
+    std::atomic_int m_queue_depth = { 0 };
+    std::atomic_int m_peak_queue_depth = { 0 };
+    std::atomic<uint64_t> m_memory_bytes = { 0 };
+    LatencyHistogram m_latencies[(int)StatsStage::Count];
+    std::mutex m_mutex;
+    std::vector<BinaryStream*> m_streams;
+};
+
+// measure the scope and record it to stage of stats. stats can be null.
+class ScopedLatency
+{
+public:
+    ScopedLatency(ContextStats *stats, StatsStage stage)
+        : m_histogram(stats ? &stats->getLatency(stage) : nullptr)
+    {
+        if (m_histogram) { m_begin = LatencyHistogram::Clock::now(); }
+    }
+    ~ScopedLatency()
+    {
+        if (m_histogram) { m_histogram->record(LatencyHistogram::Clock::now() - m_begin); }
+    }
+
+private:
+    LatencyHistogram *m_histogram;
+    LatencyHistogram::Clock::time_point m_begin;
+};
@@ -8,13 +8,42 @@ TaskGroup::TaskGroup()
 
 TaskGroup::~TaskGroup()
 {
-    wait();
+    // can't throw here. an exception nobody took by wait() is dropped
+    waitAll();
 }
 
 void TaskGroup::wait()
 {
-    for (auto& f : m_futures) {
-        f.get();
+    waitAll();
+    std::exception_ptr e;
+    {
+        Lock l(m_mutex);
+        std::swap(e, m_exception);
     }
-    m_futures.clear();
+    if (e) { std::rethrow_exception(e); }
+}
+
+void TaskGroup::waitAll()
+{
+    ThreadPool::getInstance().waitUntil(m_mutex, m_condition, [this]() { return m_active_tasks == 0; });
+}
+
+void TaskGroup::waitSlot()
+{
+    int max_tasks = std::max<int>(m_max_tasks, 1);
+    ThreadPool::getInstance().waitUntil(m_mutex, m_condition, [this, max_tasks]() { return m_active_tasks < max_tasks; });
+}
+
+void TaskGroup::onTaskFailed(std::exception_ptr e)
+{
+    Lock l(m_mutex);
+    if (!m_exception) { m_exception = e; }
+}
+
+void TaskGroup::onTaskComplete()
+{
+    // notify under the lock. the group may be destroyed as soon as the waiter wakes up.
+    Lock l(m_mutex);
+    --m_active_tasks;
+    m_condition.notify_all();
 }
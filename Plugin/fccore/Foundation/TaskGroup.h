@@ -1,32 +1,59 @@
 ﻿#pragma once
-#include <vector>
-#include <deque>
-#include <future>
+#include <mutex>
+#include <condition_variable>
 #include <atomic>
+#include <exception>
+#include "ThreadPool.h"
 
+// runs tasks on the shared ThreadPool. max_tasks limits how many tasks of this group can be in flight at once.
+// a slot is released as soon as any task completes, so one slow task doesn't block submission of others.
+// an exception thrown by a task is passed to wait() (the first one, if several tasks throw).
 class TaskGroup
 {
 public:
+    using Lock = std::unique_lock<std::mutex>;
+
     TaskGroup();
     ~TaskGroup();
 
     int getMaxTasks() const { return m_max_tasks; }
     void setMaxTasks(int v) { m_max_tasks = v; }
+    fcTaskPriority getPriority() const { return m_priority; }
+    void setPriority(fcTaskPriority v) { m_priority = v; }
 
+    // wait until all tasks complete. rethrows the exception of a failed task
     void wait();
+    // wait until number of running tasks become less than max_tasks
+    void waitSlot();
+    // true if run() would wait for a slot
+    bool isFull() const { return m_active_tasks >= std::max<int>(m_max_tasks, 1); }
 
     template<class Body>
     void run(const Body &body)
     {
-        while (m_futures.size() >= (size_t)m_max_tasks) {
-            m_futures.front().get();
-            m_futures.pop_front();
-        }
-
-        m_futures.push_back(std::async(std::launch::async, body));
+        waitSlot();
+        ++m_active_tasks;
+        ThreadPool::getInstance().run([this, body]() {
+            // the slot must be released whatever body does, or wait() never returns
+            try {
+                body();
+            }
+            catch (...) {
+                onTaskFailed(std::current_exception());
+            }
+            onTaskComplete();
+        }, m_priority);
     }
 
 private:
-    std::deque<std::future<void>> m_futures;
+    void waitAll();
+    void onTaskFailed(std::exception_ptr e);
+    void onTaskComplete();
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::atomic_int m_active_tasks = { 0 };
+    std::exception_ptr m_exception; // guarded by m_mutex
     int m_max_tasks = 8;
+    fcTaskPriority m_priority = fcTaskPriority::Normal;
 };
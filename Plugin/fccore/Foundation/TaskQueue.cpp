@@ -17,16 +17,17 @@ void TaskQueue::run(const Task& v)
 #ifdef fcForceSingleThreaded
     v();
 #else
-    if (!m_running) {
-        m_thread = std::thread([this]() { process(); });
-        m_running = true;
-    }
-
+    bool kick = false;
     {
         Lock l(m_mutex);
         m_tasks.push_back(v);
+        if (!m_scheduled) {
+            m_scheduled = kick = true;
+        }
+    }
+    if (kick) {
+        ThreadPool::getInstance().run([this]() { process(); }, m_priority);
     }
-    m_condition.notify_one();
 #endif
 }
 
@@ -34,51 +35,101 @@ void TaskQueue::wait()
 {
 #ifdef fcForceSingleThreaded
 #else
-    if (m_running) {
-        m_stop = true;
-        m_condition.notify_one();
-        m_thread.join();
-        m_running = false;
-        m_stop = false;
-    }
+    ThreadPool::getInstance().waitUntil(m_mutex, m_condition, [this]() { return !m_scheduled; });
 #endif
 }
 
-bool TaskQueue::feed()
+void TaskQueue::process()
 {
-    Task task;
-    {
-        Lock lock(m_mutex);
-        if (!m_tasks.empty()) {
-            task = m_tasks.front();
+    // process limited number of tasks and re-schedule to give other tasks chance to run
+    for (int i = 0; i < MaxTasksPerRun; ++i) {
+        Task task;
+        {
+            Lock lock(m_mutex);
+            if (m_tasks.empty()) {
+                m_scheduled = false;
+                m_condition.notify_all();
+                return;
+            }
+            task = std::move(m_tasks.front());
             m_tasks.pop_front();
         }
+        task();
     }
+    ThreadPool::getInstance().run([this]() { process(); }, m_priority);
+}
 
-    if (task) {
-        task();
-        return true;
+
+SPSCTaskQueue::SPSCTaskQueue(size_t capacity)
+{
+    size_t n = 1;
+    while (n < capacity) { n <<= 1; }
+    m_slots.resize(n);
+    m_mask = n - 1;
+}
+
+SPSCTaskQueue::~SPSCTaskQueue()
+{
+    wait();
+}
+
+void SPSCTaskQueue::wait()
+{
+#ifdef fcForceSingleThreaded
+#else
+    ThreadPool::getInstance().waitUntil(m_mutex, m_condition, [this]() { return !m_scheduled; });
+#endif
+}
+
+SPSCTaskQueue::Slot& SPSCTaskQueue::waitSlot(size_t tail)
+{
+    // queue is full. wait consumer. this should be rare as callers limit in-flight tasks by their buffer pools.
+    auto& pool = ThreadPool::getInstance();
+    while (tail - m_head.load(std::memory_order_acquire) >= m_slots.size()) {
+        if (!pool.isWorkerThread() || !pool.processOne()) {
+            std::this_thread::yield();
+        }
     }
-    else {
-        return false;
+    return m_slots[tail & m_mask];
+}
+
+void SPSCTaskQueue::kick()
+{
+#ifdef fcForceSingleThreaded
+    process();
+#else
+    if (!m_scheduled.exchange(true)) {
+        ThreadPool::getInstance().run([this]() { process(); }, m_priority);
     }
+#endif
 }
 
-void TaskQueue::process()
+void SPSCTaskQueue::process()
 {
-    while (!m_stop || !m_tasks.empty())
-    {
-        Task task;
-        {
-            Lock lock(m_mutex);
-            while (!m_stop && m_tasks.empty()) {
-                m_condition.wait(lock);
-            }
-            if (m_stop && m_tasks.empty()) { return; }
+    // process limited number of tasks and re-schedule to give other tasks chance to run
+    for (int i = 0; i < MaxTasksPerRun; ) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head != m_tail.load(std::memory_order_acquire)) {
+            Slot& slot = m_slots[head & m_mask];
+            slot.invoke(slot.storage);
+            slot.destroy(slot.storage);
+            m_head.store(head + 1, std::memory_order_release);
+            ++i;
+            continue;
+        }
 
-            task = m_tasks.front();
-            m_tasks.pop_front();
+#ifdef fcForceSingleThreaded
+        return;
+#else
+        // empty. clear scheduled flag and re-check as the producer may have pushed a task in the meantime.
+        // this is done under the lock so that wait() can't return (and the queue can't be destroyed) before this returns.
+        Lock l(m_mutex);
+        m_scheduled = false;
+        if (head == m_tail.load() || m_scheduled.exchange(true)) {
+            m_condition.notify_all();
+            return;
         }
-        task();
+#endif
     }
+    ThreadPool::getInstance().run([this]() { process(); }, m_priority);
 }
@@ -5,10 +5,13 @@
 #include <memory>
 #include <algorithm>
 #include <functional>
+#include <type_traits>
+#include <new>
 #include <thread>
 #include <mutex>
 #include <atomic>
 #include <condition_variable>
+#include "ThreadPool.h"
 
 
 template<class T>
@@ -36,7 +39,7 @@ public:
             }
         }
 
-        operator bool() const { return m_resource; }
+        operator bool() const { return m_resource != nullptr; }
         Resource& operator*() { return *m_resource; }
         const Resource& operator*() const { return *m_resource; }
         Resource* operator->() { return m_resource.get(); }
@@ -65,6 +68,18 @@ public:
         return acquire(std::chrono::hours(24));
     }
 
+    // return a free resource without waiting. if there is none, add a new one.
+    ResourceHolder acquireOrGrow()
+    {
+        ResourceHolder ret = acquire(std::chrono::seconds(0));
+        if (!ret) {
+            Lock l(m_mutex);
+            ret = { this, std::make_shared<Resource>() };
+            m_max_resources = std::max<size_t>(m_max_resources, 1);
+        }
+        return ret;
+    }
+
     template<class Rep, class Period>
     ResourceHolder acquire(std::chrono::duration<Rep, Period> wait_time)
     {
@@ -101,26 +116,88 @@ private:
 };
 
 
+// serial task queue. tasks are processed in order, one at a time, on the shared ThreadPool.
+// there is no dedicated thread: while the queue has tasks, one "drain" task for it is scheduled on the pool.
 class TaskQueue
 {
 public:
     using Task = std::function<void()>;
     using Tasks = std::deque<Task>;
     using Lock = std::unique_lock<std::mutex>;
+    static const int MaxTasksPerRun = 8;
 
     TaskQueue();
     ~TaskQueue();
+    void setPriority(fcTaskPriority v) { m_priority = v; }
+    // wait until all tasks are processed
     void wait();
-    bool feed();
     void run(const Task& v);
 
 private:
     void process();
 
-    std::thread             m_thread;
     std::mutex              m_mutex;
     std::condition_variable m_condition;
-    std::atomic_bool        m_stop = { false };
-    std::atomic_bool        m_running = { false };
     Tasks                   m_tasks;
+    bool                    m_scheduled = false;
+    fcTaskPriority          m_priority = fcTaskPriority::Normal;
+};
+
+
+// bounded lock-free single-producer / single-consumer task queue.
+// tasks are constructed in preallocated slots, so run() takes no lock and doesn't allocate unless the queue is full.
+// run() must be called from one thread (e.g. the game thread). tasks are processed in order on the shared ThreadPool
+// in the same way as TaskQueue.
+class SPSCTaskQueue
+{
+public:
+    static const size_t MaxTaskSize = 64;
+    static const int MaxTasksPerRun = 8;
+    using Lock = std::unique_lock<std::mutex>;
+
+    // capacity is rounded up to power of two
+    SPSCTaskQueue(size_t capacity = 64);
+    ~SPSCTaskQueue();
+    void setPriority(fcTaskPriority v) { m_priority = v; }
+    // wait until all tasks are processed
+    void wait();
+
+    template<class Body>
+    void run(Body&& body)
+    {
+        using Task = typename std::decay<Body>::type;
+        static_assert(sizeof(Task) <= MaxTaskSize, "SPSCTaskQueue: task is too large");
+        static_assert(alignof(Task) <= alignof(Slot), "SPSCTaskQueue: task alignment is too large");
+
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        Slot& slot = waitSlot(tail);
+        new (slot.storage) Task(std::forward<Body>(body));
+        slot.invoke = [](void *p) { (*(Task*)p)(); };
+        slot.destroy = [](void *p) { ((Task*)p)->~Task(); };
+        m_tail.store(tail + 1);
+        kick();
+    }
+
+private:
+    struct alignas(16) Slot
+    {
+        char storage[MaxTaskSize];
+        void (*invoke)(void*) = nullptr;
+        void (*destroy)(void*) = nullptr;
+    };
+
+    Slot& waitSlot(size_t tail);
+    void kick();
+    void process();
+
+    std::vector<Slot>       m_slots;
+    size_t                  m_mask = 0;
+    std::atomic<size_t>     m_head = { 0 }; // written by consumer
+    char                    m_pad[64];      // keep head and tail on separate cache lines
+    std::atomic<size_t>     m_tail = { 0 }; // written by producer
+
+    std::mutex              m_mutex;
+    std::condition_variable m_condition;
+    std::atomic_bool        m_scheduled = { false };
+    fcTaskPriority          m_priority = fcTaskPriority::Normal;
 };
@@ -0,0 +1,299 @@
+#include "pch.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#ifdef fcWindows
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <sys/resource.h>
+    #ifdef fcLinux
+        #include <sched.h>
+        #include <unistd.h>
+        #include <sys/syscall.h>
+    #endif
+#endif
+
+namespace {
+    thread_local const ThreadPool *g_current_pool = nullptr;
+    thread_local int g_worker_index = -1;
+}
+
+ThreadPool& ThreadPool::getInstance()
+{
+    static ThreadPool s_instance;
+    return s_instance;
+}
+
+ThreadPool::ThreadPool()
+{
+    int num_workers = std::max<int>(std::thread::hardware_concurrency(), 1);
+    for (int i = 0; i < num_workers; ++i) {
+        m_workers.emplace_back(new Worker());
+    }
+    setMaxWorkers(0);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        Lock l(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    m_park_condition.notify_all();
+    for (int i = 0; i < m_num_started; ++i) {
+        m_workers[i]->thread.join();
+    }
+}
+
+void ThreadPool::setMaxWorkers(int v)
+{
+    int num_workers = (int)m_workers.size();
+    if (v <= 0) { v = num_workers - 1; }
+    v = std::min<int>(std::max<int>(v, 1), num_workers);
+
+    {
+        Lock l(m_mutex);
+        m_max_workers = v;
+        for (; m_num_started < v; ++m_num_started) {
+            int wi = m_num_started;
+            m_workers[wi]->thread = std::thread([this, wi]() { process(wi); });
+        }
+    }
+    m_park_condition.notify_all();
+    m_condition.notify_all();
+}
+
+int ThreadPool::getMaxWorkers() const
+{
+    return m_max_workers;
+}
+
+int ThreadPool::getNumWorkers() const
+{
+    return (int)m_workers.size();
+}
+
+void ThreadPool::setThreadConfig(const ThreadConfig& v)
+{
+    {
+        Lock l(m_mutex);
+        m_thread_config = v;
+        ++m_thread_config_version;
+    }
+    // wake up sleeping and parked workers to let them apply new config
+    m_park_condition.notify_all();
+    m_condition.notify_all();
+}
+
+ThreadPool::ThreadConfig ThreadPool::getThreadConfig()
+{
+    Lock l(m_mutex);
+    return m_thread_config;
+}
+
+void ThreadPool::run(Task task, Priority priority)
+{
+    int wi = g_worker_index;
+    if (!isWorkerThread() || wi >= m_max_workers) {
+        wi = (int)(m_next++ % (unsigned)m_max_workers);
+    }
+
+    ++m_num_pending;
+    {
+        auto& w = *m_workers[wi];
+        Lock l(w.mutex);
+        w.tasks[(int)priority].push_back(std::move(task));
+    }
+    ++m_num_pushed;
+
+    if (m_num_sleeping > 0 || m_num_waiting > 0) {
+        Lock l(m_mutex);
+        if (m_num_sleeping > 0) { m_condition.notify_one(); }
+        // workers blocked in waitUntil() can run the task too
+        for (auto& w : m_workers) {
+            if (w->waiting) { w->waiting->notify_all(); }
+        }
+    }
+}
+
+void ThreadPool::beginWait(std::condition_variable& condition)
+{
+    Lock l(m_mutex);
+    m_workers[g_worker_index]->waiting = &condition;
+    ++m_num_waiting;
+}
+
+void ThreadPool::endWait()
+{
+    Lock l(m_mutex);
+    m_workers[g_worker_index]->waiting = nullptr;
+    --m_num_waiting;
+}
+
+bool ThreadPool::processOne()
+{
+    Task task;
+    if (take(isWorkerThread() ? g_worker_index : -1, task)) {
+        --m_num_pending;
+        task();
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::isWorkerThread() const
+{
+    return g_current_pool == this;
+}
+
+bool ThreadPool::take(int wi, Task& dst)
+{
+    for (int pi = 0; pi < NumPriorities; ++pi) {
+        if ((wi >= 0 && pop(wi, pi, dst)) || steal(wi, pi, dst)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::pop(int wi, int pi, Task& dst)
+{
+    // tasks are processed FIFO to keep frames in submission order
+    auto& w = *m_workers[wi];
+    Lock l(w.mutex);
+    auto& tasks = w.tasks[pi];
+    if (tasks.empty()) { return false; }
+    dst = std::move(tasks.front());
+    tasks.pop_front();
+    return true;
+}
+
+bool ThreadPool::steal(int wi, int pi, Task& dst)
+{
+    // steal oldest task from other workers. parked workers' deques are also checked.
+    int n = (int)m_workers.size();
+    int begin = wi >= 0 ? wi + 1 : (int)(m_next % n);
+    for (int i = 0; i < n; ++i) {
+        int vi = (begin + i) % n;
+        if (vi == wi) { continue; }
+
+        auto& w = *m_workers[vi];
+        Lock l(w.mutex);
+        auto& tasks = w.tasks[pi];
+        if (!tasks.empty()) {
+            dst = std::move(tasks.front());
+            tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::applyThreadConfig(int wi)
+{
+    ThreadConfig conf;
+    {
+        Lock l(m_mutex);
+        conf = m_thread_config;
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "%s%d", conf.name.c_str(), wi);
+    Tracer::getInstance().setThreadName(name);
+
+#if defined(fcWindows)
+    HANDLE thread = ::GetCurrentThread();
+    DWORD_PTR mask = conf.affinity_mask ? (DWORD_PTR)conf.affinity_mask : (DWORD_PTR)-1;
+    DWORD_PTR process_mask, system_mask;
+    if (::GetProcessAffinityMask(::GetCurrentProcess(), &process_mask, &system_mask)) { mask &= process_mask; }
+    if (mask == 0 || ::SetThreadAffinityMask(thread, mask) == 0) {
+        fcDebugLog("ThreadPool: SetThreadAffinityMask() failed");
+    }
+
+    int priority = THREAD_PRIORITY_NORMAL;
+    if (conf.priority <= -10)   { priority = THREAD_PRIORITY_HIGHEST; }
+    else if (conf.priority < 0) { priority = THREAD_PRIORITY_ABOVE_NORMAL; }
+    else if (conf.priority >= 10) { priority = THREAD_PRIORITY_LOWEST; }
+    else if (conf.priority > 0) { priority = THREAD_PRIORITY_BELOW_NORMAL; }
+    ::SetThreadPriority(thread, priority);
+
+    // SetThreadDescription() is available on Windows 10 1607 or later
+    typedef HRESULT (WINAPI *SetThreadDescriptionT)(HANDLE, PCWSTR);
+    static auto SetThreadDescription_ = (SetThreadDescriptionT)::GetProcAddress(::GetModuleHandleA("kernel32.dll"), "SetThreadDescription");
+    if (SetThreadDescription_) {
+        wchar_t wname[16];
+        ::MultiByteToWideChar(CP_UTF8, 0, name, -1, wname, 16);
+        SetThreadDescription_(thread, wname);
+    }
+
+#elif defined(fcLinux)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (conf.affinity_mask == 0 || (i < 64 && (conf.affinity_mask & (1ull << i)))) { CPU_SET(i, &cpuset); }
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+        fcDebugLog("ThreadPool: pthread_setaffinity_np() failed");
+    }
+
+    // nice value is per-thread on linux. raising priority (negative value) requires CAP_SYS_NICE
+    if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), conf.priority) != 0) {
+        fcDebugLog("ThreadPool: setpriority() failed");
+    }
+    pthread_setname_np(pthread_self(), name);
+
+#elif defined(fcMac)
+    // mac has no API to pin threads to cores and nice value is per-process. only name is applied.
+    pthread_setname_np(name);
+#endif
+}
+
+void ThreadPool::process(int wi)
+{
+    g_current_pool = this;
+    g_worker_index = wi;
+
+    int config_version = -1;
+    for (;;) {
+        if (config_version != m_thread_config_version) {
+            config_version = m_thread_config_version;
+            applyThreadConfig(wi);
+        }
+
+        if (wi >= m_max_workers) {
+            // over the budget. park until the budget is raised
+            Lock l(m_mutex);
+            if (m_stop) { break; }
+            if (m_num_pending > 0) { m_condition.notify_one(); } // hand over the wake-up this worker may have consumed
+            m_park_condition.wait(l, [this, wi, config_version]() {
+                return m_stop || wi < m_max_workers || config_version != m_thread_config_version;
+            });
+            continue;
+        }
+
+        Task task;
+        if (take(wi, task)) {
+            --m_num_pending;
+            task();
+            continue;
+        }
+
+        // spin a while before sleeping. tasks tend to come in bursts (e.g. video and audio of a frame),
+        // and waking up a sleeping worker is costly for the thread that submits tasks.
+        bool found = false;
+        for (int i = 0; i < 64 && !found; ++i) {
+            std::this_thread::yield();
+            found = m_num_pending > 0;
+        }
+        if (found) { continue; }
+
+        Lock l(m_mutex);
+        if (m_stop && m_num_pending == 0) { break; }
+        ++m_num_sleeping;
+        m_condition.wait(l, [this, wi, config_version]() {
+            return m_stop || m_num_pending > 0 || wi >= m_max_workers || config_version != m_thread_config_version;
+        });
+        --m_num_sleeping;
+    }
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include "../fccore.h"
+#include "RingQueue.h"
+
+
+// void() callable stored in place. unlike std::function, scheduling a task with captures doesn't allocate. move only.
+class InplaceTask
+{
+public:
+    static const size_t MaxSize = 64;
+
+    InplaceTask() {}
+
+    template<class Body, class = typename std::enable_if<!std::is_same<typename std::decay<Body>::type, InplaceTask>::value>::type>
+    InplaceTask(Body&& body)
+    {
+        using T = typename std::decay<Body>::type;
+        static_assert(sizeof(T) <= MaxSize, "InplaceTask: task is too large");
+        static_assert(alignof(T) <= 16, "InplaceTask: task alignment is too large");
+        new (m_storage) T(std::forward<Body>(body));
+        m_ops = &Impl<T>::ops;
+    }
+
+    InplaceTask(InplaceTask&& v) { moveFrom(v); }
+    InplaceTask& operator=(InplaceTask&& v)
+    {
+        if (this != &v) {
+            reset();
+            moveFrom(v);
+        }
+        return *this;
+    }
+    InplaceTask(const InplaceTask&) = delete;
+    InplaceTask& operator=(const InplaceTask&) = delete;
+    ~InplaceTask() { reset(); }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+    void operator()() { m_ops->invoke(m_storage); }
+
+    void reset()
+    {
+        if (m_ops) {
+            m_ops->destroy(m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void *p);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *p);
+    };
+
+    template<class T>
+    struct Impl
+    {
+        static void invoke(void *p) { (*(T*)p)(); }
+        static void move(void *dst, void *src) { new (dst) T(std::move(*(T*)src)); }
+        static void destroy(void *p) { ((T*)p)->~T(); }
+        static const Ops ops;
+    };
+
+    void moveFrom(InplaceTask& v)
+    {
+        if (v.m_ops) {
+            v.m_ops->move(m_storage, v.m_storage);
+            m_ops = v.m_ops;
+            v.reset();
+        }
+    }
+
+    alignas(16) char m_storage[MaxSize];
+    const Ops *m_ops = nullptr;
+};
+
+template<class T>
+const InplaceTask::Ops InplaceTask::Impl<T>::ops = { &Impl<T>::invoke, &Impl<T>::move, &Impl<T>::destroy };
+
+
+// process-wide work-stealing thread pool. all tasks of all contexts are scheduled on this.
+// each worker has its own task deques (one per priority). tasks pushed from outside the pool are distributed round-robin,
+// tasks pushed from a worker go to its own deque. idle workers steal from others before going to sleep.
+// higher priority tasks are always taken first.
+// all contexts share these workers, at most getMaxWorkers() (logical cores - 1 by default). a task that blocks holds its worker
+// and delays tasks of every other context, so blocking work doesn't belong here: waits go through waitUntil(),
+// and file / sink I/O runs on threads of its own (FileStream, AsyncStream).
+// waits on stream writes are the exception: writers hold context locks that a nested task would take again.
+class ThreadPool
+{
+public:
+    using Task = InplaceTask;
+    using Lock = std::unique_lock<std::mutex>;
+    using Priority = fcTaskPriority;
+    static const int NumPriorities = 3;
+
+    // OS level properties of worker threads. applied by each worker itself, so it takes effect on running workers too.
+    struct ThreadConfig
+    {
+        uint64_t affinity_mask = 0; // 0: all cores
+        int priority = 0;           // nice value
+        std::string name = "fcWorker";
+    };
+
+    static ThreadPool& getInstance();
+
+    ThreadPool();
+    ~ThreadPool();
+
+    // max number of workers that can run tasks at the same time.
+    // v <= 0: number of logical cores - 1 (one core is left for the game thread).
+    void setMaxWorkers(int v);
+    int getMaxWorkers() const;
+    int getNumWorkers() const;
+
+    void setThreadConfig(const ThreadConfig& v);
+    // a copy, as setThreadConfig() can be called concurrently
+    ThreadConfig getThreadConfig();
+
+    void run(Task task, Priority priority = Priority::Normal);
+
+    // run one pending task on the calling thread if there is any. return false if nothing was done.
+    // used to avoid dead-lock when a worker waits for other tasks.
+    bool processOne();
+
+    // true if current thread is a worker of this pool
+    bool isWorkerThread() const;
+
+    // wait until cond() returns true. cond() is evaluated with mutex locked, and the waiter is woken up via condition.
+    // if called from a worker, process other tasks while waiting. otherwise the pool can dead-lock.
+    template<class Cond>
+    void waitUntil(std::mutex& mutex, std::condition_variable& condition, const Cond& cond)
+    {
+        if (isWorkerThread()) {
+            for (;;) {
+                unsigned serial = m_num_pushed;
+                {
+                    Lock l(mutex);
+                    if (cond()) { break; }
+                }
+                if (processOne()) { continue; }
+
+                // nothing to run. sleep until condition is notified or run() pushes a task (it notifies condition too).
+                // run() notifies without mutex, so its wake-up can fall in between the check and the sleep. the timeout covers that.
+                beginWait(condition);
+                {
+                    Lock l(mutex);
+                    condition.wait_for(l, std::chrono::milliseconds(WaitTimeoutMS), [&]() { return cond() || m_num_pushed != serial; });
+                }
+                endWait();
+            }
+        }
+        else {
+            Lock l(mutex);
+            condition.wait(l, cond);
+        }
+    }
+
+private:
+    static const int WaitTimeoutMS = 10;
+
+    struct Worker
+    {
+        std::thread thread;
+        std::mutex mutex;
+        RingQueue<Task> tasks[NumPriorities];
+        std::condition_variable *waiting = nullptr; // condition of waitUntil() the worker sleeps on. guarded by ThreadPool::m_mutex
+    };
+    using WorkerPtr = std::unique_ptr<Worker>;
+
+    void process(int wi);
+    void applyThreadConfig(int wi);
+    void beginWait(std::condition_variable& condition);
+    void endWait();
+    bool take(int wi, Task& dst);
+    bool pop(int wi, int pi, Task& dst);
+    bool steal(int wi, int pi, Task& dst);
+
+private:
+    std::vector<WorkerPtr>  m_workers; // allocated up to number of logical cores. threads are started on demand
+    std::mutex              m_mutex;
+    std::condition_variable m_condition;
+    std::condition_variable m_park_condition;
+    ThreadConfig            m_thread_config;
+    std::atomic_int         m_thread_config_version = { 0 };
+    std::atomic_int         m_max_workers = { 0 };
+    int                     m_num_started = 0;
+    std::atomic_int         m_num_pending = { 0 };
+    std::atomic_int         m_num_sleeping = { 0 };
+    std::atomic_int         m_num_waiting = { 0 };  // workers sleeping in waitUntil()
+    std::atomic_uint        m_num_pushed = { 0 };   // tasks ever pushed. waitUntil() wakes up when this changes
+    std::atomic_uint        m_next = { 0 };
+    std::atomic_bool        m_stop = { false };
+};
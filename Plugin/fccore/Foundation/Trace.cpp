@@ -0,0 +1,152 @@
+#include "pch.h"
+#include "fcInternal.h"
+#include "Trace.h"
+#include <chrono>
+#include <cstdio>
+
+std::atomic_bool Tracer::s_enabled = { false };
+
+Tracer& Tracer::getInstance()
+{
+    static Tracer s_instance;
+    return s_instance;
+}
+
+uint64_t Tracer::now()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::begin(int capacity)
+{
+    std::unique_lock<std::mutex> l(m_mutex);
+    m_capacity = capacity > 0 ? capacity : DefaultCapacity;
+    m_begin_time = now();
+    ++m_generation; // thread buffers are cleared lazily
+    s_enabled = true;
+}
+
+void Tracer::end()
+{
+    s_enabled = false;
+}
+
+Tracer::ThreadBufferRef::~ThreadBufferRef()
+{
+    if (buffer) {
+        std::unique_lock<std::mutex> l(buffer->mutex);
+        buffer->exited = true;
+    }
+}
+
+Tracer::ThreadBuffer& Tracer::getThreadBuffer()
+{
+    // buffers are owned by the tracer too, so that spans of exited threads can be dumped.
+    // threads come and go (e.g. per-context encoder threads), so buffers of exited threads are reused instead of piling up.
+    thread_local ThreadBufferRef t_ref;
+    if (!t_ref.buffer) {
+        std::unique_lock<std::mutex> l(m_mutex);
+        for (auto& pbuf : m_buffers) {
+            std::unique_lock<std::mutex> bl(pbuf->mutex);
+            if (pbuf->exited && !hasSpans(*pbuf)) {
+                pbuf->exited = false;
+                pbuf->name.clear();
+                t_ref.buffer = pbuf;
+                break;
+            }
+        }
+        if (!t_ref.buffer) {
+            t_ref.buffer = std::make_shared<ThreadBuffer>();
+            t_ref.buffer->id = (int)m_buffers.size() + 1;
+            m_buffers.push_back(t_ref.buffer);
+        }
+    }
+    return *t_ref.buffer;
+}
+
+// buf.mutex must be locked. true if dump() would write spans of buf
+bool Tracer::hasSpans(const ThreadBuffer& buf) const
+{
+    return buf.generation == m_generation && buf.count > 0;
+}
+
+void Tracer::resetIfOld(ThreadBuffer& buf)
+{
+    int generation = m_generation;
+    if (buf.generation != generation) {
+        buf.generation = generation;
+        buf.spans.resize(m_capacity);
+        buf.count = 0;
+    }
+}
+
+void Tracer::addSpan(const char *name, uint64_t begin_ns, uint64_t end_ns)
+{
+    auto& buf = getThreadBuffer();
+    std::unique_lock<std::mutex> l(buf.mutex);
+    resetIfOld(buf);
+    auto& span = buf.spans[buf.count % buf.spans.size()];
+    span.name = name;
+    span.begin = begin_ns;
+    span.end = end_ns;
+    ++buf.count;
+}
+
+void Tracer::setThreadName(const char *name)
+{
+    auto& buf = getThreadBuffer();
+    std::unique_lock<std::mutex> l(buf.mutex);
+    buf.name = name;
+}
+
+static void WriteEscaped(FILE *f, const char *str)
+{
+    for (const char *c = str; *c; ++c) {
+        if (*c == '"' || *c == '\\') { fputc('\\', f); }
+        fputc(*c, f);
+    }
+}
+
+bool Tracer::dump(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fcDebugLog("Tracer::dump(): failed to open %s", path);
+        return false;
+    }
+
+    std::unique_lock<std::mutex> l(m_mutex);
+    int generation = m_generation;
+    bool first = true;
+    auto separator = [&]() { fputs(first ? "\n" : ",\n", f); first = false; };
+
+    fputs("{\"traceEvents\":[", f);
+    for (auto& pbuf : m_buffers) {
+        auto& buf = *pbuf;
+        std::unique_lock<std::mutex> bl(buf.mutex);
+        if (buf.exited && !hasSpans(buf)) { continue; }
+        if (!buf.name.empty()) {
+            separator();
+            fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"", buf.id);
+            WriteEscaped(f, buf.name.c_str());
+            fputs("\"}}", f);
+        }
+        if (buf.generation != generation) { continue; }
+
+        size_t capacity = buf.spans.size();
+        uint64_t first_span = buf.count > capacity ? buf.count - capacity : 0;
+        for (uint64_t i = first_span; i < buf.count; ++i) {
+            auto& span = buf.spans[i % capacity];
+            if (span.begin < m_begin_time) { continue; }
+            separator();
+            fputs("{\"name\":\"", f);
+            WriteEscaped(f, span.name);
+            fprintf(f, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                buf.id, double(span.begin - m_begin_time) / 1000.0, double(span.end - span.begin) / 1000.0);
+        }
+    }
+    fputs("\n]}\n", f);
+    fclose(f);
+    return true;
+}
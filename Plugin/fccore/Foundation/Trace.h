@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+// records begin / end of pipeline stages into per-thread ring buffers, and dumps them as chrome trace event json
+// (can be viewed by chrome://tracing or ui.perfetto.dev). while tracing is off, a span costs one relaxed atomic load.
+class Tracer
+{
+public:
+    static const int DefaultCapacity = 65536;
+
+    static Tracer& getInstance();
+    static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+    static uint64_t now(); // in nanoseconds
+
+    // capacity: max number of spans kept per thread. older spans are overwritten.
+    void begin(int capacity);
+    void end();
+    bool dump(const char *path);
+
+    // name must be a string literal or others that live until dump()
+    void addSpan(const char *name, uint64_t begin_ns, uint64_t end_ns);
+    // name of current thread shown in traces
+    void setThreadName(const char *name);
+
+private:
+    struct Span
+    {
+        const char *name;
+        uint64_t begin, end;
+    };
+    struct ThreadBuffer
+    {
+        std::mutex mutex;
+        int id = 0;
+        int generation = -1;
+        std::string name;
+        std::vector<Span> spans;
+        uint64_t count = 0;
+        bool exited = false; // the thread is gone. a new thread takes the buffer over once dump() has nothing to write from it
+    };
+    using ThreadBufferPtr = std::shared_ptr<ThreadBuffer>;
+    // held by each thread. marks the buffer as exited at thread exit
+    struct ThreadBufferRef
+    {
+        ThreadBufferPtr buffer;
+        ~ThreadBufferRef();
+    };
+
+    ThreadBuffer& getThreadBuffer();
+    void resetIfOld(ThreadBuffer& buf);
+    bool hasSpans(const ThreadBuffer& buf) const;
+
+    static std::atomic_bool s_enabled;
+    std::mutex m_mutex;
+    std::vector<ThreadBufferPtr> m_buffers;
+    std::atomic_int m_generation = { 0 };
+    std::atomic_int m_capacity = { DefaultCapacity };
+    uint64_t m_begin_time = 0;
+};
+
+class TraceScope
+{
+public:
+    TraceScope(const char *name)
+        : m_name(Tracer::isEnabled() ? name : nullptr)
+    {
+        if (m_name) { m_begin = Tracer::now(); }
+    }
+    ~TraceScope()
+    {
+        if (m_name) { Tracer::getInstance().addSpan(m_name, m_begin, Tracer::now()); }
+    }
+
+private:
+    const char *m_name;
+    uint64_t m_begin = 0;
+};
+
+#define fcTraceConcat2(a, b) a##b
+#define fcTraceConcat(a, b) fcTraceConcat2(a, b)
+#define fcTraceScope(name) TraceScope fcTraceConcat(fc_trace_scope_, __LINE__)(name)
@@ -2,6 +2,8 @@
 #include "fcInternal.h"
 #include "YUV.h"
 #include "Misc.h"
+#include "Stats.h"
+#include "Trace.h"
 
 #include <libyuv.h>
 #ifdef _WIN32
@@ -39,13 +41,17 @@ const I420Data& I420Image::data() const
 
 void AnyToI420(I420Image& dst, Buffer& tmp, const void *pixels, fcPixelFormat fmt, int width, int height)
 {
+    fcTraceScope("AnyToI420");
+    auto *stats = ContextStats::getCurrent();
     if (fmt != fcPixelFormat_RGBAu8 && fmt != fcPixelFormat_RGBu8) {
+        ScopedLatency latency(stats, StatsStage::Convert);
         tmp.resize(width * height * 4);
         fcConvertPixelFormat(tmp.data(), fcPixelFormat_RGBAu8, pixels, fmt, width * height);
         pixels = tmp.data();
         fmt = fcPixelFormat_RGBAu8;
     }
 
+    ScopedLatency latency(stats, StatsStage::YUV);
     dst.resize(width, height);
     auto& data = dst.data();
     if (fmt == fcPixelFormat_RGBAu8) {
@@ -97,13 +103,17 @@ const NV12Data& NV12Image::data() const
 
 void AnyToNV12(NV12Image& dst, Buffer& tmp, const void *pixels, fcPixelFormat fmt, int width, int height)
 {
+    fcTraceScope("AnyToNV12");
+    auto *stats = ContextStats::getCurrent();
     if (fmt != fcPixelFormat_RGBAu8) {
+        ScopedLatency latency(stats, StatsStage::Convert);
         tmp.resize(width * height * 4);
         fcConvertPixelFormat(tmp.data(), fcPixelFormat_RGBAu8, pixels, fmt, width * height);
         pixels = tmp.data();
         fmt = fcPixelFormat_RGBAu8;
     }
 
+    ScopedLatency latency(stats, StatsStage::YUV);
     dst.resize(width, height);
     auto& data = dst.data();
     if (fmt == fcPixelFormat_RGBAu8) {
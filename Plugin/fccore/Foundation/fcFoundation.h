@@ -3,8 +3,21 @@
 #include "../fccore.h"
 #include "Misc.h"
 #include "Buffer.h"
+#include "ByteWriter.h"
+#include "BufferPool.h"
+#include "MemoryBudget.h"
+#include "SpillQueue.h"
+#include "FileStream.h"
+#include "AsyncStream.h"
+#include "ChunkedBufferStream.h"
+#include "RingStream.h"
+#include "PacketSinks.h"
 #include "PixelFormat.h"
 #include "YUV.h"
 #include "LazyInstance.h"
+#include "ThreadPool.h"
 #include "TaskGroup.h"
 #include "TaskQueue.h"
+#include "FrameQueue.h"
+#include "Stats.h"
+#include "Trace.h"
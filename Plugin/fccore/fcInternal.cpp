@@ -1,10 +1,19 @@
 #include "pch.h"
 #include "fcInternal.h"
 #include "Foundation/fcFoundation.h"
+#include <limits>
 
+// contexts are deleted (= finalized) in parallel on the worker pool
 class fcAsyncDeleteManager
 {
 public:
+    fcAsyncDeleteManager()
+    {
+        // make sure the thread pool outlives this. contexts being deleted may still use it.
+        ThreadPool::getInstance();
+        m_tasks.setMaxTasks(std::numeric_limits<int>::max());
+    }
+
     ~fcAsyncDeleteManager()
     {
         wait();
@@ -12,17 +21,69 @@ public:
 
     void wait()
     {
-        while (m_task_queue.feed()) {}
-        m_task_queue.wait();
+        m_tasks.wait();
     }
 
     void add(std::function<void()> v)
     {
-        m_task_queue.run(v);
+        m_tasks.run(v);
+    }
+
+private:
+    TaskGroup m_tasks;
+};
+
+
+struct fcFinalizeHandle
+{
+    using Lock = std::unique_lock<std::mutex>;
+
+    fcFinalizeHandle(fcFinalizeCallback cb, void *userdata)
+        : m_callback(cb), m_userdata(userdata)
+    {}
+
+    void addRef() { ++m_ref; }
+    void release() { if (--m_ref == 0) { delete this; } }
+
+    void setProgress(float v)
+    {
+        m_progress = v;
+        if (m_callback) { m_callback(m_userdata, v); }
+    }
+
+    // the callback comes first, so that it has been called when fcFinalizeWait() / fcFinalizeIsDone() see completion
+    void complete()
+    {
+        m_progress = 1.0f;
+        if (m_callback) { m_callback(m_userdata, 1.0f); }
+        {
+            Lock l(m_mutex);
+            m_done = true;
+        }
+        m_condition.notify_all();
+    }
+
+    bool isDone() const { return m_done; }
+    float getProgress() const { return m_progress; }
+
+    bool wait(int timeout_ms)
+    {
+        Lock l(m_mutex);
+        if (timeout_ms < 0) {
+            m_condition.wait(l, [this]() { return (bool)m_done; });
+            return true;
+        }
+        return m_condition.wait_for(l, std::chrono::milliseconds(timeout_ms), [this]() { return (bool)m_done; });
     }
 
 private:
-    TaskQueue m_task_queue;
+    fcFinalizeCallback m_callback = nullptr;
+    void *m_userdata = nullptr;
+    std::atomic_int m_ref = { 1 };
+    std::atomic<float> m_progress = { 0.0f };
+    std::atomic_bool m_done = { false };
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
 };
 
 static fcAsyncDeleteManager g_async_delete_manager;
@@ -39,6 +100,34 @@ fcAPI void fcWaitAsyncDelete()
     g_async_delete_manager.wait();
 }
 
+fcAPI fcFinalizeHandle* fcReleaseContextAsync(fcContextBase *ctx, fcFinalizeCallback cb, void *userdata)
+{
+    if (!ctx) { return nullptr; }
+    auto ret = new fcFinalizeHandle(cb, userdata);
+    ctx->releaseAsync(ret);
+    return ret;
+}
+
+fcAPI bool fcFinalizeIsDone(fcFinalizeHandle *h)
+{
+    return h ? h->isDone() : true;
+}
+
+fcAPI float fcFinalizeGetProgress(fcFinalizeHandle *h)
+{
+    return h ? h->getProgress() : 1.0f;
+}
+
+fcAPI bool fcFinalizeWait(fcFinalizeHandle *h, int timeout_ms)
+{
+    return h ? h->wait(timeout_ms) : true;
+}
+
+fcAPI void fcReleaseFinalizeHandle(fcFinalizeHandle *h)
+{
+    if (h) { h->release(); }
+}
+
 
 fcContextBase::~fcContextBase()
 {
@@ -53,7 +142,35 @@ void fcContextBase::release()
     else { delete this; }
 }
 
+void fcContextBase::releaseAsync(fcFinalizeHandle *handle)
+{
+    handle->addRef();
+    m_finalize_handle = handle;
+    g_async_delete_manager.add([this, handle]() {
+        delete this;
+        handle->complete();
+        handle->release();
+    });
+}
+
+void fcContextBase::setFinalizeProgress(float v)
+{
+    // 1.0 is reported by fcFinalizeHandle::complete() exactly once, after the context is deleted.
+    // contexts reach 1.0 on their last step (gif: last frame, mp4 / webm: last writer), which is not the end yet.
+    if (m_finalize_handle && v < 1.0f) { m_finalize_handle->setProgress(std::max(v, 0.0f)); }
+}
+
 void fcContextBase::setOnDeleteCallback(std::function<void()> v)
 {
     m_on_delete = v;
 }
+
+bool fcContextBase::getFrameStats(fcFrameStats& /*dst*/)
+{
+    return false;
+}
+
+bool fcContextBase::getContextStats(fcContextStats& /*dst*/)
+{
+    return false;
+}
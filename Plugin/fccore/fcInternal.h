@@ -53,6 +53,10 @@
 #endif
 
 
+struct fcFrameStats;
+struct fcContextStats;
+struct fcFinalizeHandle;
+
 class fcContextBase
 {
 protected:
@@ -60,9 +64,19 @@ protected:
 public:
     virtual void release();
     virtual void setOnDeleteCallback(std::function<void()> cb);
+    virtual bool getFrameStats(fcFrameStats& dst);
+    virtual bool getContextStats(fcContextStats& dst);
+    // delete this on the worker pool and notify completion to handle
+    virtual void releaseAsync(fcFinalizeHandle *handle);
+
+protected:
+    // can be called from destructors of derived classes to report finalization progress (0.0 - 1.0).
+    // 1.0 is not passed to the callback here: it is reported once when the deletion has completed.
+    void setFinalizeProgress(float v);
 
 private:
     std::function<void()> m_on_delete;
+    fcFinalizeHandle *m_finalize_handle = nullptr;
 };
 
 #include "fccore.h"
@@ -2,9 +2,9 @@
 #include "fcInternal.h"
 #include "Foundation/fcFoundation.h"
 #include "GraphicsDevice/fcGraphicsDevice.h"
+#include <set>
 
-//#define fcTraceFunc(...)  DebugLogImpl(__FUNCTION__ "\n")
-#define fcTraceFunc(...)
+#define fcTraceFunc(...)  fcTraceScope(__FUNCTION__)
 
 
 
@@ -34,15 +34,144 @@ fcAPI fcTime fcGetTime()
     return GetCurrentTimeInSeconds();
 }
 
+fcAPI void fcSetSchedulerConfig(const fcSchedulerConfig *conf)
+{
+    fcTraceFunc();
+    fcSchedulerConfig default_conf;
+    if (conf == nullptr) { conf = &default_conf; }
+    auto& pool = ThreadPool::getInstance();
+    pool.setMaxWorkers(conf->max_workers);
+
+    ThreadPool::ThreadConfig tconf;
+    tconf.affinity_mask = conf->affinity_mask;
+    tconf.priority = conf->thread_priority;
+    if (conf->thread_name) { tconf.name = conf->thread_name; }
+    pool.setThreadConfig(tconf);
+}
+
+// names returned by fcGetSchedulerConfig() are interned, so that they outlive later fcSetSchedulerConfig() calls
+static const char* InternThreadName(const std::string& name)
+{
+    static std::mutex s_mutex;
+    static std::set<std::string> s_names;
+    std::unique_lock<std::mutex> lock(s_mutex);
+    return s_names.insert(name).first->c_str();
+}
+
+fcAPI void fcGetSchedulerConfig(fcSchedulerConfig *conf)
+{
+    fcTraceFunc();
+    if (conf == nullptr) { return; }
+    auto& pool = ThreadPool::getInstance();
+    conf->max_workers = pool.getMaxWorkers();
+
+    auto tconf = pool.getThreadConfig();
+    conf->affinity_mask = tconf.affinity_mask;
+    conf->thread_priority = tconf.priority;
+    conf->thread_name = InternThreadName(tconf.name);
+}
+
+fcAPI void fcTraceBegin(int max_spans_per_thread)
+{
+    Tracer::getInstance().begin(max_spans_per_thread);
+}
+
+fcAPI void fcTraceEnd()
+{
+    Tracer::getInstance().end();
+}
+
+fcAPI bool fcTraceDump(const char *path)
+{
+    if (!path) { return false; }
+    return Tracer::getInstance().dump(path);
+}
+
+fcAPI void fcBufferPoolSetMaxIdleBytes(uint64_t max_idle_bytes)
+{
+    BufferPool::getInstance().setMaxIdleBytes(max_idle_bytes);
+}
+
+fcAPI void fcBufferPoolTrim(uint64_t max_idle_bytes)
+{
+    fcTraceFunc();
+    BufferPool::getInstance().trim(max_idle_bytes);
+}
+
+fcAPI void fcBufferPoolGetStats(fcBufferPoolStats *dst)
+{
+    if (!dst) { return; }
+    BufferPool::getInstance().getStats(*dst);
+}
+
+fcAPI void fcSetMemoryBudget(uint64_t bytes)
+{
+    MemoryBudget::getInstance().setBudget(bytes);
+}
+
+fcAPI uint64_t fcGetMemoryBudget()
+{
+    return MemoryBudget::getInstance().getBudget();
+}
+
+fcAPI uint64_t fcGetMemoryUsage()
+{
+    return MemoryBudget::getInstance().getUsage();
+}
+
+fcAPI uint64_t fcGetPeakMemoryUsage()
+{
+    return MemoryBudget::getInstance().getPeakUsage();
+}
+
+fcAPI void fcSetSpillDirectory(const char *path)
+{
+    SetSpillDirectory(path);
+}
+
 fcAPI fcStream* fcCreateFileStream(const char *path)
 {
     fcTraceFunc();
     return new StdIOStream(new std::fstream(path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc), true);
 }
-fcAPI fcStream* fcCreateMemoryStream()
+fcAPI fcStream* fcCreateBufferedFileStream(const char *path, const fcFileStreamConfig *conf)
+{
+    fcTraceFunc();
+    fcFileStreamConfig default_conf;
+    auto ret = new FileStream(path, conf ? *conf : default_conf);
+    if (!ret->isValid()) {
+        ret->release();
+        return nullptr;
+    }
+    return ret;
+}
+fcAPI fcStream* fcCreateAsyncStream(fcStream *sink, const fcAsyncStreamConfig *conf)
+{
+    fcTraceFunc();
+    if (!sink) { return nullptr; }
+    fcAsyncStreamConfig default_conf;
+    return new AsyncStream(sink, conf ? *conf : default_conf);
+}
+fcAPI int fcFileStreamGetError(fcStream *s)
+{
+    fcTraceFunc();
+    auto fs = dynamic_cast<FileStream*>(s);
+    if (!fs) { return 0; }
+    fs->flush();
+    return fs->getError();
+}
+fcAPI bool fcGetAsyncStreamStats(fcStream *s, fcAsyncStreamStats *dst)
 {
     fcTraceFunc();
-    return new BufferStream(new Buffer(), true);
+    auto as = dynamic_cast<AsyncStream*>(s);
+    if (!as || !dst) { return false; }
+    as->getStats(*dst);
+    return true;
+}
+fcAPI fcStream* fcCreateMemoryStream(int chunk_size)
+{
+    fcTraceFunc();
+    return new ChunkedBufferStream(chunk_size > 0 ? (size_t)chunk_size : ChunkedBufferStream::DefaultSegmentSize);
 }
 fcAPI fcStream* fcCreateCustomStream(void *obj, fcTellp_t tellp, fcSeekp_t seekp, fcWrite_t write)
 {
@@ -65,13 +194,59 @@ fcAPI fcBufferData fcStreamGetBufferData(fcStream *s)
 {
     fcTraceFunc();
     fcBufferData ret;
-    if (BufferStream *bs = dynamic_cast<BufferStream*>(s)) {
+    if (auto cs = dynamic_cast<ChunkedBufferStream*>(s)) {
+        ret = cs->compact();
+    }
+    else if (auto bs = dynamic_cast<BufferStream*>(s)) {
         ret.data = bs->get().data();
         ret.size = bs->get().size();
     }
     return ret;
 }
 
+fcAPI fcStream* fcCreateRingStream(size_t capacity, fcSinkLagPolicy lag_policy)
+{
+    fcTraceFunc();
+    return new RingStream(capacity, lag_policy);
+}
+
+fcAPI bool fcRingStreamPeek(fcStream *s, fcBufferData *dst, int timeout_ms)
+{
+    auto rs = dynamic_cast<RingStream*>(s);
+    return rs && dst ? rs->peek(*dst, timeout_ms) : false;
+}
+
+fcAPI void fcRingStreamAdvance(fcStream *s, size_t n)
+{
+    if (auto rs = dynamic_cast<RingStream*>(s)) { rs->advance(n); }
+}
+
+fcAPI void fcRingStreamClose(fcStream *s)
+{
+    fcTraceFunc();
+    if (auto rs = dynamic_cast<RingStream*>(s)) { rs->close(); }
+}
+
+fcAPI uint64_t fcRingStreamGetDroppedPatchBytes(fcStream *s)
+{
+    auto rs = dynamic_cast<RingStream*>(s);
+    return rs ? rs->getDroppedPatchBytes() : 0;
+}
+
+fcAPI int fcStreamGetNumChunks(fcStream *s)
+{
+    fcTraceFunc();
+    auto cs = dynamic_cast<ChunkedBufferStream*>(s);
+    return cs ? cs->getNumChunks() : 0;
+}
+
+fcAPI fcBufferData fcStreamGetChunk(fcStream *s, int i)
+{
+    fcTraceFunc();
+    auto cs = dynamic_cast<ChunkedBufferStream*>(s);
+    return cs ? cs->getChunk(i) : fcBufferData();
+}
+
 fcAPI uint64_t fcStreamGetWrittenSize(fcStream *s)
 {
     fcTraceFunc();
@@ -85,88 +260,209 @@ fcAPI uint64_t fcStreamGetWrittenSize(fcStream *s)
 
 using fcDeferredCall = std::function<void()>;
 namespace {
-    std::mutex g_deferred_calls_mutex;
-    std::vector<fcDeferredCall> g_deferred_calls;
-}
 
+// fixed size slot table. id is (generation << IndexBits) | index, so a stale id of a released slot never hits a reused one.
+// calls from rendering thread take no lock: a slot counts its calls in flight, and whoever invalidates the slot
+// (release(), set(), exclude()) makes its change first and then waits for the count to drop to 0. all these atomics are
+// sequentially consistent, so either a call sees the change, or the waiter sees the call.
+// one camera's readback therefore only holds up the release of its own slot, not other slots or fcGuardBegin() callers
+// waiting on a process-wide lock. allocation and release are done by the main thread and guarded by a mutex.
+class fcDeferredCallTable
+{
+public:
+    static const int IndexBits = 10;
+    static const int Capacity = 1 << IndexBits; // 0th slot is "null" object
+    static const int GenerationMask = (1 << (31 - IndexBits)) - 1;
+
+    fcDeferredCallTable()
+    {
+        for (int i = Capacity - 1; i > 0; --i) { m_free.push_back(i); }
+    }
+
+    ~fcDeferredCallTable()
+    {
+        for (auto& slot : m_slots) { delete slot.call.load(); }
+    }
+
+    int allocate()
+    {
+        std::unique_lock<std::mutex> l(m_mutex);
+        if (m_free.empty()) {
+            fcDebugLog("fcDeferredCallTable::allocate(): out of slots");
+            return 0;
+        }
+        int index = m_free.back();
+        m_free.pop_back();
+        return makeID(index, m_slots[index].generation);
+    }
+
+    // waits for a call of id in progress. must not be called from a deferred call.
+    void release(int id)
+    {
+        auto *slot = find(id);
+        if (!slot) { return; }
+
+        std::unique_lock<std::mutex> l(m_mutex);
+        if (slot->generation != getGeneration(id)) { return; }
+        // invalidate id first, then the callback
+        slot->generation = (slot->generation + 1) & GenerationMask;
+        delete retire(*slot, nullptr);
+        m_free.push_back(getIndex(id));
+    }
+
+    bool set(int id, const fcDeferredCall& dc)
+    {
+        auto *slot = find(id);
+        if (!slot) { return false; }
+        delete retire(*slot, new fcDeferredCall(dc));
+        return true;
+    }
+
+    // **called from rendering thread**
+    // top_level: false for ids called by a batch. the batch's own slot already counts as in flight for exclude()
+    void call(int id, bool top_level)
+    {
+        auto *slot = find(id);
+        if (!slot) { return; }
+        for (;;) {
+            ++slot->in_flight;
+            if (!top_level || m_excluded == 0) { break; }
+            --slot->in_flight;
+            std::unique_lock<std::mutex> l(m_exclude_mutex);
+            m_exclude_cond.wait(l, [this]() { return m_excluded == 0; });
+        }
+        // the slot may have been released and reused since find()
+        if (slot->generation == getGeneration(id)) {
+            auto *dc = slot->call.load();
+            if (dc && *dc) { (*dc)(); }
+        }
+        --slot->in_flight;
+    }
+
+    // for fcGuardBegin() / fcGuardEnd(): wait for calls in progress and hold new ones off until include()
+    void exclude()
+    {
+        {
+            std::unique_lock<std::mutex> l(m_exclude_mutex);
+            ++m_excluded;
+        }
+        for (auto& slot : m_slots) { waitIdle(slot); }
+    }
+
+    void include()
+    {
+        {
+            std::unique_lock<std::mutex> l(m_exclude_mutex);
+            --m_excluded;
+        }
+        m_exclude_cond.notify_all();
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic_int generation = { 0 };
+        std::atomic_int in_flight = { 0 };      // calls running on this slot
+        std::atomic<fcDeferredCall*> call = { nullptr };
+    };
+
+    static int makeID(int index, int generation) { return (generation << IndexBits) | index; }
+    static int getIndex(int id) { return id & (Capacity - 1); }
+    static int getGeneration(int id) { return (id >> IndexBits) & GenerationMask; }
+
+    Slot* find(int id)
+    {
+        int index = getIndex(id);
+        if (id <= 0 || index == 0) { return nullptr; }
+        auto& slot = m_slots[index];
+        return slot.generation == getGeneration(id) ? &slot : nullptr;
+    }
+
+    // replace the callback and return the old one once no call can be using it
+    fcDeferredCall* retire(Slot& slot, fcDeferredCall *dc)
+    {
+        auto *old = slot.call.exchange(dc);
+        waitIdle(slot);
+        return old;
+    }
+
+    static void waitIdle(Slot& slot)
+    {
+        while (slot.in_flight > 0) { std::this_thread::yield(); }
+    }
+
+private:
+    Slot m_slots[Capacity];
+    std::mutex m_mutex;
+    std::vector<int> m_free;
+
+    std::atomic_int m_excluded = { 0 };
+    std::mutex m_exclude_mutex;
+    std::condition_variable m_exclude_cond;
+};
+
+fcDeferredCallTable g_deferred_calls;
+
+} // namespace
+
+// excludes deferred calls on the rendering thread: waits for calls in progress, and new ones wait until fcGuardEnd().
+// release contexts that deferred calls refer to between these, so that a call in progress never runs into a deleted context.
+// releasing the ids of those calls with fcReleaseDeferredCall() first does the same without holding off other calls.
 fcAPI void fcGuardBegin()
 {
     fcTraceFunc();
-    g_deferred_calls_mutex.lock();
+    g_deferred_calls.exclude();
 }
 
 fcAPI void fcGuardEnd()
 {
     fcTraceFunc();
-    g_deferred_calls_mutex.unlock();
+    g_deferred_calls.include();
 }
 
 fcAPI int fcAllocateDeferredCall()
 {
     fcTraceFunc();
-
-    // search empty object and return its position if found
-    for (int i = 1; i < (int)g_deferred_calls.size(); ++i) {
-        if (!g_deferred_calls[i]) {
-            g_deferred_calls[i] = fcDeferredCall();
-            return i;
-        }
-    }
-
-    // 0th is "null" object
-    if (g_deferred_calls.empty()) { g_deferred_calls.emplace_back(fcDeferredCall()); }
-
-    // allocate new one
-    g_deferred_calls.emplace_back(fcDeferredCall());
-    return (int)g_deferred_calls.size() - 1;
+    return g_deferred_calls.allocate();
 }
 
 fcAPI int fcAddDeferredCall(const fcDeferredCall& dc, int id)
 {
     fcTraceFunc();
     if (id <= 0) {
-        // search empty object and return its position if found
-        for (int i = 1; i < (int)g_deferred_calls.size(); ++i) {
-            if (!g_deferred_calls[i]) {
-                g_deferred_calls[i] = dc;
-                return i;
-            }
-        }
-
-        // 0th is "null" object
-        if (g_deferred_calls.empty()) { g_deferred_calls.emplace_back(fcDeferredCall()); }
-
-        // allocate new one
-        g_deferred_calls.emplace_back(dc);
-        return (int)g_deferred_calls.size() - 1;
+        id = g_deferred_calls.allocate();
     }
-    else if(id < (int)g_deferred_calls.size()) {
-        g_deferred_calls[id] = dc;
-        return id;
-    }
-    else {
-        fcDebugLog("fcAddDeferredCall(): should not be here");
+    if (!g_deferred_calls.set(id, dc)) {
+        fcDebugLog("fcAddDeferredCall(): invalid id");
         return 0;
     }
+    return id;
 }
 
+// waits for a call of id in progress. after this, the call doesn't touch what it captured
 fcAPI void fcReleaseDeferredCall(int id)
 {
     fcTraceFunc();
-    if (id <= 0 || id >= (int)g_deferred_calls.size()) { return; }
-
-    g_deferred_calls[id] = fcDeferredCall();
+    g_deferred_calls.release(id);
 }
 
 // **called from rendering thread**
 fcAPI void fcCallDeferredCall(int id)
 {
     fcTraceFunc();
-    std::unique_lock<std::mutex> l(g_deferred_calls_mutex);
-    if (id <= 0 || id >= (int)g_deferred_calls.size()) { return; }
+    g_deferred_calls.call(id, true);
+}
 
-    auto& dc = g_deferred_calls[id];
-    if (dc) { dc(); }
+// make a deferred call that calls all of ids in one render event. e.g. readback textures of all cameras at once.
+// ids are evaluated when the batch is called, so ids that are released by then are just skipped.
+fcAPI int fcAddDeferredCallBatch(const int *ids_, int num, int id)
+{
+    fcTraceFunc();
+    if (!ids_ || num <= 0) { return 0; }
+    std::vector<int> ids(ids_, ids_ + num);
+    return fcAddDeferredCall([ids]() {
+        for (int i : ids) { g_deferred_calls.call(i, false); }
+    }, id);
 }
 
 
@@ -184,6 +480,20 @@ fcAPI void fcSetOnDeleteCallback(fcContextBase *ctx, void(*cb)(void*), void *par
     ctx->setOnDeleteCallback([cb, param]() { cb(param); });
 }
 
+fcAPI bool fcGetFrameStats(fcContextBase *ctx, fcFrameStats *dst)
+{
+    fcTraceFunc();
+    if (!ctx || !dst) { return false; }
+    return ctx->getFrameStats(*dst);
+}
+
+fcAPI bool fcGetContextStats(fcContextBase *ctx, fcContextStats *dst)
+{
+    fcTraceFunc();
+    if (!ctx || !dst) { return false; }
+    return ctx->getContextStats(*dst);
+}
+
 
 // -------------------------------------------------------------
 // PNG Exporter
@@ -214,6 +524,13 @@ fcAPI bool fcPngExportTexture(fcIPngContext *ctx, const char *path, void *tex, i
     return ctx->exportTexture(path, tex, width, height, fmt, num_channels);
 }
 
+fcAPI bool fcPngExportPixelsBorrowed(fcIPngContext *ctx, const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, int num_channels, fcReleasePixels release, void *userdata)
+{
+    fcTraceFunc();
+    if (!ctx || !pixels || !release) { return false; }
+    return ctx->exportPixels(path, pixels, width, height, fmt, num_channels, release, userdata);
+}
+
 fcAPI int fcPngExportTextureDeferred(fcIPngContext *ctx, const char *path_, void *tex, int width, int height, fcPixelFormat fmt, int num_channels, int id)
 {
     fcTraceFunc();
@@ -231,6 +548,7 @@ fcAPI bool fcPngIsSupported() { return false; }
 fcAPI fcIPngContext* fcPngCreateContext(const fcPngConfig *conf) { return nullptr; }
 fcAPI bool fcPngExportPixels(fcIPngContext *ctx, const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, int num_channels) { return false; }
 fcAPI bool fcPngExportTexture(fcIPngContext *ctx, const char *path, void *tex, int width, int height, fcPixelFormat fmt, int num_channels) { return false; }
+fcAPI bool fcPngExportPixelsBorrowed(fcIPngContext *ctx, const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, int num_channels, fcReleasePixels release, void *userdata) { return false; }
 fcAPI int fcPngExportTextureDeferred(fcIPngContext *ctx, const char *path_, void *tex, int width, int height, fcPixelFormat fmt, int num_channels, int id) { return 0; }
 
 #endif // fcSupportPNG
@@ -279,6 +597,13 @@ fcAPI bool fcExrEndImage(fcIExrContext *ctx)
     return ctx->endFrame();
 }
 
+fcAPI bool fcExrAddLayerPixelsBorrowed(fcIExrContext *ctx, const void *pixels, fcPixelFormat fmt, int ch, const char *name, fcReleasePixels release, void *userdata)
+{
+    fcTraceFunc();
+    if (!ctx || !pixels || !release) { return false; }
+    return ctx->addLayerPixels(pixels, fmt, ch, name, release, userdata);
+}
+
 fcAPI int fcExrBeginImageDeferred(fcIExrContext *ctx, const char *path_, int width, int height, int id)
 {
     fcTraceFunc();
@@ -316,6 +641,7 @@ fcAPI bool fcExrBeginImage(fcIExrContext *ctx, const char *path, int width, int
 fcAPI bool fcExrAddLayerPixels(fcIExrContext *ctx, const void *pixels, fcPixelFormat fmt, int ch, const char *name) { return false; }
 fcAPI bool fcExrAddLayerTexture(fcIExrContext *ctx, void *tex, fcPixelFormat fmt, int ch, const char *name) { return false; }
 fcAPI bool fcExrEndImage(fcIExrContext *ctx) { return false; }
+fcAPI bool fcExrAddLayerPixelsBorrowed(fcIExrContext *ctx, const void *pixels, fcPixelFormat fmt, int ch, const char *name, fcReleasePixels release, void *userdata) { return false; }
 fcAPI int fcExrBeginImageDeferred(fcIExrContext *ctx, const char *path_, int width, int height, int id) { return 0; }
 fcAPI int fcExrAddLayerTextureDeferred(fcIExrContext *ctx, void *tex, fcPixelFormat fmt, int ch, const char *name_, int id) { return 0; }
 fcAPI int fcExrEndImageDeferred(fcIExrContext *ctx, int id) { return 0; }
@@ -357,6 +683,13 @@ fcAPI bool fcGifAddFrameTexture(fcIGifContext *ctx, void *tex, fcPixelFormat fmt
     if (!ctx) { return false; }
     return ctx->addFrameTexture(tex, fmt, timestamp);
 }
+
+fcAPI bool fcGifAddFramePixelsBorrowed(fcIGifContext *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata)
+{
+    fcTraceFunc();
+    if (!ctx || !pixels || !release) { return false; }
+    return ctx->addFramePixels(pixels, fmt, timestamp, release, userdata);
+}
 fcAPI int fcGifAddFrameTextureDeferred(fcIGifContext *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp, int id)
 {
     fcTraceFunc();
@@ -379,6 +712,7 @@ fcAPI fcIGifContext* fcGifCreateContext(const fcGifConfig *conf) { return nullpt
 fcAPI void fcGifAddOutputStream(fcIGifContext *ctx, fcStream *stream) {}
 fcAPI bool fcGifAddFramePixels(fcIGifContext *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp) { return false; }
 fcAPI bool fcGifAddFrameTexture(fcIGifContext *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp) { return false; }
+fcAPI bool fcGifAddFramePixelsBorrowed(fcIGifContext *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata) { return false; }
 fcAPI int fcGifAddFrameTextureDeferred(fcIGifContext *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp, int id) { return 0; }
 fcAPI void fcGifForceKeyframe(fcIGifContext *ctx) {}
 
@@ -428,6 +762,12 @@ fcAPI void fcMP4AddOutputStream(fcIMP4Context *ctx, fcStream *stream)
     ctx->addOutputStream(stream);
 }
 
+fcAPI void fcMP4AddPacketCallback(fcIMP4Context *ctx, fcPacketCallback cb, void *userdata)
+{
+    if (!ctx) { return; }
+    ctx->addPacketCallback(cb, userdata);
+}
+
 fcAPI bool fcMP4AddVideoFramePixels(fcIMP4Context *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp)
 {
     fcTraceFunc();
@@ -440,6 +780,13 @@ fcAPI bool fcMP4AddVideoFrameTexture(fcIMP4Context *ctx, void *tex, fcPixelForma
     if (!ctx) { return false; }
     return ctx->addVideoFrameTexture(tex, fmt, timestamp);
 }
+
+fcAPI bool fcMP4AddVideoFramePixelsBorrowed(fcIMP4Context *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata)
+{
+    fcTraceFunc();
+    if (!ctx || !pixels || !release) { return false; }
+    return ctx->addVideoFramePixels(pixels, fmt, timestamp, release, userdata);
+}
 fcAPI int fcMP4AddVideoFrameTextureDeferred(fcIMP4Context *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp, int id)
 {
     fcTraceFunc();
@@ -464,8 +811,10 @@ fcAPI fcIMP4Context* fcMP4OSCreateContext(fcMP4Config *conf, const char *out_pat
 fcAPI const char* fcMP4GetVideoEncoderInfo(fcIMP4Context *ctx) { return ""; }
 fcAPI const char* fcMP4GetAudioEncoderInfo(fcIMP4Context *ctx) { return ""; }
 fcAPI void fcMP4AddOutputStream(fcIMP4Context *ctx, fcStream *stream) {}
+fcAPI void fcMP4AddPacketCallback(fcIMP4Context *ctx, fcPacketCallback cb, void *userdata) {}
 fcAPI bool fcMP4AddVideoFramePixels(fcIMP4Context *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp) { return false; }
 fcAPI bool fcMP4AddVideoFrameTexture(fcIMP4Context *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp) { return false; }
+fcAPI bool fcMP4AddVideoFramePixelsBorrowed(fcIMP4Context *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata) { return false; }
 fcAPI int fcMP4AddVideoFrameTextureDeferred(fcIMP4Context *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp, int id) { return 0; }
 fcAPI bool fcMP4AddAudioSamples(fcIMP4Context *ctx, const float *samples, int num_samples) { return false; }
 
@@ -494,6 +843,12 @@ fcAPI void fcWebMAddOutputStream(fcIWebMContext *ctx, fcStream *stream)
     ctx->addOutputStream(stream);
 }
 
+fcAPI void fcWebMAddPacketCallback(fcIWebMContext *ctx, fcPacketCallback cb, void *userdata)
+{
+    if (!ctx) { return; }
+    ctx->addPacketCallback(cb, userdata);
+}
+
 fcAPI bool fcWebMAddVideoFramePixels(fcIWebMContext *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp)
 {
     fcTraceFunc();
@@ -508,6 +863,13 @@ fcAPI bool fcWebMAddVideoFrameTexture(fcIWebMContext *ctx, void *tex, fcPixelFor
     return ctx->addVideoFrameTexture(tex, fmt, timestamp);
 }
 
+fcAPI bool fcWebMAddVideoFramePixelsBorrowed(fcIWebMContext *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata)
+{
+    fcTraceFunc();
+    if (!ctx || !pixels || !release) { return false; }
+    return ctx->addVideoFramePixels(pixels, fmt, timestamp, release, userdata);
+}
+
 fcAPI int fcWebMAddVideoFrameTextureDeferred(fcIWebMContext *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp, int id)
 {
     fcTraceFunc();
@@ -529,8 +891,10 @@ fcAPI bool fcWebMAddAudioSamples(fcIWebMContext *ctx, const float *samples, int
 fcAPI bool fcWebMIsSupported() { return false; }
 fcAPI fcIWebMContext* fcWebMCreateContext(fcWebMConfig *conf) { return nullptr; }
 fcAPI void fcWebMAddOutputStream(fcIWebMContext *ctx, fcStream *stream) {}
+fcAPI void fcWebMAddPacketCallback(fcIWebMContext *ctx, fcPacketCallback cb, void *userdata) {}
 fcAPI bool fcWebMAddVideoFramePixels(fcIWebMContext *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp) { return false; }
 fcAPI bool fcWebMAddVideoFrameTexture(fcIWebMContext *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp) { return false; }
+fcAPI bool fcWebMAddVideoFramePixelsBorrowed(fcIWebMContext *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata) { return false; }
 fcAPI int fcWebMAddVideoFrameTextureDeferred(fcIWebMContext *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp, int id) { return 0; }
 fcAPI bool fcWebMAddAudioSamples(fcIWebMContext *ctx, const float *samples, int num_samples) { return false; }
 
@@ -57,6 +57,24 @@ enum class fcBitrateMode
     VBR,
 };
 
+// all encoder tasks run on one shared scheduler. higher priority tasks are processed first.
+enum class fcTaskPriority
+{
+    RealTime,   // video / audio streams
+    Normal,
+    Background, // image sequences
+};
+
+// what to do when a frame is added while the encoder is behind and all frame buffers are in use.
+enum class fcBackpressurePolicy
+{
+    Block,      // wait until the encoder catches up. stalls the caller
+    DropNewest, // discard the incoming frame
+    DropOldest, // discard the oldest frame that is queued but not being encoded yet. (GIF: same as DropNewest)
+    Grow,       // allocate more buffers up to backpressure_memory_limit, then discard the incoming frame
+    Spill,      // write the incoming frame to a temporary file and encode it later, in order. for offline capture. (GIF: same as Block)
+};
+
 
 // -------------------------------------------------------------
 // Foundation
@@ -72,6 +90,52 @@ fcAPI void            fcSetModulePath(const char *path);
 fcAPI const char*     fcGetModulePath();
 fcAPI fcTime          fcGetTime(); // current time in seconds
 
+struct fcSchedulerConfig
+{
+    int max_workers = 0; // global worker budget shared by all contexts. <= 0: number of logical cores - 1
+    uint64_t affinity_mask = 0; // cores workers can run on. bit n: core n. 0: all cores
+    int thread_priority = 0; // nice value. -20 (highest) to 19 (lowest). mapped to THREAD_PRIORITY_* on Windows
+    const char *thread_name = "fcWorker"; // workers are named "<thread_name><index>". keep it short (linux allows 15 chars). null: "fcWorker"
+};
+fcAPI void            fcSetSchedulerConfig(const fcSchedulerConfig *conf);
+// thread_name of the result stays valid until the process exits
+fcAPI void            fcGetSchedulerConfig(fcSchedulerConfig *conf);
+
+// record begin / end of each pipeline stage (readback, conversion, encode, mux, stream write) on every thread.
+// fcTraceDump() writes them as chrome trace event json (open with chrome://tracing or ui.perfetto.dev).
+// max_spans_per_thread: size of the per-thread ring buffer. <= 0: default (65536). older spans are overwritten.
+fcAPI void            fcTraceBegin(int max_spans_per_thread);
+fcAPI void            fcTraceEnd();
+fcAPI bool            fcTraceDump(const char *path);
+
+// frame buffers of all contexts are drawn from one process-wide pool, so that recorders share idle memory.
+struct fcBufferPoolStats
+{
+    uint64_t idle_bytes = 0;        // buffers waiting in the pool
+    uint64_t peak_idle_bytes = 0;
+    uint64_t in_use_bytes = 0;      // buffers taken from the pool and not returned yet
+    uint64_t peak_in_use_bytes = 0;
+    uint64_t num_allocations = 0;   // requests that needed a new buffer
+    uint64_t num_reuses = 0;        // requests served by an idle buffer
+    uint64_t num_trimmed = 0;       // idle buffers freed by fcBufferPoolTrim() or max idle bytes
+};
+// buffers returned while the pool holds more than max_idle_bytes are freed instead. default: 256MB
+fcAPI void            fcBufferPoolSetMaxIdleBytes(uint64_t max_idle_bytes);
+// free idle buffers (larger ones first) until idle bytes <= max_idle_bytes. 0: free all of them
+fcAPI void            fcBufferPoolTrim(uint64_t max_idle_bytes);
+fcAPI void            fcBufferPoolGetStats(fcBufferPoolStats *dst);
+
+// process-wide limit of frame data held by all contexts: frames waiting for or being encoded, and encoded data waiting to be written.
+// when a new frame would exceed it, the context applies its backpressure policy (Grow: discard the frame).
+// png / exr contexts wait until it fits. 0: unlimited (default)
+fcAPI void            fcSetMemoryBudget(uint64_t bytes);
+fcAPI uint64_t        fcGetMemoryBudget();
+fcAPI uint64_t        fcGetMemoryUsage();
+fcAPI uint64_t        fcGetPeakMemoryUsage();
+
+// directory to create temporary files of fcBackpressurePolicy::Spill. null or empty: system temporary directory (default)
+fcAPI void            fcSetSpillDirectory(const char *path);
+
 
 #ifndef fcImpl
 struct fcStream;
@@ -92,10 +156,59 @@ struct fcBufferData
     size_t size = 0;
 };
 fcAPI fcStream*       fcCreateFileStream(const char *path);
-fcAPI fcStream*       fcCreateMemoryStream();
+
+struct fcFileStreamConfig
+{
+    int buffer_size = 1024 * 1024;  // write-behind buffer size in bytes
+    int num_buffers = 4;            // writes block when all buffers are waiting for the disk
+    uint64_t preallocate_size = 0;  // reserve disk space in chunks of this size as the file grows (linux). 0: disabled
+    bool use_io_uring = false;      // linux: writes are queued to io_uring from registered buffers instead of the I/O thread. ignored if unavailable
+    bool direct_io = false;         // bypass the page cache, so that long captures don't evict the game's data (linux: O_DIRECT, mac: F_NOCACHE). takes precedence over use_io_uring
+};
+// file stream on a native file descriptor. writes are packed into buffers and written to the file by a background I/O thread.
+// faster than fcCreateFileStream() (std::fstream) for many small writes. return null if the file can't be opened.
+fcAPI fcStream*       fcCreateBufferedFileStream(const char *path, const fcFileStreamConfig *conf = nullptr);
+// errno of the first failed write to the file (e.g. ENOSPC), 0 if none. s must be created by fcCreateBufferedFileStream(), otherwise return 0.
+// the file is written in the background, so a failure shows up later than the write. after it, writes are rejected and fcStreamGetWrittenSize() stops growing.
+// pending writes are flushed first: call this when no context is writing to s, e.g. after releasing them.
+fcAPI int             fcFileStreamGetError(fcStream *s);
+// memory stream made of fixed-size chunks, so that growing doesn't copy the recording so far.
+// chunk_size: 0 is default (1MB)
+fcAPI fcStream*       fcCreateMemoryStream(int chunk_size = 0);
 fcAPI fcStream*       fcCreateCustomStream(void *obj, fcTellp_t tellp, fcSeekp_t seekp, fcWrite_t write);
 fcAPI void            fcReleaseStream(fcStream *s);
-fcAPI fcBufferData    fcStreamGetBufferData(fcStream *s); // s must be created by fcCreateMemoryStream(), otherwise return {nullptr, 0}.
+// s must be created by fcCreateMemoryStream(), otherwise return {nullptr, 0}.
+// chunks are merged into one buffer on the first call (and on calls after more writes). use chunks below to avoid the copy.
+fcAPI fcBufferData    fcStreamGetBufferData(fcStream *s);
+// chunks of memory stream in order. their concatenation is the whole data. valid until the next write to s
+fcAPI int             fcStreamGetNumChunks(fcStream *s);
+fcAPI fcBufferData    fcStreamGetChunk(fcStream *s, int i);
+
+// what a stream does when its reader (the sink of fcCreateAsyncStream(), the consumer of fcCreateRingStream()) falls behind
+enum class fcSinkLagPolicy
+{
+    Block,  // wait until the sink catches up. stalls the context, as without the async stream
+    Detach, // stop writing to the sink and discard its queue. the output of the sink is incomplete, but other sinks keep going
+};
+
+// stream on a ring buffer of capacity bytes, to pull encoded data out of a running context (e.g. for live upload)
+// without a file and without copying in a callback. a consumer thread reads with fcRingStreamPeek() / fcRingStreamAdvance().
+// lag_policy applies while the ring is full:
+//   Block: writes wait until the consumer advances. the consumer must not run on a thread that adds frames or releases the context:
+//          e.g. polling fcRingStreamPeek(s, &d, 0) in the same loop that feeds frames dead-locks as soon as the ring fills up.
+//   Detach: the stream is closed as by fcRingStreamClose(). the consumer gets what the ring holds, and the rest of the output is discarded.
+// containers patch headers by seeking back. such writes change only bytes the consumer hasn't peeked yet, and the rest is dropped.
+// so use append-only modes: fcWebMConfig::live, Ogg. mp4 / wave / flac patch their headers at the end and would be incomplete.
+fcAPI fcStream*       fcCreateRingStream(size_t capacity, fcSinkLagPolicy lag_policy = fcSinkLagPolicy::Block);
+// get readable bytes from the read cursor in place. they stay valid until fcRingStreamAdvance().
+// wait up to timeout_ms (-1: forever) for data. return false on timeout, or if the stream is closed and drained.
+fcAPI bool            fcRingStreamPeek(fcStream *s, fcBufferData *dst, int timeout_ms);
+// consume n bytes from the read cursor
+fcAPI void            fcRingStreamAdvance(fcStream *s, size_t n);
+// end of the stream. the consumer can read what is left, and later writes are discarded (also unblocks waiting writes)
+fcAPI void            fcRingStreamClose(fcStream *s);
+// bytes of backward writes that were not applied because the consumer had peeked them
+fcAPI uint64_t        fcRingStreamGetDroppedPatchBytes(fcStream *s);
 fcAPI uint64_t        fcStreamGetWrittenSize(fcStream *s);
 
 fcAPI void            fcEnableAsyncReleaseContext(bool v);
@@ -104,6 +217,116 @@ fcAPI void            fcWaitAsyncDelete();
 fcAPI void            fcReleaseContext(fcContextBase *ctx);
 fcAPI void            fcSetOnDeleteCallback(fcContextBase *ctx, void(*cb)(void*), void *param);
 
+struct fcFrameStats
+{
+    uint64_t frames = 0;            // frames passed to the context
+    uint64_t dropped_frames = 0;    // frames discarded by backpressure policy
+    uint64_t late_frames = 0;       // frames that blocked the caller until the encoder caught up
+    uint64_t spilled_frames = 0;    // frames written to the spill file. see fcBackpressurePolicy::Spill
+};
+// return false if ctx doesn't take video frames (png, exr, audio contexts).
+fcAPI bool            fcGetFrameStats(fcContextBase *ctx, fcFrameStats *dst);
+
+struct fcLatencyStats
+{
+    uint64_t count = 0;
+    float p50 = 0.0f; // in milliseconds
+    float p99 = 0.0f;
+    float max = 0.0f;
+};
+
+#define fcMaxStatsStreams 8
+// counters are always on. they are cheap (a few relaxed atomic operations per frame and stage).
+struct fcContextStats
+{
+    uint64_t frames_submitted = 0;  // video frames (image contexts: images, audio contexts: addSamples() calls) passed to the context
+    uint64_t frames_encoded = 0;
+    uint64_t frames_written = 0;    // encoded frames passed to output streams
+    int queue_depth = 0;            // frames waiting for or being encoded
+    int peak_queue_depth = 0;
+    int num_streams = 0;
+    uint64_t stream_bytes[fcMaxStatsStreams] = {}; // bytes written to each output stream
+    uint64_t stream_pending_bytes[fcMaxStatsStreams] = {}; // bytes queued but not written yet by each output stream. see fcCreateAsyncStream()
+    fcLatencyStats readback;        // GPU texture -> CPU memory
+    fcLatencyStats convert;         // pixel format conversion
+    fcLatencyStats yuv;             // RGB -> YUV conversion
+    fcLatencyStats encode;          // includes convert and yuv if the encoder does them
+    fcLatencyStats write;           // mux and write to output streams
+    uint64_t memory_bytes = 0;      // frame data charged to the memory budget. see fcSetMemoryBudget()
+};
+// all contexts support this. return false if ctx is null.
+fcAPI bool            fcGetContextStats(fcContextBase *ctx, fcContextStats *dst);
+
+struct fcAsyncStreamConfig
+{
+    int max_queue_size = 64 * 1024 * 1024; // in bytes. lag_policy applies when queued data exceeds this
+    fcSinkLagPolicy lag_policy = fcSinkLagPolicy::Block;
+};
+struct fcAsyncStreamStats
+{
+    uint64_t queued_bytes = 0;      // waiting for the sink
+    uint64_t peak_queued_bytes = 0;
+    uint64_t written_bytes = 0;     // passed to the sink
+    uint64_t stalls = 0;            // writes that waited for the sink (fcSinkLagPolicy::Block)
+    fcLatencyStats lag;             // time from queuing data to the sink finishing its write
+    bool detached = false;          // cut off by fcSinkLagPolicy::Detach
+};
+// wrap sink so that writes are queued and passed to sink by a dedicated thread.
+// register the returned stream to contexts instead of sink, so that one slow sink doesn't stall other sinks and the encoder.
+// sink is referenced by the returned stream. release both as usual; releasing the returned stream waits for queued data.
+// once detached, writes are discarded and not counted as written (fcStreamGetWrittenSize(), fcContextStats::stream_bytes).
+fcAPI fcStream*       fcCreateAsyncStream(fcStream *sink, const fcAsyncStreamConfig *conf = nullptr);
+// return false if s is not created by fcCreateAsyncStream()
+fcAPI bool            fcGetAsyncStreamStats(fcStream *s, fcAsyncStreamStats *dst);
+
+// finalizing a context (flushing buffered frames, writing out index etc.) can take long.
+// fcReleaseContextAsync() finalizes ctx on the worker pool (regardless of fcEnableAsyncReleaseContext()) in parallel with others,
+// and returns a handle to poll / wait for it. the handle must be released by fcReleaseFinalizeHandle(). it can be released before completion.
+// fcWaitAsyncDelete() also waits for these.
+struct fcFinalizeHandle;
+// called on a worker thread. progress: 0.0 - 1.0. called with 1.0 exactly once when finalization is completed.
+typedef void(*fcFinalizeCallback)(void *userdata, float progress);
+fcAPI fcFinalizeHandle* fcReleaseContextAsync(fcContextBase *ctx, fcFinalizeCallback cb, void *userdata);
+fcAPI bool            fcFinalizeIsDone(fcFinalizeHandle *h);
+fcAPI float           fcFinalizeGetProgress(fcFinalizeHandle *h);
+// timeout_ms < 0: wait infinitely. return true if finalization is completed.
+fcAPI bool            fcFinalizeWait(fcFinalizeHandle *h, int timeout_ms);
+fcAPI void            fcReleaseFinalizeHandle(fcFinalizeHandle *h);
+
+// *Borrowed() variants of *Pixels() functions don't copy pixels. the encoder reads them directly and calls release
+// exactly once when it no longer needs them. until then, the caller must keep the pixels alive and unmodified.
+// release can be called on any thread, including inside the *Borrowed() call (e.g. the frame was dropped).
+// if a *Borrowed() function returns false, release is not called and the pixels are not referenced.
+typedef void(*fcReleasePixels)(void *userdata, const void *pixels);
+
+// encoded packets handed to callbacks registered by fcMP4AddPacketCallback() / fcWebMAddPacketCallback(),
+// for consumers that want elementary streams rather than a container. callbacks can be registered with or without output streams.
+enum class fcPacketCodec
+{
+    H264,   // one NAL unit without start code. SPS / PPS come in-band before keyframes
+    AAC,    // one raw access unit without ADTS header
+    VP8,
+    VP9,
+    Vorbis,
+    Opus,
+};
+struct fcPacket
+{
+    fcPacketCodec codec = fcPacketCodec::H264;
+    // points into the encoder's output buffer. valid only during the callback
+    const void *data = nullptr;
+    size_t size = 0;
+    fcTime timestamp = 0.0;
+    fcTime duration = 0.0; // 0 if unknown
+    bool keyframe = false;
+    // AAC AudioSpecificConfig, Vorbis / Opus headers in matroska CodecPrivate layout. null if the codec has none
+    const void *codec_private = nullptr;
+    size_t codec_private_size = 0;
+};
+// called on encoder threads, one call at a time per context. packets of a video frame come in a row.
+// the callback must not add frames to or release the context.
+typedef void(*fcPacketCallback)(void *userdata, const fcPacket *packet);
+
 
 // -------------------------------------------------------------
 // PNG Exporter
@@ -122,12 +345,15 @@ struct fcPngConfig
 {
     fcPngPixelFormat pixel_format = fcPngPixelFormat::Auto;
     int max_tasks = 4;
+    fcTaskPriority priority = fcTaskPriority::Background;
+    fcBackpressurePolicy backpressure = fcBackpressurePolicy::Block; // Spill or Block. others are treated as Block
 };
 
 fcAPI bool            fcPngIsSupported();
 fcAPI fcIPngContext*  fcPngCreateContext(const fcPngConfig *conf = nullptr);
 fcAPI bool            fcPngExportPixels(fcIPngContext *ctx, const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, int num_channels = 0);
 fcAPI bool            fcPngExportTexture(fcIPngContext *ctx, const char *path, void *tex, int width, int height, fcPixelFormat fmt, int num_channels = 0);
+fcAPI bool            fcPngExportPixelsBorrowed(fcIPngContext *ctx, const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, int num_channels, fcReleasePixels release, void *userdata);
 
 
 // -------------------------------------------------------------
@@ -158,6 +384,7 @@ struct fcExrConfig
     fcExrPixelFormat pixel_format = fcExrPixelFormat::Auto;
     fcExrCompression compression = fcExrCompression::Zip;
     int max_tasks = 4;
+    fcTaskPriority priority = fcTaskPriority::Background;
 };
 
 fcAPI bool            fcExrIsSupported();
@@ -166,6 +393,8 @@ fcAPI bool            fcExrBeginImage(fcIExrContext *ctx, const char *path, int
 fcAPI bool            fcExrAddLayerPixels(fcIExrContext *ctx, const void *pixels, fcPixelFormat fmt, int ch, const char *name);
 fcAPI bool            fcExrAddLayerTexture(fcIExrContext *ctx, void *tex, fcPixelFormat fmt, int ch, const char *name);
 fcAPI bool            fcExrEndImage(fcIExrContext *ctx);
+// pixels are released after the image is written. layers that need conversion are copied and released immediately.
+fcAPI bool            fcExrAddLayerPixelsBorrowed(fcIExrContext *ctx, const void *pixels, fcPixelFormat fmt, int ch, const char *name, fcReleasePixels release, void *userdata);
 
 
 // -------------------------------------------------------------
@@ -181,6 +410,9 @@ struct fcGifConfig
     int num_colors = 256;
     int keyframe_interval = 30;
     int max_tasks = 8;
+    fcTaskPriority priority = fcTaskPriority::Normal;
+    fcBackpressurePolicy backpressure = fcBackpressurePolicy::Block;
+    int backpressure_memory_limit = 256; // in MB
 };
 
 fcAPI bool            fcGifIsSupported();
@@ -190,6 +422,7 @@ fcAPI void            fcGifAddOutputStream(fcIGifContext *ctx, fcStream *stream)
 fcAPI bool            fcGifAddFramePixels(fcIGifContext *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1.0);
 // timestamp=-1 is treated as current time.
 fcAPI bool            fcGifAddFrameTexture(fcIGifContext *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp = -1.0);
+fcAPI bool            fcGifAddFramePixelsBorrowed(fcIGifContext *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata);
 // force next frame to update palette
 fcAPI void            fcGifForceKeyframe(fcIGifContext *ctx);
 
@@ -235,6 +468,11 @@ struct fcMP4Config
     int audio_target_bitrate = 128 * 1000;
     int audio_flags = fcMP4_AACMask; // combination of fcMP4AudioFlags
     int audio_max_tasks = 4;
+
+    fcTaskPriority priority = fcTaskPriority::RealTime;
+    // applied to video frames. audio samples are never dropped: with policies other than Block, audio buffers just grow.
+    fcBackpressurePolicy backpressure = fcBackpressurePolicy::Block;
+    int backpressure_memory_limit = 512; // in MB
 };
 
 fcAPI bool            fcMP4IsSupported();
@@ -245,10 +483,13 @@ fcAPI fcIMP4Context*  fcMP4OSCreateContext(fcMP4Config *conf, const char *out_pa
 fcAPI const char*     fcMP4GetVideoEncoderInfo(fcIMP4Context *ctx);
 fcAPI const char*     fcMP4GetAudioEncoderInfo(fcIMP4Context *ctx);
 fcAPI void            fcMP4AddOutputStream(fcIMP4Context *ctx, fcStream *stream);
+// register before adding frames. contexts by fcMP4OSCreateContext() write the file by themselves and never call cb.
+fcAPI void            fcMP4AddPacketCallback(fcIMP4Context *ctx, fcPacketCallback cb, void *userdata);
 // timestamp=-1 is treated as current time.
 fcAPI bool            fcMP4AddVideoFramePixels(fcIMP4Context *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1.0);
 // timestamp=-1 is treated as current time.
 fcAPI bool            fcMP4AddVideoFrameTexture(fcIMP4Context *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp = -1.0);
+fcAPI bool            fcMP4AddVideoFramePixelsBorrowed(fcIMP4Context *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata);
 fcAPI bool            fcMP4AddAudioSamples(fcIMP4Context *ctx, const float *samples, int num_samples);
 
 
@@ -289,15 +530,26 @@ struct fcWebMConfig
     fcBitrateMode audio_bitrate_mode = fcBitrateMode::VBR;
     int audio_target_bitrate = 128 * 1000;
     int audio_max_tasks = 4;
+
+    fcTaskPriority priority = fcTaskPriority::RealTime;
+    // applied to video frames. audio samples are never dropped: with policies other than Block, audio buffers just grow.
+    fcBackpressurePolicy backpressure = fcBackpressurePolicy::Block;
+    int backpressure_memory_limit = 512; // in MB
+
+    // matroska live mode: append-only output without cues or size patch-ups, for fcCreateRingStream() and other streams that can't seek back
+    bool live = false;
 };
 
 fcAPI bool            fcWebMIsSupported();
 fcAPI fcIWebMContext* fcWebMCreateContext(fcWebMConfig *conf);
 fcAPI void            fcWebMAddOutputStream(fcIWebMContext *ctx, fcStream *stream);
+// register before adding frames.
+fcAPI void            fcWebMAddPacketCallback(fcIWebMContext *ctx, fcPacketCallback cb, void *userdata);
 // timestamp=-1 is treated as current time.
 fcAPI bool            fcWebMAddVideoFramePixels(fcIWebMContext *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1.0);
 // timestamp=-1 is treated as current time.
 fcAPI bool            fcWebMAddVideoFrameTexture(fcIWebMContext *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp = -1.0);
+fcAPI bool            fcWebMAddVideoFramePixelsBorrowed(fcIWebMContext *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcReleasePixels release, void *userdata);
 fcAPI bool            fcWebMAddAudioSamples(fcIWebMContext *ctx, const float *samples, int num_samples);
 
 
@@ -334,6 +586,7 @@ struct fcOggConfig
     fcBitrateMode bitrate_mode = fcBitrateMode::VBR;
     int target_bitrate = 128 * 1000;
     int max_tasks = 4;
+    fcTaskPriority priority = fcTaskPriority::RealTime;
 };
 fcAPI bool            fcOggIsSupported();
 fcAPI fcIOggContext*  fcOggCreateContext(fcOggConfig *conf);
@@ -356,6 +609,7 @@ struct fcFlacConfig
     int block_size = 0;
     bool verify = false;
     int max_tasks = 4;
+    fcTaskPriority priority = fcTaskPriority::RealTime;
 };
 fcAPI bool            fcFlacIsSupported();
 fcAPI fcIFlacContext* fcFlacCreateContext(fcFlacConfig *conf);